@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+
+/*! Counts heap allocations made through the global operator new on the
+ * calling thread. Used by the benchmarks to report allocations per cycle.
+ */
+size_t thread_allocation_count();
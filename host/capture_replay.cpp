@@ -0,0 +1,34 @@
+#include "capture_replay.hpp"
+
+#include <algorithm>
+#include <thread>
+
+capture_replay::capture_replay(udp_capture_reader& reader, double speed)
+    : _reader{reader}, _speed{speed} {}
+
+std::optional<hub_datagram>
+capture_replay::receive(std::span<uint8_t> buffer) {
+  const auto record = _reader.next();
+  if (!record || record->data.size() > buffer.size()) {
+    return std::nullopt;
+  }
+
+  if (_speed > 0) {
+    if (!_start) {
+      _start = clock::now();
+    }
+    _elapsed += record->delay / _speed;
+    _due_time =
+        *_start +
+        std::chrono::duration_cast<clock::duration>(_elapsed);
+    std::this_thread::sleep_until(_due_time);
+  } else {
+    _due_time = clock::now();
+  }
+
+  std::copy(record->data.begin(), record->data.end(), buffer.begin());
+  return hub_datagram{
+      .hub = record->hub,
+      .data = buffer.first(record->data.size()),
+  };
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "hub_demultiplexer.hpp"
+#include "udp_capture.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+/*! Stands in for the hub_demultiplexer's socket and hands out the datagrams
+ * of a capture, either with their original spacing scaled by the speed or as
+ * fast as possible.
+ */
+class capture_replay {
+public:
+  using clock = std::chrono::steady_clock;
+
+  /*! A speed of 1 replays in real time, 0 as fast as possible
+   */
+  capture_replay(udp_capture_reader& reader, double speed);
+
+  /*! Copies the next datagram into the buffer once it's due like
+   * hub_demultiplexer::receive. Returns std::nullopt at the end of the
+   * capture.
+   */
+  std::optional<hub_datagram> receive(std::span<uint8_t> buffer);
+
+  /*! When the datagram last returned by receive() was due, which is the
+   * time it was returned when replaying as fast as possible
+   */
+  clock::time_point due_time() const { return _due_time; }
+
+private:
+  udp_capture_reader& _reader;
+  double _speed;
+  std::optional<clock::time_point> _start;
+  std::chrono::duration<double, std::micro> _elapsed{0};
+  clock::time_point _due_time{};
+};
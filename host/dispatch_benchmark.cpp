@@ -0,0 +1,93 @@
+// Measures the cost of dispatching incoming messages through the
+// subscription table used by mqtt_client::notify_data.
+//
+// Usage: dispatch_benchmark [--subscriptions N] [--wildcards N]
+//                           [--iterations N]
+
+#include "allocation_counter.hpp"
+#include "subscription_table.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+struct options {
+  size_t subscriptions{500};
+  size_t wildcards{50};
+  size_t iterations{1000000};
+};
+
+options parse_options(int argc, char** argv) {
+  options result;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const auto name = std::string_view{argv[i]};
+    const auto value = std::strtoul(argv[i + 1], nullptr, 10);
+    if (name == "--subscriptions") {
+      result.subscriptions = value;
+    } else if (name == "--wildcards") {
+      result.wildcards = value;
+    } else if (name == "--iterations") {
+      result.iterations = value;
+    } else {
+      std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const auto options = parse_options(argc, argv);
+
+  size_t calls = 0;
+  const auto callback = [&](std::string_view) { calls++; };
+
+  subscription_table table;
+  for (size_t i = 0; i < options.subscriptions; i++) {
+    table = table.with("simarine_esp/device_" + std::to_string(i) + "/set",
+                       callback);
+  }
+  for (size_t i = 0; i < options.wildcards; i++) {
+    table = table.with("simarine_esp/group_" + std::to_string(i) + "/+/set",
+                       callback);
+  }
+  table = table.with("homeassistant/#", callback);
+
+  std::vector<std::string> topics;
+  for (size_t i = 0; i < 64; i++) {
+    topics.push_back("simarine_esp/device_" +
+                     std::to_string(i * 7 % options.subscriptions) + "/set");
+    topics.push_back("simarine_esp/group_" +
+                     std::to_string(i % options.wildcards) + "/x/set");
+    topics.push_back("homeassistant/status");
+    topics.push_back("unrelated/topic/without/subscribers");
+  }
+
+  const auto allocations_before = thread_allocation_count();
+  const auto start_time = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < options.iterations; i++) {
+    table.dispatch(topics[i % topics.size()], "payload");
+  }
+
+  const auto elapsed = std::chrono::steady_clock::now() - start_time;
+  const auto allocations = thread_allocation_count() - allocations_before;
+
+  std::printf("subscriptions:            %zu\n", table.size());
+  std::printf("dispatches:               %zu\n", options.iterations);
+  std::printf("callbacks called:         %zu\n", calls);
+  std::printf("ns per dispatch:          %.1f\n",
+              std::chrono::duration<double, std::nano>{elapsed}.count() /
+                  double(options.iterations));
+  std::printf("allocations per dispatch: %.2f\n",
+              double(allocations) / double(options.iterations));
+
+  return EXIT_SUCCESS;
+}
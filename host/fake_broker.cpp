@@ -0,0 +1,48 @@
+#include "fake_broker.hpp"
+
+fake_broker& fake_broker::instance() {
+  static fake_broker broker;
+  return broker;
+}
+
+bool fake_broker::publish(std::string_view topic, std::string_view data,
+                          mqtt_qos, bool) {
+  _message_count++;
+  _byte_count += topic.size() + data.size();
+
+  std::shared_ptr<const handlers> current;
+  {
+    std::unique_lock lock{_mutex};
+    current = _handlers;
+  }
+
+  // Callbacks may publish or subscribe themselves
+  if (current->observer) {
+    current->observer(topic, data);
+  }
+  for (const auto& subscription : current->subscriptions) {
+    if (topic_matches(subscription.topic, topic)) {
+      subscription.callback(topic, data);
+    }
+  }
+  return true;
+}
+
+void fake_broker::subscribe(std::string topic, message_callback callback) {
+  std::unique_lock lock{_mutex};
+  auto updated = std::make_shared<handlers>(*_handlers);
+  updated->subscriptions.push_back({std::move(topic), std::move(callback)});
+  _handlers = std::move(updated);
+}
+
+void fake_broker::set_publish_observer(message_callback observer) {
+  std::unique_lock lock{_mutex};
+  auto updated = std::make_shared<handlers>(*_handlers);
+  updated->observer = std::move(observer);
+  _handlers = std::move(updated);
+}
+
+void fake_broker::reset_statistics() {
+  _message_count = 0;
+  _byte_count = 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "mqtt_client.hpp"
+#include "subscription_table.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*! In-process stand-in for an MQTT broker used by the host build of
+ * mqtt_client. Doesn't store published messages, it only counts them and
+ * forwards them to the observer and to matching subscribers so that it
+ * doesn't distort allocation measurements.
+ */
+class fake_broker {
+public:
+  using message_callback =
+      std::function<void(std::string_view topic, std::string_view data)>;
+
+  static fake_broker& instance();
+
+  bool publish(std::string_view topic, std::string_view data, mqtt_qos qos,
+               bool retain);
+
+  void subscribe(std::string topic, message_callback callback);
+
+  /*! Called for every published message on the publishing thread
+   */
+  void set_publish_observer(message_callback observer);
+
+  size_t message_count() const { return _message_count; }
+  size_t byte_count() const { return _byte_count; }
+
+  void reset_statistics();
+
+private:
+  struct subscription {
+    std::string topic;
+    message_callback callback;
+  };
+
+  /*! Replaced instead of modified, so publish() can call the callbacks
+   * without holding the lock and without copying them
+   */
+  struct handlers {
+    message_callback observer;
+    std::vector<subscription> subscriptions;
+  };
+
+  std::atomic<size_t> _message_count{0};
+  std::atomic<size_t> _byte_count{0};
+
+  std::mutex _mutex;
+  std::shared_ptr<const handlers> _handlers{std::make_shared<handlers>()};
+};
@@ -0,0 +1,177 @@
+// Runs the sensor pipeline against several simulated Simarine hubs that share
+// one UDP socket through the hub_demultiplexer and reports how the cost per
+// datagram scales with the number of hubs.
+//
+// Usage: hub_benchmark [--hubs N] [--devices N] [--seconds N]
+//                      [--window-ms N] [--broadcast-us N]
+
+#include "fake_broker.hpp"
+#include "home_assistant_publisher.hpp"
+#include "hub_demultiplexer.hpp"
+#include "mqtt_client.hpp"
+#include "simarine_simulator.hpp"
+
+#include "spymarine/buffer.hpp"
+#include "spymarine/read_devices.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+struct options {
+  size_t hubs{2};
+  size_t devices_per_type{3};
+  std::chrono::seconds duration{10};
+  std::chrono::milliseconds window{1000};
+  std::chrono::microseconds broadcast_interval{10ms};
+};
+
+options parse_options(int argc, char** argv) {
+  options result;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const auto name = std::string_view{argv[i]};
+    const auto value = std::strtoul(argv[i + 1], nullptr, 10);
+    if (name == "--hubs") {
+      result.hubs = value;
+    } else if (name == "--devices") {
+      result.devices_per_type = value;
+    } else if (name == "--seconds") {
+      result.duration = std::chrono::seconds{value};
+    } else if (name == "--window-ms") {
+      result.window = std::chrono::milliseconds{value};
+    } else if (name == "--broadcast-us") {
+      result.broadcast_interval = std::chrono::microseconds{value};
+    } else {
+      std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  return result;
+}
+
+double cpu_seconds() { return double(std::clock()) / CLOCKS_PER_SEC; }
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const auto options = parse_options(argc, argv);
+
+  // Hubs answer on 127.0.0.2, 127.0.0.3, ... so that 127.0.0.1 stays free
+  std::vector<std::unique_ptr<simarine_simulator>> simulators;
+  for (size_t i = 0; i < options.hubs; i++) {
+    simulators.push_back(
+        std::make_unique<simarine_simulator>(simarine_simulator::config{
+            .battery_count = options.devices_per_type,
+            .tank_count = options.devices_per_type,
+            .temperature_count = options.devices_per_type,
+            .address = uint32_t(0x7f000002 + i),
+            .broadcast_interval = options.broadcast_interval,
+        }));
+    simulators.back()->start();
+  }
+
+  const auto ips = discover_hubs(2s, options.hubs);
+  if (ips.size() != options.hubs) {
+    std::fprintf(stderr, "Discovered %zu of %zu hubs\n", ips.size(),
+                 options.hubs);
+    return EXIT_FAILURE;
+  }
+
+  spymarine::buffer buffer;
+  std::vector<std::vector<spymarine::device>> devices;
+  devices.reserve(ips.size());
+  for (const auto ip : ips) {
+    auto hub_devices = spymarine::read_devices<spymarine::tcp_socket>(
+        buffer, ip, spymarine::simarine_default_tcp_port,
+        spymarine::filter_by_device_type<spymarine::temperature_device,
+                                         spymarine::tank_device,
+                                         spymarine::battery_device>{});
+    if (!hub_devices) {
+      std::fprintf(stderr, "Failed to read devices: %s\n",
+                   spymarine::error_message(hub_devices.error()).c_str());
+      return EXIT_FAILURE;
+    }
+    devices.push_back(std::move(*hub_devices));
+  }
+
+  aggregation_config aggregation;
+  aggregation.defaults.window = options.window;
+  hub_demultiplexer demultiplexer{aggregation};
+  if (!demultiplexer.open()) {
+    return EXIT_FAILURE;
+  }
+
+  mqtt_client client{esp_mqtt_client_config_t{}};
+  client.start();
+
+  std::vector<std::unique_ptr<home_assistant_publisher>> publishers;
+  for (size_t i = 0; i < ips.size(); i++) {
+    demultiplexer.add_hub(ips[i], devices[i]);
+    publishers.push_back(std::make_unique<home_assistant_publisher>(
+        client, sensor_publish_mode::all, delta_publish_config{}));
+    publishers.back()->set_device_namespace("hub_" +
+                                            std::to_string(ips[i] & 0xff));
+  }
+
+  auto& broker = fake_broker::instance();
+  broker.reset_statistics();
+
+  size_t datagrams = 0;
+  size_t windows = 0;
+  const auto cpu_start = cpu_seconds();
+  const auto start_time = std::chrono::steady_clock::now();
+  const auto end_time = start_time + options.duration;
+
+  while (std::chrono::steady_clock::now() < end_time) {
+    const auto completed_hub = demultiplexer.read_and_update();
+    if (!completed_hub) {
+      std::fprintf(stderr, "Failed to read sensor values: %s\n",
+                   spymarine::error_message(completed_hub.error()).c_str());
+      return EXIT_FAILURE;
+    }
+    datagrams++;
+
+    if (*completed_hub) {
+      publishers[**completed_hub]->publish_sensor_values(
+          demultiplexer.aggregated_devices(**completed_hub),
+          demultiplexer.completed_devices(**completed_hub));
+      windows++;
+    }
+  }
+
+  const auto cpu_time = cpu_seconds() - cpu_start;
+  const auto elapsed = std::chrono::duration<double>{
+      std::chrono::steady_clock::now() - start_time}
+                           .count();
+  for (auto& simulator : simulators) {
+    simulator->stop();
+  }
+
+  size_t total_devices = 0;
+  for (const auto& hub_devices : devices) {
+    total_devices += hub_devices.size();
+  }
+
+  std::printf("hubs:                     %zu\n", ips.size());
+  std::printf("devices:                  %zu\n", total_devices);
+  std::printf("datagrams per second:     %.1f\n", double(datagrams) / elapsed);
+  std::printf("unknown datagrams:        %zu\n",
+              demultiplexer.unknown_datagrams());
+  std::printf("windows published:        %zu\n", windows);
+  std::printf("messages per second:      %.1f\n",
+              double(broker.message_count()) / elapsed);
+  std::printf("cpu per datagram (us):    %.2f\n",
+              datagrams > 0 ? cpu_time * 1e6 / double(datagrams) : 0.0);
+  std::printf("cpu utilization:          %.1f%%\n", cpu_time / elapsed * 100);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// Host stand-in for esp-idf's logging API. Writes to stderr and only logs
+// messages at or above the level set with esp_log_level_set("*", level).
+
+#include <cstdarg>
+#include <cstdio>
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+inline esp_log_level_t g_esp_log_level = ESP_LOG_WARN;
+
+inline void esp_log_level_set(const char*, esp_log_level_t level) {
+  g_esp_log_level = level;
+}
+
+inline void esp_log_write(esp_log_level_t level, const char* tag,
+                          const char* format, ...) {
+  if (level > g_esp_log_level) {
+    return;
+  }
+
+  constexpr const char level_letters[] = "NEWIDV";
+  std::fprintf(stderr, "%c (%s) ", level_letters[level], tag);
+
+  va_list list;
+  va_start(list, format);
+  std::vfprintf(stderr, format, list);
+  va_end(list);
+
+  std::fputc('\n', stderr);
+}
+
+#define ESP_LOGE(tag, format, ...)                                             \
+  esp_log_write(ESP_LOG_ERROR, tag, format __VA_OPT__(, ) __VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)                                             \
+  esp_log_write(ESP_LOG_WARN, tag, format __VA_OPT__(, ) __VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)                                             \
+  esp_log_write(ESP_LOG_INFO, tag, format __VA_OPT__(, ) __VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)                                             \
+  esp_log_write(ESP_LOG_DEBUG, tag, format __VA_OPT__(, ) __VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)                                             \
+  esp_log_write(ESP_LOG_VERBOSE, tag, format __VA_OPT__(, ) __VA_ARGS__)
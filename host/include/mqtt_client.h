@@ -0,0 +1,21 @@
+#pragma once
+
+// Host stand-ins for the esp-mqtt types referenced by main/mqtt_client.hpp.
+// The host implementation of mqtt_client in host/mqtt_client.cpp doesn't use
+// them beyond storing the config.
+
+#include <cstdint>
+
+typedef const char* esp_event_base_t;
+typedef void* esp_event_handler_instance_t;
+
+struct esp_mqtt_client;
+typedef struct esp_mqtt_client* esp_mqtt_client_handle_t;
+
+typedef struct {
+  struct {
+    struct {
+      const char* uri;
+    } address;
+  } broker;
+} esp_mqtt_client_config_t;
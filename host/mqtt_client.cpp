@@ -0,0 +1,74 @@
+// Host implementation of mqtt_client that talks to the in-process
+// fake_broker instead of esp-mqtt.
+
+#include "mqtt_client.hpp"
+#include "fake_broker.hpp"
+
+mqtt_client::mqtt_client(esp_mqtt_client_config_t config)
+    : _config{std::move(config)}, _client{nullptr} {}
+
+mqtt_client::~mqtt_client() = default;
+
+void mqtt_client::set_availability(const char* topic, const char* online,
+                                   const char*) {
+  _availability_topic = topic;
+  _availability_online = online;
+}
+
+void mqtt_client::start() {
+  _started = true;
+  if (_availability_topic) {
+    fake_broker::instance().publish(_availability_topic,
+                                    _availability_online,
+                                    mqtt_qos::at_least_once, true);
+  }
+  _connected = true;
+  notify_connection({.connected = true, .session_present = false});
+}
+
+bool mqtt_client::publish(const char* topic, const std::string_view data,
+                          mqtt_qos qos, const bool retain) {
+  if (!_started) {
+    return false;
+  }
+  return fake_broker::instance().publish(topic, data, qos, retain);
+}
+
+bool mqtt_client::subscribe(const char* topic, mqtt_qos,
+                            subscribe_callback callback) {
+  {
+    std::unique_lock lock{_subscribe_mutex};
+    _subscriptions = std::make_shared<const subscription_table>(
+        _subscriptions.load()->with(topic, std::move(callback)));
+  }
+  fake_broker::instance().subscribe(
+      topic, [this](std::string_view topic, std::string_view data) {
+        notify_data(topic, data);
+      });
+  return true;
+}
+
+uint32_t mqtt_client::add_connection_callback(connection_callback callback) {
+  std::unique_lock lock{_connection_mutex};
+  const auto id = _next_connection_callback_id++;
+  _connection_callbacks.emplace_back(id, std::move(callback));
+  return id;
+}
+
+void mqtt_client::remove_connection_callback(const uint32_t id) {
+  std::unique_lock lock{_connection_mutex};
+  std::erase_if(_connection_callbacks,
+                [&](const auto& entry) { return entry.first == id; });
+}
+
+void mqtt_client::notify_connection(const mqtt_connection_event& event) {
+  std::unique_lock lock{_connection_mutex};
+  for (const auto& [id, callback] : _connection_callbacks) {
+    callback(event);
+  }
+}
+
+void mqtt_client::notify_data(std::string_view topic, std::string_view data) {
+  const auto subscriptions = _subscriptions.load();
+  subscriptions->dispatch(topic, data);
+}
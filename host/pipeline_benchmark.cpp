@@ -0,0 +1,237 @@
+// Runs the sensor pipeline against a simulated Simarine device and the
+// in-process MQTT broker and reports throughput, latency and allocations.
+//
+// Usage: pipeline_benchmark [--devices N] [--seconds N] [--window-ms N]
+//                           [--broadcast-us N]
+//                           [--mode all|changed|aggregated] [--async 0|1]
+//                           [--reduction mean|min|max|ema|last]
+
+#include "allocation_counter.hpp"
+#include "fake_broker.hpp"
+#include "home_assistant_publisher.hpp"
+#include "mqtt_client.hpp"
+#include "mqtt_publish_queue.hpp"
+#include "sensor_aggregator.hpp"
+#include "simarine_simulator.hpp"
+
+#include "spymarine/buffer.hpp"
+#include "spymarine/discover.hpp"
+#include "spymarine/read_devices.hpp"
+#include "spymarine/sensor_reader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+struct options {
+  size_t devices_per_type{3};
+  std::chrono::seconds duration{10};
+  std::chrono::milliseconds window{1000};
+  std::chrono::microseconds broadcast_interval{10ms};
+  sensor_publish_mode mode{sensor_publish_mode::all};
+  bool async{false};
+  sensor_reduction reduction{sensor_reduction::mean};
+};
+
+options parse_options(int argc, char** argv) {
+  options result;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const auto name = std::string_view{argv[i]};
+    const auto value = std::strtoul(argv[i + 1], nullptr, 10);
+    if (name == "--devices") {
+      result.devices_per_type = value;
+    } else if (name == "--seconds") {
+      result.duration = std::chrono::seconds{value};
+    } else if (name == "--window-ms") {
+      result.window = std::chrono::milliseconds{value};
+    } else if (name == "--broadcast-us") {
+      result.broadcast_interval = std::chrono::microseconds{value};
+    } else if (name == "--async") {
+      result.async = value != 0;
+    } else if (name == "--reduction") {
+      const auto reduction = std::string_view{argv[i + 1]};
+      result.reduction = reduction == "min"    ? sensor_reduction::minimum
+                         : reduction == "max"  ? sensor_reduction::maximum
+                         : reduction == "ema"  ? sensor_reduction::ema
+                         : reduction == "last" ? sensor_reduction::last
+                                               : sensor_reduction::mean;
+    } else if (name == "--mode") {
+      const auto mode = std::string_view{argv[i + 1]};
+      result.mode = mode == "changed"      ? sensor_publish_mode::changed
+                    : mode == "aggregated" ? sensor_publish_mode::aggregated
+                                           : sensor_publish_mode::all;
+    } else {
+      std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  return result;
+}
+
+double percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[size_t(p * double(values.size() - 1))];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const auto options = parse_options(argc, argv);
+
+  simarine_simulator simulator{{
+      .battery_count = options.devices_per_type,
+      .tank_count = options.devices_per_type,
+      .temperature_count = options.devices_per_type,
+      .broadcast_interval = options.broadcast_interval,
+  }};
+  simulator.start();
+
+  spymarine::buffer buffer;
+  auto devices = spymarine::discover().and_then([&](const auto ip) {
+    return spymarine::read_devices<spymarine::tcp_socket>(
+        buffer, ip, spymarine::simarine_default_tcp_port,
+        spymarine::filter_by_device_type<spymarine::temperature_device,
+                                         spymarine::tank_device,
+                                         spymarine::battery_device>{});
+  });
+  if (!devices) {
+    std::fprintf(stderr, "Failed to read devices: %s\n",
+                 spymarine::error_message(devices.error()).c_str());
+    return EXIT_FAILURE;
+  }
+
+  auto sensor_reader = spymarine::make_sensor_reader(buffer, *devices);
+  if (!sensor_reader) {
+    std::fprintf(stderr, "Failed to make sensor reader: %s\n",
+                 spymarine::error_message(sensor_reader.error()).c_str());
+    return EXIT_FAILURE;
+  }
+
+  aggregation_config aggregation;
+  aggregation.defaults = {.window = options.window,
+                          .reduction = options.reduction};
+  sensor_aggregator aggregator{aggregation, *devices};
+
+  mqtt_client client{esp_mqtt_client_config_t{}};
+  client.start();
+
+  delta_publish_config delta_config;
+  delta_config.set_deadband<spymarine::temperature_device>({.absolute = 0.2f});
+  delta_config.set_deadband<spymarine::tank_device>({.absolute = 1.0f});
+  delta_config.set_deadband<spymarine::battery_device>({.relative = 0.01f});
+
+  home_assistant_publisher publisher{client, options.mode, delta_config};
+  mqtt_publish_queue publish_queue{client};
+  if (options.async) {
+    publish_queue.start();
+    publisher.set_publish_queue(&publish_queue);
+  }
+  publisher.send_device_discovery(*devices);
+
+  // Latency from the most recent UDP datagram to each published message,
+  // recorded on the publishing task
+  const auto max_windows = size_t(options.duration / options.window) + 16;
+  std::vector<double> latencies_us(max_windows * (devices->size() + 1));
+  std::atomic<size_t> latency_count{0};
+
+  auto& broker = fake_broker::instance();
+  broker.set_publish_observer([&](std::string_view, std::string_view) {
+    const auto latency =
+        std::chrono::steady_clock::now() - simulator.last_datagram_time();
+    if (const auto index = latency_count++; index < latencies_us.size()) {
+      latencies_us[index] =
+          std::chrono::duration<double, std::micro>{latency}.count();
+    }
+  });
+  broker.reset_statistics();
+
+  std::vector<double> publish_durations_us;
+  publish_durations_us.reserve(max_windows);
+  size_t publish_allocations = 0;
+
+  size_t windows = 0;
+  const auto datagrams_before = simulator.datagrams_sent();
+  const auto allocations_before = thread_allocation_count();
+  const auto start_time = std::chrono::steady_clock::now();
+  const auto end_time = start_time + options.duration;
+
+  while (std::chrono::steady_clock::now() < end_time) {
+    const auto result = sensor_reader->read_and_update();
+    if (!result) {
+      std::fprintf(stderr, "Failed to read sensor values: %s\n",
+                   spymarine::error_message(result.error()).c_str());
+      return EXIT_FAILURE;
+    }
+
+    if (aggregator.update()) {
+      const auto publish_allocations_before = thread_allocation_count();
+      const auto publish_start = std::chrono::steady_clock::now();
+      publisher.publish_sensor_values(aggregator.devices(),
+                                      aggregator.completed());
+      const auto publish_end = std::chrono::steady_clock::now();
+
+      // The first publish sizes the publisher's per device state
+      if (windows > 0) {
+        publish_allocations +=
+            thread_allocation_count() - publish_allocations_before;
+      }
+      publish_durations_us.push_back(
+          std::chrono::duration<double, std::micro>{publish_end -
+                                                    publish_start}
+              .count());
+
+      windows++;
+    }
+  }
+
+  const auto allocations = thread_allocation_count() - allocations_before;
+  broker.set_publish_observer(nullptr);
+  latencies_us.resize(std::min(latency_count.load(), latencies_us.size()));
+  const auto elapsed = std::chrono::duration<double>{
+      std::chrono::steady_clock::now() - start_time}
+                           .count();
+  simulator.stop();
+
+  std::printf("devices:                  %zu\n", devices->size());
+  std::printf("datagrams received:       %zu\n",
+              simulator.datagrams_sent() - datagrams_before);
+  std::printf("windows published:        %zu\n", windows);
+  std::printf("messages per second:      %.1f\n",
+              double(broker.message_count()) / elapsed);
+  std::printf("bytes per second:         %.1f\n",
+              double(broker.byte_count()) / elapsed);
+  std::printf("udp to publish p50 (us):  %.1f\n",
+              percentile(latencies_us, 0.5));
+  std::printf("udp to publish p99 (us):  %.1f\n",
+              percentile(latencies_us, 0.99));
+  std::printf("publish p50 (us):         %.1f\n",
+              percentile(publish_durations_us, 0.5));
+  std::printf("publish p99 (us):         %.1f\n",
+              percentile(publish_durations_us, 0.99));
+  if (options.async) {
+    const auto statistics = publish_queue.get_statistics();
+    std::printf("queued / dropped:         %zu / %zu\n", statistics.enqueued,
+                statistics.dropped);
+  }
+  std::printf("allocations per cycle:    %.1f\n",
+              windows > 0 ? double(allocations) / double(windows) : 0.0);
+  std::printf("allocations per publish:  %zu\n", publish_allocations);
+
+  if (publish_allocations != 0) {
+    std::fprintf(stderr, "Publishing sensor values allocated memory\n");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
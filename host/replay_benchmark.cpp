@@ -0,0 +1,187 @@
+// Replays a capture recorded with udp_recorder through the hub_demultiplexer
+// and the publishers and reports throughput and latency. The capture makes
+// runs repeatable, e.g. to compare parsing and aggregation between releases
+// on the traffic of real boats.
+//
+// Usage: replay_benchmark --input FILE [--speed X] [--repeat N]
+//                         [--window-ms N]
+//                         [--mode all|changed|aggregated|binary]
+//
+// A speed of 0, the default, replays as fast as possible, 1 in real time.
+
+#include "capture_replay.hpp"
+#include "fake_broker.hpp"
+#include "home_assistant_publisher.hpp"
+#include "hub_demultiplexer.hpp"
+#include "mqtt_client.hpp"
+#include "udp_capture.hpp"
+
+#include "spymarine/buffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+struct options {
+  std::string input;
+  double speed{0.0};
+  size_t repeat{1};
+  std::chrono::milliseconds window{1000};
+  sensor_publish_mode mode{sensor_publish_mode::all};
+};
+
+options parse_options(int argc, char** argv) {
+  options result;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const auto name = std::string_view{argv[i]};
+    const auto value = std::string_view{argv[i + 1]};
+    if (name == "--input") {
+      result.input = value;
+    } else if (name == "--speed") {
+      result.speed = std::strtod(argv[i + 1], nullptr);
+    } else if (name == "--repeat") {
+      result.repeat =
+          std::max<size_t>(std::strtoul(argv[i + 1], nullptr, 10), 1);
+    } else if (name == "--window-ms") {
+      result.window =
+          std::chrono::milliseconds{std::strtoul(argv[i + 1], nullptr, 10)};
+    } else if (name == "--mode") {
+      result.mode = value == "changed"      ? sensor_publish_mode::changed
+                    : value == "aggregated" ? sensor_publish_mode::aggregated
+                    : value == "binary"     ? sensor_publish_mode::binary
+                                            : sensor_publish_mode::all;
+    } else {
+      std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  if (result.input.empty()) {
+    std::fprintf(stderr, "Missing --input\n");
+    std::exit(EXIT_FAILURE);
+  }
+  return result;
+}
+
+double percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[size_t(p * double(values.size() - 1))];
+}
+
+double cpu_seconds() { return double(std::clock()) / CLOCKS_PER_SEC; }
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const auto options = parse_options(argc, argv);
+
+  const auto file = std::fopen(options.input.c_str(), "rb");
+  if (!file) {
+    std::fprintf(stderr, "Failed to open %s\n", options.input.c_str());
+    return EXIT_FAILURE;
+  }
+  auto reader = open_udp_capture(file);
+  if (!reader) {
+    std::fprintf(stderr, "%s isn't a capture of version %u\n",
+                 options.input.c_str(), unsigned(udp_capture_version));
+    return EXIT_FAILURE;
+  }
+
+  // The demultiplexer updates the devices in place
+  auto hubs = reader->hubs();
+
+  aggregation_config aggregation;
+  aggregation.defaults.window = options.window;
+  hub_demultiplexer demultiplexer{aggregation};
+
+  mqtt_client client{esp_mqtt_client_config_t{}};
+  client.start();
+
+  std::vector<std::unique_ptr<home_assistant_publisher>> publishers;
+  for (auto& hub : hubs) {
+    demultiplexer.add_hub(hub.ip, hub.devices);
+    publishers.push_back(std::make_unique<home_assistant_publisher>(
+        client, options.mode, delta_publish_config{}));
+    if (hubs.size() > 1) {
+      publishers.back()->set_device_namespace("hub_" +
+                                              std::to_string(hub.ip & 0xff));
+    }
+  }
+
+  auto& broker = fake_broker::instance();
+  broker.reset_statistics();
+
+  spymarine::buffer buffer;
+  std::vector<double> processing_us;
+  std::vector<double> behind_us;
+  size_t windows = 0;
+  size_t failures = 0;
+  const auto cpu_start = cpu_seconds();
+  const auto start_time = std::chrono::steady_clock::now();
+
+  for (size_t run = 0; run < options.repeat; run++) {
+    reader->rewind();
+    capture_replay replay{*reader, options.speed};
+
+    while (const auto datagram = replay.receive(buffer)) {
+      const auto received = std::chrono::steady_clock::now();
+      const auto completed =
+          demultiplexer.update(datagram->hub, datagram->data);
+      if (!completed) {
+        failures++;
+      } else if (*completed) {
+        publishers[datagram->hub]->publish_sensor_values(
+            demultiplexer.aggregated_devices(datagram->hub),
+            demultiplexer.completed_devices(datagram->hub));
+        windows++;
+      }
+      const auto processed = std::chrono::steady_clock::now();
+
+      processing_us.push_back(
+          std::chrono::duration<double, std::micro>{processed - received}
+              .count());
+      behind_us.push_back(std::chrono::duration<double, std::micro>{
+          received - replay.due_time()}
+                              .count());
+    }
+  }
+
+  const auto cpu_time = cpu_seconds() - cpu_start;
+  const auto elapsed = std::chrono::duration<double>{
+      std::chrono::steady_clock::now() - start_time}
+                           .count();
+  const auto datagrams = processing_us.size();
+
+  std::printf("hubs:                      %zu\n", hubs.size());
+  std::printf("datagrams:                 %zu\n", datagrams);
+  std::printf("failed datagrams:          %zu\n", failures);
+  std::printf("windows published:         %zu\n", windows);
+  std::printf("messages published:        %zu\n", broker.message_count());
+  std::printf("datagrams per second:      %.1f\n",
+              elapsed > 0 ? double(datagrams) / elapsed : 0.0);
+  std::printf("cpu per datagram (us):     %.2f\n",
+              datagrams > 0 ? cpu_time * 1e6 / double(datagrams) : 0.0);
+  std::printf("processing p50 (us):       %.1f\n",
+              percentile(processing_us, 0.5));
+  std::printf("processing p99 (us):       %.1f\n",
+              percentile(processing_us, 0.99));
+  std::printf("processing max (us):       %.1f\n",
+              percentile(processing_us, 1.0));
+  if (options.speed > 0) {
+    std::printf("behind schedule p99 (us):  %.1f\n",
+                percentile(behind_us, 0.99));
+  }
+
+  std::fclose(file);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,296 @@
+#include "simarine_simulator.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Framing as reverse engineered by pico2signalk: a constant header, the
+// message type, the device serial, the length of the remaining data and
+// the payload followed by a CRC. Payload values are separated by 0xff and
+// consist of an id, a value type and a big endian value.
+constexpr std::array<uint8_t, 6> message_header{0x00, 0x00, 0x00,
+                                                0x00, 0x00, 0xff};
+constexpr std::array<uint8_t, 4> device_serial{0x85, 0xde, 0xc3, 0x46};
+constexpr size_t message_header_size = 13;
+
+constexpr uint8_t device_count_message = 0x02;
+constexpr uint8_t device_info_message = 0x41;
+constexpr uint8_t sensor_state_message = 0xb0;
+
+constexpr uint8_t numeric_value = 0x01;
+constexpr uint8_t string_value = 0x04;
+
+uint16_t crc16(std::span<const uint8_t> data) {
+  uint16_t crc = 0;
+  for (const auto byte : data) {
+    crc ^= uint16_t(byte) << 8;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1189 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+class message_writer {
+public:
+  explicit message_writer(uint8_t type) {
+    _data.insert(_data.end(), message_header.begin(), message_header.end());
+    _data.push_back(type);
+    _data.insert(_data.end(), device_serial.begin(), device_serial.end());
+    _data.push_back(0);
+    _data.push_back(0);
+  }
+
+  message_writer& numeric(uint8_t id, int32_t value) {
+    _data.push_back(0xff);
+    _data.push_back(id);
+    _data.push_back(numeric_value);
+    push_be32(uint32_t(value));
+    return *this;
+  }
+
+  message_writer& string(uint8_t id, std::string_view value) {
+    _data.push_back(0xff);
+    _data.push_back(id);
+    _data.push_back(string_value);
+    push_be32(0);
+    _data.insert(_data.end(), value.begin(), value.end());
+    _data.push_back(0);
+    return *this;
+  }
+
+  std::span<const uint8_t> finish() {
+    _data.push_back(0xff);
+    const auto length = _data.size() - message_header_size + 2;
+    _data[11] = uint8_t(length >> 8);
+    _data[12] = uint8_t(length);
+    const auto crc = crc16(std::span{_data}.subspan(1));
+    _data.push_back(uint8_t(crc >> 8));
+    _data.push_back(uint8_t(crc));
+    return _data;
+  }
+
+private:
+  void push_be32(uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      _data.push_back(uint8_t(value >> shift));
+    }
+  }
+
+  std::vector<uint8_t> _data;
+};
+
+uint8_t sensor_count(simarine_simulator::device_type type) {
+  return type == simarine_simulator::device_type::battery ? 5 : 1;
+}
+
+std::string device_name(const simarine_simulator::device& device,
+                        size_t index) {
+  switch (device.type) {
+  case simarine_simulator::device_type::battery:
+    return "Battery " + std::to_string(index);
+  case simarine_simulator::device_type::tank:
+    return "Tank " + std::to_string(index);
+  case simarine_simulator::device_type::temperature:
+    return "Temperature " + std::to_string(index);
+  default:
+    return "Device " + std::to_string(index);
+  }
+}
+
+int32_t initial_value(const simarine_simulator::device& device,
+                      uint8_t sensor) {
+  switch (device.type) {
+  case simarine_simulator::device_type::battery: {
+    constexpr std::array<int32_t, 5> values{0, 14400, 9000, -250, 13200};
+    return values[sensor];
+  }
+  case simarine_simulator::device_type::tank:
+    return 600;
+  case simarine_simulator::device_type::temperature:
+    return 215;
+  default:
+    return 0;
+  }
+}
+
+void send_all(int socket, std::span<const uint8_t> data) {
+  while (!data.empty()) {
+    const auto sent = ::send(socket, data.data(), data.size(), MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return;
+    }
+    data = data.subspan(size_t(sent));
+  }
+}
+
+} // namespace
+
+simarine_simulator::simarine_simulator(config config) : _config{config} {
+  const auto add_devices = [&](device_type type, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      _devices.push_back({type, _state_count, sensor_count(type)});
+      _state_count += sensor_count(type);
+    }
+  };
+
+  add_devices(device_type::battery, _config.battery_count);
+  add_devices(device_type::tank, _config.tank_count);
+  add_devices(device_type::temperature, _config.temperature_count);
+}
+
+simarine_simulator::~simarine_simulator() { stop(); }
+
+void simarine_simulator::start() {
+  _tcp_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+  _udp_socket = ::socket(AF_INET, SOCK_DGRAM, 0);
+  if (_tcp_socket < 0 || _udp_socket < 0) {
+    throw std::runtime_error{"Failed to create simulator sockets"};
+  }
+
+  const int enable = 1;
+  ::setsockopt(_tcp_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  ::setsockopt(_udp_socket, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(_config.address);
+  address.sin_port = htons(_config.tcp_port);
+  if (::bind(_tcp_socket, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) < 0 ||
+      ::listen(_tcp_socket, 1) < 0) {
+    throw std::runtime_error{"Failed to listen on the simulator TCP port"};
+  }
+
+  // Sends from the simulator's address so receivers can tell hubs apart
+  sockaddr_in source{};
+  source.sin_family = AF_INET;
+  source.sin_addr.s_addr = htonl(_config.address);
+  if (::bind(_udp_socket, reinterpret_cast<sockaddr*>(&source),
+             sizeof(source)) < 0) {
+    throw std::runtime_error{"Failed to bind the simulator UDP socket"};
+  }
+
+  _running = true;
+  _tcp_thread = std::thread{[this] { serve_device_info(); }};
+  _udp_thread = std::thread{[this] { broadcast_sensor_states(); }};
+}
+
+void simarine_simulator::stop() {
+  if (!_running.exchange(false)) {
+    return;
+  }
+
+  _tcp_thread.join();
+  _udp_thread.join();
+  ::close(_tcp_socket);
+  ::close(_udp_socket);
+}
+
+void simarine_simulator::serve_device_info() {
+  std::array<uint8_t, 1024> request{};
+
+  while (_running) {
+    pollfd listen_fd{_tcp_socket, POLLIN, 0};
+    if (::poll(&listen_fd, 1, 100) <= 0) {
+      continue;
+    }
+
+    const auto connection = ::accept(_tcp_socket, nullptr, nullptr);
+    if (connection < 0) {
+      continue;
+    }
+
+    while (_running) {
+      pollfd connection_fd{connection, POLLIN, 0};
+      if (::poll(&connection_fd, 1, 100) <= 0) {
+        continue;
+      }
+
+      const auto size = ::recv(connection, request.data(), request.size(), 0);
+      if (size < ssize_t(message_header_size) ||
+          !std::equal(message_header.begin(), message_header.end(),
+                      request.begin())) {
+        break;
+      }
+
+      const auto type = request[6];
+      if (type == device_count_message) {
+        send_all(connection, message_writer{device_count_message}
+                                 .numeric(1, int32_t(_devices.size()))
+                                 .finish());
+      } else if (type == device_info_message) {
+        // The requested device index is the first value of the request
+        const auto index = request[message_header_size + 5];
+        if (index >= _devices.size()) {
+          break;
+        }
+
+        const auto& device = _devices[index];
+        message_writer response{device_info_message};
+        response.numeric(1, index)
+            .numeric(2, int32_t(device.type))
+            .string(3, device_name(device, index));
+        if (device.type == device_type::tank) {
+          response.numeric(6, 0).numeric(7, 1000);
+        } else if (device.type == device_type::battery) {
+          response.numeric(5, 2000).numeric(8, 5);
+        }
+        send_all(connection, response.finish());
+      } else {
+        break;
+      }
+    }
+
+    ::close(connection);
+  }
+}
+
+void simarine_simulator::broadcast_sensor_states() {
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(_config.udp_port);
+
+  std::vector<int32_t> values;
+  for (const auto& device : _devices) {
+    for (uint8_t sensor = 0; sensor < device.sensor_count; sensor++) {
+      values.push_back(initial_value(device, sensor));
+    }
+  }
+
+  std::mt19937 random{42};
+  std::uniform_int_distribution<int32_t> noise{-5, 5};
+  auto next_send = std::chrono::steady_clock::now();
+
+  while (_running) {
+    message_writer message{sensor_state_message};
+    for (size_t index = 0; index < values.size(); index++) {
+      values[index] += noise(random);
+      message.numeric(uint8_t(index), values[index]);
+    }
+
+    const auto data = message.finish();
+    ::sendto(_udp_socket, data.data(), data.size(), 0,
+             reinterpret_cast<sockaddr*>(&address), sizeof(address));
+
+    _last_datagram_time =
+        std::chrono::steady_clock::now().time_since_epoch().count();
+    _datagrams_sent++;
+
+    next_send += _config.broadcast_interval;
+    std::this_thread::sleep_until(next_send);
+  }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "spymarine/defaults.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/*! Stand-in for a Simarine Pico on the local host. Answers the TCP device
+ * count and device info requests used by spymarine::read_devices and
+ * broadcasts sensor state datagrams at a fixed rate like the real device.
+ */
+class simarine_simulator {
+public:
+  struct config {
+    size_t battery_count{2};
+    size_t tank_count{2};
+    size_t temperature_count{2};
+    /*! Loopback address the simulator answers on and broadcasts from, in
+     * host byte order. Several simulators with different addresses act as
+     * separate hubs.
+     */
+    uint32_t address{0x7f000001};
+    uint16_t tcp_port{spymarine::simarine_default_tcp_port};
+    uint16_t udp_port{spymarine::simarine_default_udp_port};
+    std::chrono::microseconds broadcast_interval{std::chrono::seconds{1}};
+  };
+
+  explicit simarine_simulator(config config);
+  simarine_simulator(const simarine_simulator& other) = delete;
+
+  ~simarine_simulator();
+
+  simarine_simulator& operator=(const simarine_simulator& other) = delete;
+
+  void start();
+  void stop();
+
+  size_t device_count() const { return _devices.size(); }
+
+  size_t datagrams_sent() const { return _datagrams_sent; }
+
+  /*! Time at which the most recent sensor state datagram was sent
+   */
+  std::chrono::steady_clock::time_point last_datagram_time() const {
+    return std::chrono::steady_clock::time_point{
+        std::chrono::steady_clock::duration{_last_datagram_time.load()}};
+  }
+
+  /*! Device type codes as reported in the device info response
+   */
+  enum class device_type : uint8_t {
+    voltage = 1,
+    current = 2,
+    temperature = 3,
+    barometer = 5,
+    resistive = 6,
+    tank = 8,
+    battery = 9,
+  };
+
+  struct device {
+    device_type type;
+    uint8_t state_index;
+    uint8_t sensor_count;
+  };
+
+private:
+  void serve_device_info();
+  void broadcast_sensor_states();
+
+  config _config;
+  std::vector<device> _devices;
+  uint8_t _state_count{0};
+
+  std::atomic<bool> _running{false};
+  std::atomic<size_t> _datagrams_sent{0};
+  std::atomic<std::chrono::steady_clock::rep> _last_datagram_time{0};
+  int _tcp_socket{-1};
+  int _udp_socket{-1};
+  std::thread _tcp_thread;
+  std::thread _udp_thread;
+};
@@ -0,0 +1,374 @@
+// Runs next to the MQTT broker and turns the binary snapshots published in
+// the binary publish mode back into the JSON state messages that the Home
+// Assistant discovery configs refer to, see main/binary_snapshot.hpp.
+//
+// Speaks plain MQTT 3.1.1 over TCP, so it should connect to the broker on
+// the local host or a trusted network rather than over the metered link.
+//
+// Usage: snapshot_bridge [--host ADDRESS] [--port N] [--username NAME]
+//                        [--password PASSWORD] [--client-id ID]
+
+#include "binary_snapshot.hpp"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr auto keep_alive = 60s;
+
+constexpr std::string_view layout_suffix = "/binary/layout";
+constexpr std::string_view snapshot_suffix = "/binary/state";
+
+struct options {
+  std::string host{"localhost"};
+  std::string port{"1883"};
+  std::string username;
+  std::string password;
+  std::string client_id{"simarine_snapshot_bridge"};
+};
+
+options parse_options(int argc, char** argv) {
+  options result;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const auto name = std::string_view{argv[i]};
+    const auto value = std::string{argv[i + 1]};
+    if (name == "--host") {
+      result.host = value;
+    } else if (name == "--port") {
+      result.port = value;
+    } else if (name == "--username") {
+      result.username = value;
+    } else if (name == "--password") {
+      result.password = value;
+    } else if (name == "--client-id") {
+      result.client_id = value;
+    } else {
+      std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  return result;
+}
+
+enum packet_type : uint8_t {
+  connect_packet = 1,
+  connack_packet = 2,
+  publish_packet = 3,
+  subscribe_packet = 8,
+  pingreq_packet = 12,
+};
+
+struct packet {
+  uint8_t header;
+  std::vector<uint8_t> body;
+
+  uint8_t type() const { return header >> 4; }
+};
+
+void append_u16(std::vector<uint8_t>& data, uint16_t value) {
+  data.push_back(uint8_t(value >> 8));
+  data.push_back(uint8_t(value));
+}
+
+void append_string(std::vector<uint8_t>& data, std::string_view value) {
+  append_u16(data, uint16_t(value.size()));
+  data.insert(data.end(), value.begin(), value.end());
+}
+
+/*! A blocking MQTT 3.1.1 connection with just enough of the protocol for
+ * the bridge: QoS 0 publishing and subscribing
+ */
+class mqtt_connection {
+public:
+  ~mqtt_connection() {
+    if (_socket >= 0) {
+      ::close(_socket);
+    }
+  }
+
+  bool connect(const options& options) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (::getaddrinfo(options.host.c_str(), options.port.c_str(), &hints,
+                      &addresses) != 0) {
+      std::fprintf(stderr, "Failed to resolve %s\n", options.host.c_str());
+      return false;
+    }
+
+    for (auto address = addresses; address; address = address->ai_next) {
+      _socket = ::socket(address->ai_family, address->ai_socktype,
+                         address->ai_protocol);
+      if (_socket >= 0 &&
+          ::connect(_socket, address->ai_addr, address->ai_addrlen) == 0) {
+        break;
+      }
+      if (_socket >= 0) {
+        ::close(_socket);
+        _socket = -1;
+      }
+    }
+    ::freeaddrinfo(addresses);
+    if (_socket < 0) {
+      std::fprintf(stderr, "Failed to connect to %s:%s\n",
+                   options.host.c_str(), options.port.c_str());
+      return false;
+    }
+
+    std::vector<uint8_t> body;
+    append_string(body, "MQTT");
+    body.push_back(4); // Protocol level 3.1.1
+    uint8_t flags = 0x02; // Clean session
+    if (!options.username.empty()) {
+      flags |= 0x80;
+    }
+    if (!options.password.empty()) {
+      flags |= 0x40;
+    }
+    body.push_back(flags);
+    append_u16(body, uint16_t(keep_alive.count()));
+    append_string(body, options.client_id);
+    if (!options.username.empty()) {
+      append_string(body, options.username);
+    }
+    if (!options.password.empty()) {
+      append_string(body, options.password);
+    }
+    if (!send(connect_packet << 4, body)) {
+      return false;
+    }
+
+    const auto connack = receive();
+    if (!connack || connack->type() != connack_packet ||
+        connack->body.size() != 2 || connack->body[1] != 0) {
+      std::fprintf(stderr, "Connection refused by the broker\n");
+      return false;
+    }
+    return true;
+  }
+
+  bool subscribe(std::string_view filter) {
+    std::vector<uint8_t> body;
+    append_u16(body, _next_packet_id++);
+    append_string(body, filter);
+    body.push_back(0); // QoS 0
+    return send((subscribe_packet << 4) | 0x02, body);
+  }
+
+  bool publish(std::string_view topic, std::string_view payload) {
+    std::vector<uint8_t> body;
+    append_string(body, topic);
+    body.insert(body.end(), payload.begin(), payload.end());
+    return send(publish_packet << 4, body);
+  }
+
+  /*! Waits for the next packet, sending pings to keep the connection alive
+   */
+  std::optional<packet> next_packet() {
+    while (true) {
+      pollfd descriptor{.fd = _socket, .events = POLLIN, .revents = 0};
+      const auto timeout =
+          std::chrono::duration_cast<std::chrono::milliseconds>(keep_alive /
+                                                                2);
+      const auto result = ::poll(&descriptor, 1, int(timeout.count()));
+      if (result < 0) {
+        return std::nullopt;
+      }
+      if (result == 0) {
+        if (!send(pingreq_packet << 4, {})) {
+          return std::nullopt;
+        }
+        continue;
+      }
+      return receive();
+    }
+  }
+
+private:
+  bool send(uint8_t header, const std::vector<uint8_t>& body) {
+    std::vector<uint8_t> data{header};
+    auto remaining = body.size();
+    do {
+      uint8_t byte = remaining % 128;
+      remaining /= 128;
+      if (remaining > 0) {
+        byte |= 0x80;
+      }
+      data.push_back(byte);
+    } while (remaining > 0);
+    data.insert(data.end(), body.begin(), body.end());
+    return write_all(data.data(), data.size());
+  }
+
+  std::optional<packet> receive() {
+    packet result{};
+    if (!read_all(&result.header, 1)) {
+      return std::nullopt;
+    }
+
+    size_t remaining = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+      uint8_t byte;
+      if (!read_all(&byte, 1)) {
+        return std::nullopt;
+      }
+      remaining |= size_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+
+    result.body.resize(remaining);
+    if (!read_all(result.body.data(), remaining)) {
+      return std::nullopt;
+    }
+    return result;
+  }
+
+  bool write_all(const uint8_t* data, size_t size) {
+    while (size > 0) {
+      const auto written = ::send(_socket, data, size, MSG_NOSIGNAL);
+      if (written <= 0) {
+        return false;
+      }
+      data += written;
+      size -= size_t(written);
+    }
+    return true;
+  }
+
+  bool read_all(uint8_t* data, size_t size) {
+    while (size > 0) {
+      const auto count = ::recv(_socket, data, size, 0);
+      if (count <= 0) {
+        return false;
+      }
+      data += count;
+      size -= size_t(count);
+    }
+    return true;
+  }
+
+  int _socket{-1};
+  uint16_t _next_packet_id{1};
+};
+
+/*! The topic and payload of a received publish packet
+ */
+struct publish_message {
+  std::string_view topic;
+  std::span<const uint8_t> payload;
+};
+
+std::optional<publish_message> parse_publish(const packet& packet) {
+  const auto& body = packet.body;
+  if (body.size() < 2) {
+    return std::nullopt;
+  }
+  const size_t topic_size = (body[0] << 8) | body[1];
+  size_t offset = 2 + topic_size;
+  // The broker may deliver retained messages with a higher QoS than
+  // subscribed, which adds a packet id
+  if ((packet.header >> 1) & 0x03) {
+    offset += 2;
+  }
+  if (body.size() < offset) {
+    return std::nullopt;
+  }
+  return publish_message{
+      .topic = {reinterpret_cast<const char*>(body.data()) + 2, topic_size},
+      .payload = std::span{body}.subspan(offset),
+  };
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const auto options = parse_options(argc, argv);
+
+  mqtt_connection connection;
+  if (!connection.connect(options) ||
+      !connection.subscribe("simarine_esp/binary/+") ||
+      !connection.subscribe("simarine_esp/+/binary/+")) {
+    return EXIT_FAILURE;
+  }
+  std::printf("Bridging binary snapshots on %s:%s\n", options.host.c_str(),
+              options.port.c_str());
+
+  // Layouts by the topic prefix they were published under, which includes
+  // the hub namespace
+  std::map<std::string, binary_layout, std::less<>> layouts;
+  size_t snapshot_bytes = 0;
+  size_t json_bytes = 0;
+
+  while (const auto packet = connection.next_packet()) {
+    if (packet->type() != publish_packet) {
+      continue;
+    }
+    const auto message = parse_publish(*packet);
+    if (!message) {
+      continue;
+    }
+
+    if (message->topic.ends_with(layout_suffix)) {
+      const auto prefix = std::string{message->topic.substr(
+          0, message->topic.size() - layout_suffix.size())};
+      if (auto layout = parse_binary_layout(message->payload)) {
+        std::printf("Layout of %zu devices for %s\n", layout->devices.size(),
+                    prefix.c_str());
+        layouts.insert_or_assign(prefix, std::move(*layout));
+      } else {
+        std::fprintf(stderr, "Invalid layout for %s\n", prefix.c_str());
+      }
+    } else if (message->topic.ends_with(snapshot_suffix)) {
+      const auto prefix = message->topic.substr(
+          0, message->topic.size() - snapshot_suffix.size());
+      const auto layout = layouts.find(prefix);
+      if (layout == layouts.end()) {
+        std::fprintf(stderr, "No layout for %.*s yet\n", int(prefix.size()),
+                     prefix.data());
+        continue;
+      }
+
+      snapshot_bytes += message->payload.size();
+      const auto decoded = decode_binary_snapshot(
+          layout->second, message->payload,
+          [&](std::string_view topic, std::string_view payload) {
+            json_bytes += payload.size();
+            connection.publish(topic, payload);
+          });
+      if (!decoded) {
+        std::fprintf(stderr, "Invalid snapshot for %.*s\n", int(prefix.size()),
+                     prefix.data());
+        continue;
+      }
+
+      std::printf("Snapshot of %zu bytes, %.1fx smaller than JSON so far\n",
+                  message->payload.size(),
+                  snapshot_bytes > 0 ? double(json_bytes) / snapshot_bytes
+                                     : 0.0);
+    }
+  }
+
+  std::fprintf(stderr, "Connection to the broker lost\n");
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,133 @@
+// Records the sensor state broadcasts of the Simarine hubs on the network to
+// a capture file for replay_benchmark. Run it on a machine in the same
+// network as the hubs, e.g. a laptop on the boat's Wifi. With --simulate 1 a
+// simulated hub on the local host is recorded instead.
+//
+// Usage: udp_recorder --output FILE [--seconds N] [--hubs N]
+//                     [--simulate 0|1]
+
+#include "hub_demultiplexer.hpp"
+#include "simarine_simulator.hpp"
+#include "udp_capture.hpp"
+
+#include "spymarine/buffer.hpp"
+#include "spymarine/read_devices.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+struct options {
+  std::string output;
+  std::chrono::seconds duration{60};
+  size_t hubs{4};
+  bool simulate{false};
+};
+
+options parse_options(int argc, char** argv) {
+  options result;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const auto name = std::string_view{argv[i]};
+    const auto value = std::strtoul(argv[i + 1], nullptr, 10);
+    if (name == "--output") {
+      result.output = argv[i + 1];
+    } else if (name == "--seconds") {
+      result.duration = std::chrono::seconds{value};
+    } else if (name == "--hubs") {
+      result.hubs = value;
+    } else if (name == "--simulate") {
+      result.simulate = value != 0;
+    } else {
+      std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  if (result.output.empty()) {
+    std::fprintf(stderr, "Missing --output\n");
+    std::exit(EXIT_FAILURE);
+  }
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const auto options = parse_options(argc, argv);
+
+  std::unique_ptr<simarine_simulator> simulator;
+  if (options.simulate) {
+    simulator = std::make_unique<simarine_simulator>(
+        simarine_simulator::config{.broadcast_interval = 100ms});
+    simulator->start();
+  }
+
+  const auto ips = discover_hubs(3s, options.hubs);
+  if (ips.empty()) {
+    std::fprintf(stderr, "No Simarine hub found\n");
+    return EXIT_FAILURE;
+  }
+
+  // All devices are kept so that the capture can be replayed with any
+  // device filter
+  spymarine::buffer buffer;
+  std::vector<cached_devices> hubs;
+  for (const auto ip : ips) {
+    auto devices = spymarine::read_devices<spymarine::tcp_socket>(
+        buffer, ip, spymarine::simarine_default_tcp_port,
+        [](const spymarine::device&) { return true; });
+    if (!devices) {
+      std::fprintf(stderr, "Failed to read devices: %s\n",
+                   spymarine::error_message(devices.error()).c_str());
+      return EXIT_FAILURE;
+    }
+    hubs.push_back({.ip = ip, .devices = std::move(*devices)});
+  }
+
+  hub_demultiplexer demultiplexer{aggregation_config{}};
+  if (!demultiplexer.open()) {
+    return EXIT_FAILURE;
+  }
+  demultiplexer.set_receive_timeout(100ms);
+  for (auto& hub : hubs) {
+    demultiplexer.add_hub(hub.ip, hub.devices);
+  }
+
+  const auto file = std::fopen(options.output.c_str(), "wb");
+  if (!file) {
+    std::fprintf(stderr, "Failed to open %s\n", options.output.c_str());
+    return EXIT_FAILURE;
+  }
+  udp_capture_writer capture{file, hubs};
+  demultiplexer.set_capture(&capture);
+
+  std::printf("Recording %zu hubs for %lld seconds\n", hubs.size(),
+              static_cast<long long>(options.duration.count()));
+
+  const auto end_time = std::chrono::steady_clock::now() + options.duration;
+  while (std::chrono::steady_clock::now() < end_time && capture.good()) {
+    const auto datagram = demultiplexer.receive(buffer);
+    if (!datagram) {
+      std::fprintf(stderr, "Failed to receive sensor values: %s\n",
+                   spymarine::error_message(datagram.error()).c_str());
+      break;
+    }
+  }
+
+  demultiplexer.set_capture(nullptr);
+  std::fclose(file);
+  if (simulator) {
+    simulator->stop();
+  }
+
+  std::printf("Recorded %zu datagrams to %s\n", capture.records(),
+              options.output.c_str());
+  return capture.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,141 @@
+#include "alert_rules.hpp"
+#include "device_sensors.hpp"
+
+#include "esp_log.h"
+
+#include <cmath>
+
+namespace {
+
+constexpr auto TAG = "alert_rules";
+
+std::string_view condition_string(const alert_condition condition) {
+  switch (condition) {
+  case alert_condition::below:
+    return "below";
+  case alert_condition::above:
+    return "above";
+  case alert_condition::falling_faster_than:
+    return "falling_faster_than";
+  case alert_condition::rising_faster_than:
+    return "rising_faster_than";
+  }
+  return "";
+}
+
+} // namespace
+
+alert_engine::alert_engine(std::vector<alert_rule> rules)
+    : _rules{std::move(rules)} {}
+
+void alert_engine::add_hub(const std::vector<spymarine::device>& raw_devices) {
+  auto& bound_rules = _hubs.emplace_back();
+
+  for (size_t rule_index = 0; rule_index < _rules.size(); rule_index++) {
+    const auto& rule = _rules[rule_index];
+    for (const auto& device : raw_devices) {
+      if (device_name(device) != rule.device) {
+        continue;
+      }
+      for_each_sensor(device, [&](const sensor_description& description,
+                                  const spymarine::sensor& sensor) {
+        if (description.key == rule.sensor) {
+          bound_rules.push_back({
+              .rule = uint16_t(rule_index),
+              .sensor = &sensor,
+          });
+        }
+      });
+    }
+  }
+
+  ESP_LOGI(TAG, "Watching %zu sensors of hub %zu for %zu alert rules",
+           bound_rules.size(), _hubs.size() - 1, _rules.size());
+}
+
+bool alert_engine::write_event_message(const alert_event& event,
+                                       message_buffer& message) const {
+  const auto& rule = _rules[event.rule];
+
+  message.clear();
+  message.topic().append(alert_topic);
+  message.payload()
+      .append("{\"rule\":")
+      .append_json_string(rule.name)
+      .append(",\"state\":")
+      .append(event.raised ? "\"raised\"" : "\"cleared\"")
+      .append(",\"hub\":")
+      .append(size_t(event.hub))
+      .append(",\"device\":")
+      .append_json_string(rule.device)
+      .append(",\"sensor\":")
+      .append_json_string(rule.sensor)
+      .append(",\"condition\":\"")
+      .append(condition_string(rule.condition))
+      .append("\",\"threshold\":")
+      .append(rule.threshold, 2)
+      .append(",\"value\":")
+      .append(event.value, 2)
+      .append('}');
+  return !message.overflowed();
+}
+
+std::optional<float> alert_engine::evaluate(bound_rule& bound,
+                                            const clock::time_point now) {
+  const auto& rule = _rules[bound.rule];
+  const auto value = bound.sensor->value;
+  if (!std::isfinite(value)) {
+    return std::nullopt;
+  }
+
+  // Rate conditions compare the change per minute against the threshold
+  auto measured = value;
+  const auto limit = rule.threshold;
+  auto exceeds = false;
+  auto recovered = false;
+
+  switch (rule.condition) {
+  case alert_condition::below:
+    exceeds = value < limit;
+    recovered = value >= limit + rule.hysteresis;
+    break;
+  case alert_condition::above:
+    exceeds = value > limit;
+    recovered = value <= limit - rule.hysteresis;
+    break;
+  case alert_condition::falling_faster_than:
+  case alert_condition::rising_faster_than: {
+    if (bound.reference_time == clock::time_point{}) {
+      bound.reference_value = value;
+      bound.reference_time = now;
+      return std::nullopt;
+    }
+    const auto elapsed =
+        std::chrono::duration<float>{now - bound.reference_time}.count();
+    if (elapsed < float(rule.rate_interval.count())) {
+      return std::nullopt;
+    }
+
+    const auto rate = (value - bound.reference_value) / elapsed * 60.0f;
+    bound.reference_value = value;
+    bound.reference_time = now;
+
+    const auto change =
+        rule.condition == alert_condition::falling_faster_than ? -rate : rate;
+    exceeds = change > limit;
+    recovered = change <= limit - rule.hysteresis;
+    measured = rate;
+    break;
+  }
+  }
+
+  if (!bound.active && exceeds) {
+    bound.active = true;
+    return measured;
+  }
+  if (bound.active && recovered) {
+    bound.active = false;
+    return measured;
+  }
+  return std::nullopt;
+}
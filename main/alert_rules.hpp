@@ -0,0 +1,133 @@
+#pragma once
+
+#include "message_buffer.hpp"
+
+#include "spymarine/device.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/*! What a rule checks the raw samples of its sensor for
+ */
+enum class alert_condition {
+  below,
+  above,
+
+  /*! The value drops by more than the threshold per minute
+   */
+  falling_faster_than,
+
+  /*! The value rises by more than the threshold per minute
+   */
+  rising_faster_than,
+};
+
+/*! Raises an alert when a sensor's raw samples meet the condition and clears
+ * it once they are back beyond the threshold by the hysteresis
+ */
+struct alert_rule {
+  /*! Identifies the rule in alert events
+   */
+  std::string_view name;
+
+  /*! Name of the device as configured in the Simarine app, the rule applies
+   * to the devices of that name of every hub
+   */
+  std::string_view device;
+
+  /*! Key of the sensor in state messages, e.g. "voltage"
+   */
+  std::string_view sensor;
+
+  alert_condition condition;
+  float threshold;
+  float hysteresis{0.0f};
+
+  /*! The rate of change is measured between samples at least this far
+   * apart, which smooths the noise of single samples
+   */
+  std::chrono::seconds rate_interval{10};
+};
+
+/*! An alert being raised or cleared
+ */
+struct alert_event {
+  uint16_t rule;
+  uint8_t hub;
+  bool raised;
+
+  /*! The sample, or for rate conditions the rate per minute, that raised or
+   * cleared the alert
+   */
+  float value;
+};
+
+/*! Evaluates the alert rules against every raw sample of the hubs' devices.
+ *
+ * The rules are resolved to the sensors they watch when the hubs are added,
+ * so evaluating is allocation free and costs O(rules) per datagram with a
+ * fixed amount of state per rule.
+ */
+class alert_engine {
+public:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr auto alert_topic = "simarine_esp/alert";
+
+  explicit alert_engine(std::vector<alert_rule> rules);
+  alert_engine(const alert_engine& other) = delete;
+
+  alert_engine& operator=(const alert_engine& other) = delete;
+
+  /*! Resolves the rules for the next hub. The raw devices are updated in
+   * place by the hub's sensor reader and need to outlive the engine.
+   */
+  void add_hub(const std::vector<spymarine::device>& raw_devices);
+
+  /*! Checks the rules of the hub against the current raw samples and calls
+   * the function with each alert_event
+   */
+  template <typename Function>
+  void evaluate(size_t hub, clock::time_point now, Function&& function) {
+    if (hub >= _hubs.size()) {
+      return;
+    }
+    for (auto& bound : _hubs[hub]) {
+      if (const auto event = evaluate(bound, now)) {
+        function(alert_event{
+            .rule = bound.rule,
+            .hub = uint8_t(hub),
+            .raised = bound.active,
+            .value = *event,
+        });
+      }
+    }
+  }
+
+  /*! Writes the event as JSON message on alert_topic
+   */
+  bool write_event_message(const alert_event& event,
+                           message_buffer& message) const;
+
+  size_t rule_count() const { return _rules.size(); }
+
+private:
+  struct bound_rule {
+    uint16_t rule;
+    const spymarine::sensor* sensor;
+    bool active{false};
+    float reference_value{0.0f};
+    clock::time_point reference_time{};
+  };
+
+  /*! Returns the value for the event if the rule's alert changed
+   */
+  std::optional<float> evaluate(bound_rule& bound, clock::time_point now);
+
+  std::vector<alert_rule> _rules;
+  std::vector<std::vector<bound_rule>> _hubs;
+};
@@ -0,0 +1,292 @@
+#include "binary_snapshot.hpp"
+#include "device_sensors.hpp"
+#include "home_assistant_serializer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+// Layout message: the format version (u8), the device count (u16) followed
+// by the devices. Each device consists of its state topic length (u8) and
+// topic, its sensor count (u8) and the length (u8) and key of each sensor.
+//
+// Snapshot message: the format version (u8), the layout id (u16), a bitmap
+// with a bit per device of the layout (LSB first) and for each flagged
+// device the values of its sensors as zigzag varints.
+//
+// Multi-byte integers are little endian.
+
+namespace {
+
+constexpr float value_scale = 100.0f;
+static_assert(binary_snapshot_decimals == 2);
+
+void write_u8(text_writer& writer, uint8_t value) {
+  writer.append(char(value));
+}
+
+void write_u16(text_writer& writer, uint16_t value) {
+  write_u8(writer, uint8_t(value));
+  write_u8(writer, uint8_t(value >> 8));
+}
+
+void write_string(text_writer& writer, std::string_view value) {
+  const auto size = std::min<size_t>(value.size(), UINT8_MAX);
+  write_u8(writer, uint8_t(size));
+  writer.append(value.substr(0, size));
+}
+
+void write_varint(text_writer& writer, int32_t value) {
+  auto zigzag = (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+  while (zigzag >= 0x80) {
+    write_u8(writer, uint8_t(zigzag | 0x80));
+    zigzag >>= 7;
+  }
+  write_u8(writer, uint8_t(zigzag));
+}
+
+int32_t to_fixed_point(float value) {
+  constexpr auto max = float(std::numeric_limits<int32_t>::max() / 2);
+  if (std::isnan(value)) {
+    return 0;
+  }
+  return int32_t(std::lround(std::clamp(value * value_scale, -max, max)));
+}
+
+/*! FNV-1a folded to 16 bits
+ */
+uint16_t layout_hash(std::string_view data) {
+  uint32_t hash = 2166136261u;
+  for (const auto c : data) {
+    hash = (hash ^ uint8_t(c)) * 16777619u;
+  }
+  return uint16_t(hash ^ (hash >> 16));
+}
+
+class snapshot_reader {
+public:
+  explicit snapshot_reader(std::span<const uint8_t> data) : _data{data} {}
+
+  uint8_t u8() {
+    if (_data.empty()) {
+      _failed = true;
+      return 0;
+    }
+    const auto value = _data.front();
+    _data = _data.subspan(1);
+    return value;
+  }
+
+  uint16_t u16() {
+    const auto low = u8();
+    return uint16_t(low | (u8() << 8));
+  }
+
+  std::string string() {
+    const auto size = u8();
+    if (_data.size() < size) {
+      _failed = true;
+      return {};
+    }
+    std::string value{reinterpret_cast<const char*>(_data.data()), size};
+    _data = _data.subspan(size);
+    return value;
+  }
+
+  int32_t varint() {
+    uint32_t zigzag = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      const auto byte = u8();
+      zigzag |= uint32_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return int32_t((zigzag >> 1) ^ -(zigzag & 1));
+      }
+    }
+    _failed = true;
+    return 0;
+  }
+
+  bool failed() const { return _failed; }
+  bool done() const { return _data.empty(); }
+
+private:
+  std::span<const uint8_t> _data;
+  bool _failed{false};
+};
+
+} // namespace
+
+void write_binary_layout_topic(text_writer& writer,
+                               std::string_view device_namespace) {
+  writer.append(home_assistant_topic_prefix).append('/');
+  if (!device_namespace.empty()) {
+    writer.append_identifier(device_namespace).append('/');
+  }
+  writer.append("binary/layout");
+}
+
+void write_binary_snapshot_topic(text_writer& writer,
+                                 std::string_view device_namespace) {
+  writer.append(home_assistant_topic_prefix).append('/');
+  if (!device_namespace.empty()) {
+    writer.append_identifier(device_namespace).append('/');
+  }
+  writer.append("binary/state");
+}
+
+std::optional<uint16_t>
+write_binary_layout_message(std::span<const spymarine::device> devices,
+                            message_buffer& message,
+                            std::string_view device_namespace) {
+  message.clear();
+  write_binary_layout_topic(message.topic(), device_namespace);
+
+  // The state topic is written to a scratch buffer first to learn its
+  // length
+  std::array<char, 128> topic_storage;
+  text_writer state_topic{topic_storage};
+
+  auto& payload = message.payload();
+  write_u8(payload, binary_snapshot_version);
+  write_u16(payload, uint16_t(devices.size()));
+  for (const auto& device : devices) {
+    state_topic.clear();
+    write_home_assistant_state_topic(device, state_topic, device_namespace);
+    write_string(payload, state_topic.view());
+
+    size_t sensor_count = 0;
+    for_each_sensor(device, [&](const sensor_description&,
+                                const spymarine::sensor&) { sensor_count++; });
+    write_u8(payload, uint8_t(sensor_count));
+    for_each_sensor(device, [&](const sensor_description& description,
+                                const spymarine::sensor&) {
+      write_string(payload, description.key);
+    });
+  }
+
+  if (message.overflowed() || state_topic.overflowed()) {
+    return std::nullopt;
+  }
+  return layout_hash(payload.view());
+}
+
+bool write_binary_snapshot_message(std::span<const spymarine::device> devices,
+                                   std::span<const uint8_t> include,
+                                   const uint16_t layout_id,
+                                   message_buffer& message,
+                                   std::string_view device_namespace) {
+  message.clear();
+  write_binary_snapshot_topic(message.topic(), device_namespace);
+
+  auto& payload = message.payload();
+  write_u8(payload, binary_snapshot_version);
+  write_u16(payload, layout_id);
+
+  const auto included = [&](size_t index) {
+    return include.empty() || include[index];
+  };
+
+  for (size_t first = 0; first < devices.size(); first += 8) {
+    uint8_t bits = 0;
+    for (size_t bit = 0; bit < 8 && first + bit < devices.size(); bit++) {
+      if (included(first + bit)) {
+        bits |= uint8_t(1 << bit);
+      }
+    }
+    write_u8(payload, bits);
+  }
+
+  for (size_t index = 0; index < devices.size(); index++) {
+    if (!included(index)) {
+      continue;
+    }
+    for_each_sensor(devices[index], [&](const sensor_description&,
+                                        const spymarine::sensor& sensor) {
+      write_varint(payload, to_fixed_point(sensor.value));
+    });
+  }
+
+  return !message.overflowed();
+}
+
+std::optional<binary_layout>
+parse_binary_layout(std::span<const uint8_t> data) {
+  snapshot_reader reader{data};
+  if (reader.u8() != binary_snapshot_version) {
+    return std::nullopt;
+  }
+
+  binary_layout layout;
+  layout.id = layout_hash(
+      {reinterpret_cast<const char*>(data.data()), data.size()});
+
+  const auto count = reader.u16();
+  for (size_t i = 0; i < count && !reader.failed(); i++) {
+    auto& device = layout.devices.emplace_back();
+    device.state_topic = reader.string();
+    const auto sensor_count = reader.u8();
+    for (size_t j = 0; j < sensor_count; j++) {
+      device.sensor_keys.push_back(reader.string());
+    }
+  }
+
+  if (reader.failed() || !reader.done()) {
+    return std::nullopt;
+  }
+  return layout;
+}
+
+bool decode_binary_snapshot(
+    const binary_layout& layout, std::span<const uint8_t> data,
+    const std::function<void(std::string_view topic, std::string_view payload)>&
+        function) {
+  snapshot_reader reader{data};
+  if (reader.u8() != binary_snapshot_version || reader.u16() != layout.id) {
+    return false;
+  }
+
+  std::vector<uint8_t> bitmap((layout.devices.size() + 7) / 8);
+  for (auto& bits : bitmap) {
+    bits = reader.u8();
+  }
+
+  // Nothing is passed on unless the whole snapshot is valid
+  std::vector<std::pair<std::string_view, std::string>> messages;
+  std::array<char, 512> payload_storage;
+  text_writer payload{payload_storage};
+
+  for (size_t index = 0; index < layout.devices.size(); index++) {
+    if (!(bitmap[index / 8] & (1 << (index % 8)))) {
+      continue;
+    }
+
+    const auto& device = layout.devices[index];
+    payload.clear();
+    payload.append('{');
+    for (size_t i = 0; i < device.sensor_keys.size(); i++) {
+      if (i > 0) {
+        payload.append(',');
+      }
+      const auto value = float(reader.varint()) / value_scale;
+      payload.append_json_string(device.sensor_keys[i])
+          .append(':')
+          .append(value, binary_snapshot_decimals);
+    }
+    payload.append('}');
+
+    if (reader.failed() || payload.overflowed()) {
+      return false;
+    }
+    messages.emplace_back(device.state_topic, payload.view());
+  }
+
+  if (!reader.done()) {
+    return false;
+  }
+  for (const auto& [topic, message_payload] : messages) {
+    function(topic, message_payload);
+  }
+  return true;
+}
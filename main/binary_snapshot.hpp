@@ -0,0 +1,76 @@
+#pragma once
+
+#include "message_buffer.hpp"
+
+#include "spymarine/device.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*! A compact alternative to the JSON state messages for links that are
+ * charged per byte. The ESP32 publishes a retained layout message naming
+ * the state topic and the sensor keys of every device once, and then only
+ * snapshots of the sensor values. A bridge next to the broker turns the
+ * snapshots back into the JSON state messages, see host/snapshot_bridge.cpp.
+ *
+ * Values are sent as fixed-point numbers with binary_snapshot_decimals
+ * decimals, matching the JSON messages, in zigzag varint encoding, so most
+ * values take two or three bytes.
+ */
+
+constexpr uint8_t binary_snapshot_version = 1;
+constexpr int binary_snapshot_decimals = 2;
+
+/*! Writes simarine_esp[/<namespace>]/binary/layout
+ */
+void write_binary_layout_topic(text_writer& writer,
+                               std::string_view device_namespace = {});
+
+/*! Writes simarine_esp[/<namespace>]/binary/state
+ */
+void write_binary_snapshot_topic(text_writer& writer,
+                                 std::string_view device_namespace = {});
+
+/*! Writes the layout message of the devices. Returns the id identifying the
+ * layout in snapshots, or nothing if the message exceeds the buffer.
+ */
+std::optional<uint16_t>
+write_binary_layout_message(std::span<const spymarine::device> devices,
+                            message_buffer& message,
+                            std::string_view device_namespace = {});
+
+/*! Writes a snapshot of the devices flagged in include, all if include is
+ * empty
+ */
+bool write_binary_snapshot_message(std::span<const spymarine::device> devices,
+                                   std::span<const uint8_t> include,
+                                   uint16_t layout_id, message_buffer& message,
+                                   std::string_view device_namespace = {});
+
+/*! A parsed layout message
+ */
+struct binary_layout {
+  struct device {
+    std::string state_topic;
+    std::vector<std::string> sensor_keys;
+  };
+
+  uint16_t id;
+  std::vector<device> devices;
+};
+
+std::optional<binary_layout> parse_binary_layout(std::span<const uint8_t> data);
+
+/*! Calls the function with the state topic and the JSON state payload of
+ * each device in the snapshot. Returns false if the snapshot is invalid or
+ * belongs to another layout.
+ */
+bool decode_binary_snapshot(
+    const binary_layout& layout, std::span<const uint8_t> data,
+    const std::function<void(std::string_view topic, std::string_view payload)>&
+        function);
@@ -0,0 +1,105 @@
+#include "buffer_arena.hpp"
+
+#include "esp_log.h"
+
+#include <cassert>
+#include <utility>
+
+namespace {
+
+constexpr auto TAG = "buffer_arena";
+
+constexpr uint32_t index_mask = 0xffff;
+
+uint32_t make_head(uint32_t previous, uint16_t index) {
+  return ((previous & ~index_mask) + (index_mask + 1)) | index;
+}
+
+} // namespace
+
+buffer_arena::handle::handle(handle&& other)
+    : _arena{std::exchange(other._arena, nullptr)}, _index{other._index} {}
+
+buffer_arena::handle::~handle() { reset(); }
+
+buffer_arena::handle& buffer_arena::handle::operator=(handle&& other) {
+  if (this != &other) {
+    reset();
+    _arena = std::exchange(other._arena, nullptr);
+    _index = other._index;
+  }
+  return *this;
+}
+
+std::span<uint8_t> buffer_arena::handle::bytes() const {
+  if (!_arena) {
+    return {};
+  }
+  return {_arena->_storage.get() + _index * _arena->_slab_size,
+          _arena->_slab_size};
+}
+
+std::span<char> buffer_arena::handle::chars() const {
+  const auto data = bytes();
+  return {reinterpret_cast<char*>(data.data()), data.size()};
+}
+
+void buffer_arena::handle::reset() {
+  if (_arena) {
+    std::exchange(_arena, nullptr)->release(_index);
+  }
+}
+
+buffer_arena::buffer_arena(const char* name, const size_t slab_count,
+                           const size_t slab_size)
+    : _slab_count{slab_count}, _slab_size{slab_size},
+      _storage{std::make_unique<uint8_t[]>(slab_count * slab_size)},
+      _next_free{std::make_unique<std::atomic<uint16_t>[]>(slab_count)},
+      _free_head{slab_count > 0 ? 0u : no_slab} {
+  assert(slab_count < no_slab);
+
+  for (size_t index = 0; index < slab_count; index++) {
+    _next_free[index].store(
+        index + 1 < slab_count ? uint16_t(index + 1) : no_slab,
+        std::memory_order_relaxed);
+  }
+
+  ESP_LOGI(TAG, "%s: %zu slabs of %zu bytes, %zu bytes in total", name,
+           slab_count, slab_size, capacity());
+}
+
+buffer_arena::handle buffer_arena::acquire() {
+  auto head = _free_head.load(std::memory_order_acquire);
+  while (true) {
+    const auto index = uint16_t(head & index_mask);
+    if (index == no_slab) {
+      _exhausted.fetch_add(1, std::memory_order_relaxed);
+      return {};
+    }
+
+    // A stale next index fails the exchange because the tag changed
+    const auto next = _next_free[index].load(std::memory_order_relaxed);
+    if (_free_head.compare_exchange_weak(head, make_head(head, next),
+                                         std::memory_order_acquire,
+                                         std::memory_order_acquire)) {
+      const auto in_use = _in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+      auto peak = _peak.load(std::memory_order_relaxed);
+      while (in_use > peak && !_peak.compare_exchange_weak(
+                                  peak, in_use, std::memory_order_relaxed)) {
+      }
+      return handle{*this, index};
+    }
+  }
+}
+
+void buffer_arena::release(const uint16_t index) {
+  _in_use.fetch_sub(1, std::memory_order_relaxed);
+
+  auto head = _free_head.load(std::memory_order_relaxed);
+  do {
+    _next_free[index].store(uint16_t(head & index_mask),
+                            std::memory_order_relaxed);
+  } while (!_free_head.compare_exchange_weak(head, make_head(head, index),
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+}
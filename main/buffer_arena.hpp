@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+/*! A fixed number of equally sized slabs allocated once when the arena is
+ * created, so buffers that move between tasks don't touch the heap after
+ * boot and the arena's size is the peak memory they can use.
+ *
+ * Slabs are handed out as move-only handles that return the slab to the
+ * arena when destroyed. Stages pass the handles instead of copying the
+ * data. Acquiring and releasing are lock-free and may happen on any task.
+ */
+class buffer_arena {
+public:
+  /*! Exclusive access to a slab of the arena, empty if default constructed
+   * or moved from
+   */
+  class handle {
+  public:
+    handle() = default;
+    handle(handle&& other);
+    handle(const handle& other) = delete;
+
+    ~handle();
+
+    handle& operator=(handle&& other);
+    handle& operator=(const handle& other) = delete;
+
+    explicit operator bool() const { return _arena != nullptr; }
+
+    std::span<uint8_t> bytes() const;
+
+    /*! The slab as characters, e.g. for a text_writer
+     */
+    std::span<char> chars() const;
+
+    /*! Returns the slab to the arena early
+     */
+    void reset();
+
+  private:
+    friend class buffer_arena;
+
+    handle(buffer_arena& arena, uint16_t index)
+        : _arena{&arena}, _index{index} {}
+
+    buffer_arena* _arena{nullptr};
+    uint16_t _index{0};
+  };
+
+  buffer_arena(const char* name, size_t slab_count, size_t slab_size);
+  buffer_arena(const buffer_arena& other) = delete;
+
+  buffer_arena& operator=(const buffer_arena& other) = delete;
+
+  /*! Returns a free slab or an empty handle if all slabs are in use
+   */
+  handle acquire();
+
+  size_t slab_count() const { return _slab_count; }
+  size_t slab_size() const { return _slab_size; }
+
+  /*! The memory of all slabs in bytes
+   */
+  size_t capacity() const { return _slab_count * _slab_size; }
+
+  size_t in_use() const { return _in_use.load(std::memory_order_relaxed); }
+
+  /*! The most slabs that were in use at the same time
+   */
+  size_t peak_in_use() const { return _peak.load(std::memory_order_relaxed); }
+
+  /*! Number of acquires that failed because all slabs were in use
+   */
+  size_t exhausted() const {
+    return _exhausted.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr uint16_t no_slab = 0xffff;
+
+  void release(uint16_t index);
+
+  size_t _slab_count;
+  size_t _slab_size;
+  std::unique_ptr<uint8_t[]> _storage;
+  std::unique_ptr<std::atomic<uint16_t>[]> _next_free;
+
+  /*! Index of the first free slab in the lower 16 bits and a tag in the
+   * upper 16 bits that changes with every update to avoid ABA problems
+   */
+  std::atomic<uint32_t> _free_head;
+
+  std::atomic<size_t> _in_use{0};
+  std::atomic<size_t> _peak{0};
+  std::atomic<size_t> _exhausted{0};
+};
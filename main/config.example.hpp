@@ -1,17 +1,37 @@
 #pragma once
 
+#include "alert_rules.hpp"
+#include "delta_publish_filter.hpp"
+#include "duty_cycle.hpp"
+#include "home_assistant_publisher.hpp"
 #include "mqtt_client.hpp"
+#include "mqtt_logger.hpp"
+#include "runtime_settings.hpp"
+#include "sensor_aggregator.hpp"
+#include "wifi_reconnect_policy.hpp"
 
 #include "spymarine/read_devices.hpp"
 
 #include <chrono>
 
 constexpr auto wifi_retry_interval = std::chrono::seconds{5};
-constexpr auto sensor_update_interval = std::chrono::minutes{1};
+
+// Duty-cycled mode only, gives up and sleeps until the next cycle instead of
+// draining the battery while the Wifi is out of reach
+constexpr auto wifi_connect_timeout = std::chrono::seconds{30};
+constexpr auto publish_mode = sensor_publish_mode::changed;
+constexpr auto diagnostics_interval = std::chrono::seconds{60};
+
+// Hubs are found by listening for their sensor broadcasts, which they send
+// about every second
+constexpr auto hub_discovery_duration = std::chrono::seconds{3};
+constexpr size_t max_hubs = 4;
 
 constexpr auto wifi_ssid = "SSID";
 constexpr auto wifi_password = "password";
 
+constexpr auto ntp_server = "pool.ntp.org";
+
 constexpr auto mqtt_broker_uri = "mqtts://unique-id.s1.eu.hivemq.cloud:8883";
 constexpr auto mqtt_username = "user";
 constexpr auto mqtt_password = "password";
@@ -28,11 +48,85 @@ inline esp_mqtt_client_config_t make_mqtt_config() {
   config.broker.verification.certificate = mqtt_root_ca_certificate;
   config.credentials.username = mqtt_username;
   config.credentials.authentication.password = mqtt_password;
+  // Keeps the subscriptions and pending messages on the broker across
+  // reconnects. The default client id is derived from the MAC address, so it
+  // stays the same.
+  config.session.disable_clean_session = true;
+  // Any message resets the keep alive, so pings are only sent while nothing
+  // is published. The broker publishes the offline will after 1.5 times the
+  // keep alive without a message.
+  config.session.keepalive = 60;
+  return config;
+}
+
+inline mqtt_logger_config make_mqtt_logger_config() {
+  mqtt_logger_config config;
+  config.level = ESP_LOG_INFO;
+  config.excluded_tags = {"mqtt_client"};
+  config.batch_interval = std::chrono::seconds{5};
+  return config;
+}
+
+inline wifi_reconnect_config make_wifi_reconnect_config() {
+  wifi_reconnect_config config;
+  config.authentication.max = std::chrono::minutes{5};
+  config.pinned_attempts = 3;
+  return config;
+}
+
+// Can be changed at runtime on the config topic, see runtime_settings.hpp
+inline device_type_filter make_device_filter() {
+  return filter_device_types<spymarine::temperature_device,
+                             spymarine::tank_device,
+                             spymarine::battery_device>();
+}
+
+inline aggregation_config make_aggregation_config() {
+  aggregation_config config;
+  config.defaults = {.window = std::chrono::minutes{1}};
+  config.set_aggregation<spymarine::battery_device>(
+      {.window = std::chrono::seconds{5}, .reduction = sensor_reduction::ema});
+  config.set_aggregation<spymarine::tank_device>(
+      {.window = std::chrono::minutes{10},
+       .reduction = sensor_reduction::mean});
+  return config;
+}
+
+inline delta_publish_config make_delta_publish_config() {
+  delta_publish_config config;
+  config.max_interval = std::chrono::minutes{15};
+  config.set_deadband<spymarine::temperature_device>({.absolute = 0.2f});
+  config.set_deadband<spymarine::tank_device>({.absolute = 1.0f});
+  config.set_deadband<spymarine::battery_device>({.relative = 0.01f});
   return config;
 }
 
-inline auto make_device_filter() {
-  return spymarine::filter_by_device_type<spymarine::temperature_device,
-                                          spymarine::tank_device,
-                                          spymarine::battery_device>{};
+// Checked against every raw sample, device names as in the Simarine app
+inline std::vector<alert_rule> make_alert_rules() {
+  return {
+      {.name = "battery_low",
+       .device = "Battery",
+       .sensor = "voltage",
+       .condition = alert_condition::below,
+       .threshold = 11.8f,
+       .hysteresis = 0.3f},
+      {.name = "battery_draining",
+       .device = "Battery",
+       .sensor = "charge",
+       .condition = alert_condition::falling_faster_than,
+       .threshold = 1.0f,
+       .hysteresis = 0.5f,
+       .rate_interval = std::chrono::seconds{30}},
+  };
+}
+
+inline duty_cycle_config make_duty_cycle_config() {
+  duty_cycle_config config;
+  config.enabled = false;
+  config.interval = std::chrono::minutes{10};
+  config.window = std::chrono::seconds{10};
+  config.active_current_ma = 100.0f;
+  config.sleep_current_ma = 0.01f;
+  config.supply_voltage = 3.3f;
+  return config;
 }
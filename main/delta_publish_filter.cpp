@@ -0,0 +1,65 @@
+#include "delta_publish_filter.hpp"
+
+#include <cmath>
+
+namespace {
+
+bool exceeds_deadband(const deadband& band, float published, float current) {
+  const auto difference = std::fabs(current - published);
+  if (band.absolute == 0.0f && band.relative == 0.0f) {
+    return difference > 0.0f;
+  }
+
+  return (band.absolute > 0.0f && difference > band.absolute) ||
+         (band.relative > 0.0f &&
+          difference > band.relative * std::fabs(published));
+}
+
+} // namespace
+
+delta_publish_filter::delta_publish_filter(delta_publish_config config)
+    : _config{std::move(config)} {}
+
+bool delta_publish_filter::is_due(const size_t device_index,
+                                  const spymarine::device& device,
+                                  const clock::time_point now) const {
+  if (device_index >= _published_states.size()) {
+    return true;
+  }
+
+  const auto& state = _published_states[device_index];
+  const auto& band = _config.deadbands[device.index()];
+
+  bool changed = !state.valid || now - state.time >= _config.max_interval;
+  size_t sensor_index = 0;
+  for_each_sensor(device, [&](const sensor_description&,
+                              const spymarine::sensor& sensor) {
+    changed = changed || exceeds_deadband(band, state.values[sensor_index],
+                                          sensor.value);
+    sensor_index++;
+  });
+  return changed;
+}
+
+void delta_publish_filter::mark_published(const size_t device_index,
+                                          const spymarine::device& device,
+                                          const clock::time_point now) {
+  if (device_index >= _published_states.size()) {
+    _published_states.resize(device_index + 1);
+  }
+
+  auto& state = _published_states[device_index];
+  size_t sensor_index = 0;
+  for_each_sensor(device, [&](const sensor_description&,
+                              const spymarine::sensor& sensor) {
+    state.values[sensor_index++] = sensor.value;
+  });
+  state.time = now;
+  state.valid = true;
+}
+
+void delta_publish_filter::reset() {
+  for (auto& state : _published_states) {
+    state.valid = false;
+  }
+}
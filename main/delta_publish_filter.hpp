@@ -0,0 +1,74 @@
+#pragma once
+
+#include "device_sensors.hpp"
+
+#include "spymarine/device.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <variant>
+#include <vector>
+
+/*! A sensor value is considered changed if it moved by more than the
+ * absolute or the relative (to the last published value) amount. If both
+ * are zero any change is considered a change.
+ */
+struct deadband {
+  float absolute{0.0f};
+  float relative{0.0f};
+};
+
+struct delta_publish_config {
+  /*! The maximum time between two state messages of a device. Keeps Home
+   * Assistant from marking sensors as unavailable if their values don't
+   * change.
+   */
+  std::chrono::seconds max_interval{std::chrono::minutes{15}};
+
+  std::array<deadband, std::variant_size_v<spymarine::device>> deadbands{};
+
+  /*! Sets the deadband for all sensors of the given device type
+   */
+  template <typename T> void set_deadband(deadband value) {
+    deadbands[device_type_index<T>()] = value;
+  }
+};
+
+/*! Keeps the last published sensor values of each device and decides if a
+ * new state message is necessary
+ */
+class delta_publish_filter {
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit delta_publish_filter(delta_publish_config config);
+
+  /*! Returns true if the state of the device at the given index changed
+   * past its deadband or the keep-alive interval elapsed
+   */
+  bool is_due(size_t device_index, const spymarine::device& device,
+              clock::time_point now) const;
+
+  /*! Remembers the current values of the device as published. Only called
+   * once the message was handed over, so a dropped message is retried with
+   * the next window.
+   */
+  void mark_published(size_t device_index, const spymarine::device& device,
+                      clock::time_point now);
+
+  /*! Forgets all published values so that is_due returns true for every
+   * device
+   */
+  void reset();
+
+private:
+  struct published_state {
+    std::array<float, max_device_sensors> values{};
+    clock::time_point time{};
+    bool valid{false};
+  };
+
+  delta_publish_config _config;
+  std::vector<published_state> _published_states;
+};
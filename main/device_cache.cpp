@@ -0,0 +1,161 @@
+#include "device_cache.hpp"
+#include "device_serialization.hpp"
+#include "nvs_storage.hpp"
+
+#include "esp_log.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_pthread.h"
+#endif
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+constexpr auto TAG = "device_cache";
+constexpr auto device_cache_namespace = "devices";
+// Blobs of the layout without the MAC address are kept under "hubs" and are
+// ignored, so they can't be misread
+constexpr auto device_cache_key = "hubs_mac";
+
+// Layout: the hub count (u8) followed by the hubs. Each hub consists of its
+// IP (u32), whether the MAC address is known (u8), the MAC address (6 bytes,
+// zero if unknown), the size of its serialized devices (u16) and the
+// serialized devices, which carry their own format version. Little endian.
+constexpr size_t hub_header_size = 13;
+
+void write_le(std::vector<uint8_t>& data, uint32_t value, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    data.push_back(uint8_t(value >> (i * 8)));
+  }
+}
+
+uint32_t read_le(std::span<const uint8_t> data, size_t size) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < size; i++) {
+    value |= uint32_t(data[i]) << (i * 8);
+  }
+  return value;
+}
+
+} // namespace
+
+std::vector<uint8_t> serialize_hubs(std::span<const cached_devices> hubs) {
+  std::vector<uint8_t> data;
+  data.push_back(uint8_t(hubs.size()));
+
+  for (const auto& hub : hubs) {
+    const auto devices = serialize_devices(hub.devices);
+    write_le(data, hub.ip, 4);
+    data.push_back(hub.mac ? 1 : 0);
+    const auto mac = hub.mac.value_or(std::array<uint8_t, 6>{});
+    data.insert(data.end(), mac.begin(), mac.end());
+    write_le(data, uint32_t(devices.size()), 2);
+    data.insert(data.end(), devices.begin(), devices.end());
+  }
+
+  return data;
+}
+
+std::optional<std::vector<cached_devices>>
+deserialize_hubs(std::span<const uint8_t> data) {
+  if (data.empty()) {
+    return std::nullopt;
+  }
+
+  const auto count = data[0];
+  data = data.subspan(1);
+
+  std::vector<cached_devices> hubs;
+  hubs.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    if (data.size() < hub_header_size) {
+      return std::nullopt;
+    }
+    const auto ip = read_le(data, 4);
+    std::optional<std::array<uint8_t, 6>> mac;
+    if (data[4]) {
+      mac.emplace();
+      std::copy_n(data.begin() + 5, mac->size(), mac->begin());
+    }
+    const auto size = read_le(data.subspan(11), 2);
+    data = data.subspan(hub_header_size);
+    if (data.size() < size) {
+      return std::nullopt;
+    }
+
+    auto devices = deserialize_devices(data.first(size));
+    if (!devices || devices->empty()) {
+      return std::nullopt;
+    }
+    data = data.subspan(size);
+
+    hubs.push_back({ip, std::move(*devices), mac});
+  }
+
+  if (!data.empty() || hubs.empty()) {
+    return std::nullopt;
+  }
+  return hubs;
+}
+
+std::optional<std::vector<cached_devices>> load_device_cache() {
+  const auto data = nvs_read_blob(device_cache_namespace, device_cache_key);
+  if (!data) {
+    return std::nullopt;
+  }
+
+  auto hubs = deserialize_hubs(*data);
+  if (!hubs) {
+    ESP_LOGW(TAG, "Ignoring outdated or invalid device cache");
+  }
+  return hubs;
+}
+
+bool store_device_cache(std::span<const cached_devices> hubs) {
+  return nvs_write_blob(device_cache_namespace, device_cache_key,
+                        serialize_hubs(hubs));
+}
+
+bool same_topology(std::span<const cached_devices> lhs,
+                   std::span<const cached_devices> rhs) {
+  return serialize_hubs(lhs) == serialize_hubs(rhs);
+}
+
+device_enumerator::device_enumerator(enumerate_function enumerate)
+    : _enumerate{std::move(enumerate)} {}
+
+device_enumerator::~device_enumerator() {
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+void device_enumerator::start() {
+#ifdef ESP_PLATFORM
+  auto config = esp_pthread_get_default_config();
+  config.stack_size = stack_size;
+  config.thread_name = "device_enum";
+  ESP_ERROR_CHECK(esp_pthread_set_cfg(&config));
+#endif
+
+  _thread = std::thread{[this] {
+    auto result = _enumerate();
+    if (result) {
+      std::lock_guard lock{_mutex};
+      _result = std::move(result);
+    }
+    _finished = true;
+  }};
+
+#ifdef ESP_PLATFORM
+  config = esp_pthread_get_default_config();
+  ESP_ERROR_CHECK(esp_pthread_set_cfg(&config));
+#endif
+}
+
+std::optional<std::vector<cached_devices>> device_enumerator::take_result() {
+  std::lock_guard lock{_mutex};
+  return std::exchange(_result, std::nullopt);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "spymarine/device.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+/*! A Simarine hub's address in host byte order and its devices. The MAC
+ * address identifies the hub across DHCP leases, it's unknown if the hub
+ * wasn't in the ARP table.
+ */
+struct cached_devices {
+  uint32_t ip;
+  std::vector<spymarine::device> devices;
+  std::optional<std::array<uint8_t, 6>> mac{};
+};
+
+/*! Serializes the hubs and their devices, without sensor values
+ */
+std::vector<uint8_t> serialize_hubs(std::span<const cached_devices> hubs);
+
+/*! Restores hubs serialized with serialize_hubs. Returns std::nullopt if the
+ * data is malformed or was written in an older format.
+ */
+std::optional<std::vector<cached_devices>>
+deserialize_hubs(std::span<const uint8_t> data);
+
+/*! Loads the hubs stored with store_device_cache from NVS. Returns
+ * std::nullopt if there are none or they were stored in an older format.
+ */
+std::optional<std::vector<cached_devices>> load_device_cache();
+
+bool store_device_cache(std::span<const cached_devices> hubs);
+
+/*! Returns true if both lists contain the same hubs with the same devices and
+ * sensors, sensor values are ignored
+ */
+bool same_topology(std::span<const cached_devices> lhs,
+                   std::span<const cached_devices> rhs);
+
+/*! Runs the device enumeration on a separate thread, so the app can already
+ * work with cached devices in the meantime
+ */
+class device_enumerator {
+public:
+  using enumerate_function =
+      std::function<std::optional<std::vector<cached_devices>>()>;
+
+  static constexpr size_t stack_size = 8192;
+
+  explicit device_enumerator(enumerate_function enumerate);
+  device_enumerator(const device_enumerator& other) = delete;
+
+  ~device_enumerator();
+
+  void start();
+
+  /*! Returns the enumerated devices once the enumeration succeeded, and
+   * std::nullopt before and after that
+   */
+  std::optional<std::vector<cached_devices>> take_result();
+
+  /*! Returns true once the enumeration succeeded or failed, destroying the
+   * enumerator doesn't block after that
+   */
+  bool finished() const { return _finished; }
+
+  device_enumerator& operator=(const device_enumerator& other) = delete;
+
+private:
+  enumerate_function _enumerate;
+  std::thread _thread;
+  std::mutex _mutex;
+  std::optional<std::vector<cached_devices>> _result;
+  std::atomic<bool> _finished{false};
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "spymarine/device.hpp"
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+/*! The maximum number of sensors a single device has
+ */
+constexpr size_t max_device_sensors = 4;
+
+/*! Describes how a sensor is exposed to Home Assistant
+ */
+struct sensor_description {
+  /*! Key of the value in state messages
+   */
+  std::string_view key;
+
+  /*! Home Assistant device class, empty if there is none
+   */
+  std::string_view device_class;
+
+  std::string_view unit;
+};
+
+namespace sensor_descriptions {
+constexpr sensor_description charge{"charge", "battery", "%"};
+constexpr sensor_description remaining_capacity{"remaining_capacity", "",
+                                                "Ah"};
+constexpr sensor_description current{"current", "current", "A"};
+constexpr sensor_description voltage{"voltage", "voltage", "V"};
+constexpr sensor_description temperature{"temperature", "temperature",
+                                         "°C"};
+constexpr sensor_description pressure{"pressure", "atmospheric_pressure",
+                                      "mbar"};
+constexpr sensor_description resistance{"resistance", "", "Ω"};
+constexpr sensor_description level{"level", "", "%"};
+} // namespace sensor_descriptions
+
+/*! The sensors of the device type T at compile time: their descriptions and
+ * the members holding them, in the order for_each_sensor visits them
+ */
+template <typename T> struct device_sensor_layout {
+  static constexpr std::array descriptions{
+      std::is_same_v<T, spymarine::current_device>
+          ? sensor_descriptions::current
+      : std::is_same_v<T, spymarine::temperature_device>
+          ? sensor_descriptions::temperature
+      : std::is_same_v<T, spymarine::barometer_device>
+          ? sensor_descriptions::pressure
+      : std::is_same_v<T, spymarine::resistive_device>
+          ? sensor_descriptions::resistance
+      : std::is_same_v<T, spymarine::tank_device>
+          ? sensor_descriptions::level
+          : sensor_descriptions::voltage};
+  static constexpr std::tuple members{&T::device_sensor};
+};
+
+template <> struct device_sensor_layout<spymarine::battery_device> {
+  static constexpr std::array descriptions{
+      sensor_descriptions::charge, sensor_descriptions::remaining_capacity,
+      sensor_descriptions::current, sensor_descriptions::voltage};
+  static constexpr std::tuple members{
+      &spymarine::battery_device::charge_sensor,
+      &spymarine::battery_device::remaining_capacity_sensor,
+      &spymarine::battery_device::current_sensor,
+      &spymarine::battery_device::voltage_sensor};
+};
+
+/*! Calls the given function with the description and the sensor of each
+ * sensor of the device in a stable order
+ */
+template <typename Device, typename Function>
+  requires std::is_same_v<std::remove_const_t<Device>, spymarine::device>
+void for_each_sensor(Device& device, Function&& function) {
+  std::visit(
+      [&](auto& concrete_device) {
+        using device_type = std::remove_cvref_t<decltype(concrete_device)>;
+        using layout = device_sensor_layout<device_type>;
+        [&]<size_t... I>(std::index_sequence<I...>) {
+          (function(layout::descriptions[I],
+                    concrete_device.*std::get<I>(layout::members)),
+           ...);
+        }(std::make_index_sequence<layout::descriptions.size()>{});
+      },
+      device);
+}
+
+/*! The name of the device as configured in the Simarine app
+ */
+inline std::string_view device_name(const spymarine::device& device) {
+  return std::visit(
+      [](const auto& concrete_device) -> std::string_view {
+        if constexpr (requires { concrete_device.name; }) {
+          return concrete_device.name;
+        } else {
+          return "Pico";
+        }
+      },
+      device);
+}
+
+/*! The index of the device type T in the spymarine::device variant
+ */
+template <typename T, size_t I = 0> constexpr size_t device_type_index() {
+  static_assert(I < std::variant_size_v<spymarine::device>,
+                "T is not a spymarine device type");
+  if constexpr (std::is_same_v<T, std::variant_alternative_t<
+                                      I, spymarine::device>>) {
+    return I;
+  } else {
+    return device_type_index<T, I + 1>();
+  }
+}
@@ -0,0 +1,193 @@
+#include "device_serialization.hpp"
+#include "device_sensors.hpp"
+
+#include <cstring>
+#include <string>
+#include <utility>
+
+// Layout: the format version (u8), the device count (u16) followed by the
+// devices. Each device consists of its index in the spymarine::device
+// variant (u8), its name length (u8) and name, the type (u8) and state index
+// (u8) of each of its sensors and for tanks and batteries their type (u8)
+// and capacity (f32).
+
+namespace {
+
+class byte_writer {
+public:
+  void u8(uint8_t value) { _data.push_back(value); }
+
+  void u16(uint16_t value) {
+    u8(uint8_t(value));
+    u8(uint8_t(value >> 8));
+  }
+
+  void f32(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int shift = 0; shift < 32; shift += 8) {
+      u8(uint8_t(bits >> shift));
+    }
+  }
+
+  void string(std::string_view value) {
+    const auto size = std::min<size_t>(value.size(), UINT8_MAX);
+    u8(uint8_t(size));
+    _data.insert(_data.end(), value.begin(), value.begin() + size);
+  }
+
+  std::vector<uint8_t> take() { return std::move(_data); }
+
+private:
+  std::vector<uint8_t> _data;
+};
+
+class byte_reader {
+public:
+  explicit byte_reader(std::span<const uint8_t> data) : _data{data} {}
+
+  uint8_t u8() {
+    if (_data.empty()) {
+      _failed = true;
+      return 0;
+    }
+    const auto value = _data.front();
+    _data = _data.subspan(1);
+    return value;
+  }
+
+  uint16_t u16() {
+    const auto low = u8();
+    return uint16_t(low | (u8() << 8));
+  }
+
+  float f32() {
+    uint32_t bits = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+      bits |= uint32_t(u8()) << shift;
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  std::string string() {
+    const auto size = u8();
+    if (_data.size() < size) {
+      _failed = true;
+      return {};
+    }
+    std::string value{reinterpret_cast<const char*>(_data.data()), size};
+    _data = _data.subspan(size);
+    return value;
+  }
+
+  bool failed() const { return _failed; }
+  bool done() const { return _data.empty(); }
+
+private:
+  std::span<const uint8_t> _data;
+  bool _failed{false};
+};
+
+template <size_t... I>
+std::optional<spymarine::device> make_device(size_t index,
+                                             std::index_sequence<I...>) {
+  std::optional<spymarine::device> result;
+  ((index == I ? (result.emplace(std::in_place_index<I>), true) : false) ||
+   ...);
+  return result;
+}
+
+} // namespace
+
+std::vector<uint8_t>
+serialize_devices(std::span<const spymarine::device> devices) {
+  byte_writer writer;
+  writer.u8(device_serialization_version);
+  writer.u16(uint16_t(devices.size()));
+
+  for (const auto& device : devices) {
+    writer.u8(uint8_t(device.index()));
+
+    std::visit(
+        [&](const auto& concrete_device) {
+          if constexpr (requires { concrete_device.name; }) {
+            writer.string(concrete_device.name);
+          } else {
+            writer.string({});
+          }
+        },
+        device);
+
+    for_each_sensor(device, [&](const sensor_description&,
+                                const spymarine::sensor& sensor) {
+      writer.u8(uint8_t(sensor.type));
+      writer.u8(sensor.state_index);
+    });
+
+    if (const auto tank = std::get_if<spymarine::tank_device>(&device)) {
+      writer.u8(uint8_t(tank->type));
+      writer.f32(tank->capacity);
+    } else if (const auto battery =
+                   std::get_if<spymarine::battery_device>(&device)) {
+      writer.u8(uint8_t(battery->type));
+      writer.f32(battery->capacity);
+    }
+  }
+
+  return writer.take();
+}
+
+std::optional<std::vector<spymarine::device>>
+deserialize_devices(std::span<const uint8_t> data) {
+  byte_reader reader{data};
+  if (reader.u8() != device_serialization_version) {
+    return std::nullopt;
+  }
+
+  const auto count = reader.u16();
+
+  std::vector<spymarine::device> devices;
+  devices.reserve(count);
+
+  for (size_t i = 0; i < count && !reader.failed(); i++) {
+    auto device = make_device(
+        reader.u8(),
+        std::make_index_sequence<std::variant_size_v<spymarine::device>>{});
+    if (!device) {
+      return std::nullopt;
+    }
+
+    auto name = reader.string();
+    std::visit(
+        [&](auto& concrete_device) {
+          if constexpr (requires { concrete_device.name; }) {
+            concrete_device.name = std::move(name);
+          }
+        },
+        *device);
+
+    for_each_sensor(*device, [&](const sensor_description&,
+                                 spymarine::sensor& sensor) {
+      sensor.type = static_cast<decltype(sensor.type)>(reader.u8());
+      sensor.state_index = reader.u8();
+    });
+
+    if (auto tank = std::get_if<spymarine::tank_device>(&*device)) {
+      tank->type = static_cast<decltype(tank->type)>(reader.u8());
+      tank->capacity = reader.f32();
+    } else if (auto battery =
+                   std::get_if<spymarine::battery_device>(&*device)) {
+      battery->type = static_cast<decltype(battery->type)>(reader.u8());
+      battery->capacity = reader.f32();
+    }
+
+    devices.push_back(std::move(*device));
+  }
+
+  if (reader.failed() || !reader.done()) {
+    return std::nullopt;
+  }
+  return devices;
+}
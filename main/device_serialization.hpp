@@ -0,0 +1,25 @@
+#pragma once
+
+#include "spymarine/device.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+/*! Incremented whenever the binary representation changes, older data is
+ * rejected by deserialize_devices
+ */
+constexpr uint8_t device_serialization_version = 1;
+
+/*! Serializes the device list, without sensor values, into a compact binary
+ * representation
+ */
+std::vector<uint8_t>
+serialize_devices(std::span<const spymarine::device> devices);
+
+/*! Restores a device list serialized with serialize_devices. Returns
+ * std::nullopt if the data is malformed.
+ */
+std::optional<std::vector<spymarine::device>>
+deserialize_devices(std::span<const uint8_t> data);
@@ -0,0 +1,155 @@
+#include "diagnostics_publisher.hpp"
+#include "home_assistant_serializer.hpp"
+#include "metrics.hpp"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+namespace {
+
+constexpr auto TAG = "diagnostics";
+constexpr auto diagnostics_state_topic = "simarine_esp/diagnostics/state";
+constexpr auto diagnostics_discovery_topic =
+    "homeassistant/device/simarine_esp_diagnostics/config";
+
+gauge g_free_heap{"free_heap", "B"};
+gauge g_minimum_free_heap{"minimum_free_heap", "B"};
+gauge g_largest_free_block{"largest_free_block", "B"};
+gauge g_stack_high_water_mark{"stack_high_water_mark", "B"};
+gauge g_publish_queue_dropped{"publish_queue_dropped"};
+gauge g_publish_queue_failed{"publish_queue_failed"};
+gauge g_message_slabs_peak{"message_slabs_peak"};
+
+} // namespace
+
+diagnostics_publisher::diagnostics_publisher(mqtt_client& client,
+                                             std::chrono::seconds interval)
+    : _client{client}, _interval{interval} {}
+
+void diagnostics_publisher::set_publish_queue(mqtt_publish_queue* queue) {
+  _queue = queue;
+}
+
+void diagnostics_publisher::update() {
+  const auto now = clock::now();
+  if (_last_publish != clock::time_point{} && now - _last_publish < _interval) {
+    return;
+  }
+  _last_publish = now;
+
+  if (!_discovery_sent) {
+    _discovery_sent = send_device_discovery();
+  }
+
+  sample_system_metrics();
+  if (publish_metrics()) {
+    for_each_metric([](metric& m) { m.reset_window(); });
+  }
+}
+
+void diagnostics_publisher::reset() {
+  _discovery_sent = false;
+  _last_publish = {};
+}
+
+void diagnostics_publisher::sample_system_metrics() {
+  g_free_heap.set(int32_t(esp_get_free_heap_size()));
+  g_minimum_free_heap.set(int32_t(esp_get_minimum_free_heap_size()));
+  g_largest_free_block.set(
+      int32_t(heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT)));
+  // Of the calling task, which is the one running the sensor loop
+  g_stack_high_water_mark.set(int32_t(uxTaskGetStackHighWaterMark(nullptr)));
+
+  if (_queue) {
+    const auto statistics = _queue->get_statistics();
+    g_publish_queue_dropped.set(int32_t(statistics.dropped));
+    g_publish_queue_failed.set(int32_t(statistics.failed));
+    g_message_slabs_peak.set(int32_t(_queue->arena().peak_in_use()));
+  }
+}
+
+bool diagnostics_publisher::send_device_discovery() {
+  _message.clear();
+  _message.topic().append(diagnostics_discovery_topic);
+
+  auto& payload = _message.payload();
+  payload.append(
+      R"({"dev":{"ids":"simarine_esp_diagnostics","name":"Simarine ESP Diagnostics"},)"
+      R"("o":{"name":"simarine_esp","url":"https://github.com/christopher-strack/esp_simarine_home_assistant"},)"
+      R"("cmps":{)");
+
+  bool first = true;
+  for_each_metric([&](const metric& m) {
+    if (!first) {
+      payload.append(',');
+    }
+    first = false;
+
+    payload.append(R"("simarine_esp_diagnostics_)")
+        .append_identifier(m.name())
+        .append(R"(":{"p":"sensor","unique_id":"simarine_esp_diagnostics_)")
+        .append_identifier(m.name())
+        .append(R"(","name":)")
+        .append_json_string(m.name())
+        .append(R"(,"entity_category":"diagnostic","state_class":"measurement",)");
+    if (!m.unit().empty()) {
+      payload.append(R"("unit_of_measurement":)")
+          .append_json_string(m.unit())
+          .append(',');
+    }
+    payload.append(R"("value_template":"{{ value_json.)")
+        .append(m.name())
+        .append(m.value_selector())
+        .append(R"( }}"})");
+  });
+
+  payload.append(R"(},"state_topic":)")
+      .append_json_string(diagnostics_state_topic)
+      .append(R"(,"availability_topic":)")
+      .append_json_string(availability_topic)
+      .append(R"(,"qos":0})");
+
+  if (_message.overflowed()) {
+    ESP_LOGE(TAG, "Diagnostics discovery message exceeds the buffer size");
+    return false;
+  }
+  return publish_message(true);
+}
+
+bool diagnostics_publisher::publish_metrics() {
+  _message.clear();
+  _message.topic().append(diagnostics_state_topic);
+
+  auto& payload = _message.payload();
+  payload.append('{');
+  bool first = true;
+  for_each_metric([&](const metric& m) {
+    if (!first) {
+      payload.append(',');
+    }
+    first = false;
+
+    payload.append_json_string(m.name()).append(':');
+    m.write_value(payload);
+  });
+  payload.append('}');
+
+  if (_message.overflowed()) {
+    ESP_LOGE(TAG, "Diagnostics message exceeds the buffer size");
+    return false;
+  }
+  return publish_message(false);
+}
+
+bool diagnostics_publisher::publish_message(bool retain) {
+  if (_queue) {
+    return _queue
+        ->publish(_message.topic().c_str(), _message.payload().view(),
+                  mqtt_qos::at_most_once, retain)
+        .has_value();
+  }
+  return _client.publish(_message, mqtt_qos::at_most_once, retain);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "message_buffer.hpp"
+#include "mqtt_client.hpp"
+#include "mqtt_publish_queue.hpp"
+
+#include <chrono>
+
+/*! Publishes all metrics as diagnostic sensors of a "Simarine ESP
+ * Diagnostics" Home Assistant device. Meant to be updated from the sensor
+ * loop, only publishes once per interval.
+ */
+class diagnostics_publisher {
+public:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr size_t max_topic_size = 128;
+  static constexpr size_t max_payload_size = 4096;
+
+  diagnostics_publisher(mqtt_client& client, std::chrono::seconds interval);
+  diagnostics_publisher(const diagnostics_publisher& other) = delete;
+
+  void set_publish_queue(mqtt_publish_queue* queue);
+
+  /*! Samples the system metrics and publishes all metrics if the interval
+   * passed since the last publish
+   */
+  void update();
+
+  /*! Publishes the discovery message and the metrics again on the next
+   * update
+   */
+  void reset();
+
+  diagnostics_publisher& operator=(const diagnostics_publisher& other) = delete;
+
+private:
+  void sample_system_metrics();
+  bool send_device_discovery();
+  bool publish_metrics();
+  bool publish_message(bool retain);
+
+  mqtt_client& _client;
+  mqtt_publish_queue* _queue{nullptr};
+  std::chrono::seconds _interval;
+  clock::time_point _last_publish{};
+  bool _discovery_sent{false};
+  fixed_message_buffer<max_topic_size, max_payload_size> _message;
+};
@@ -0,0 +1,91 @@
+#include "discovery_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr uint16_t format_version = 1;
+
+struct header {
+  uint16_t version;
+  uint16_t count;
+};
+
+uint32_t fnv1a(uint32_t hash, std::string_view data) {
+  for (const auto c : data) {
+    hash ^= uint8_t(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+} // namespace
+
+uint32_t discovery_cache::hash(std::string_view topic,
+                               std::string_view payload) {
+  return fnv1a(fnv1a(2166136261u, topic), payload);
+}
+
+bool discovery_cache::load(std::span<const uint8_t> data) {
+  _entries.clear();
+  _dirty = false;
+
+  header h{};
+  if (data.size() < sizeof(h)) {
+    return false;
+  }
+  std::memcpy(&h, data.data(), sizeof(h));
+  if (h.version != format_version ||
+      data.size() != sizeof(h) + h.count * sizeof(entry)) {
+    return false;
+  }
+
+  _entries.resize(h.count);
+  std::memcpy(_entries.data(), data.data() + sizeof(h),
+              h.count * sizeof(entry));
+  for (auto& entry : _entries) {
+    entry.topic.back() = '\0';
+  }
+  return true;
+}
+
+std::vector<uint8_t> discovery_cache::data() const {
+  const header h{format_version, uint16_t(_entries.size())};
+  std::vector<uint8_t> result(sizeof(h) + _entries.size() * sizeof(entry));
+  std::memcpy(result.data(), &h, sizeof(h));
+  std::memcpy(result.data() + sizeof(h), _entries.data(),
+              _entries.size() * sizeof(entry));
+  _dirty = false;
+  return result;
+}
+
+bool discovery_cache::is_published(std::string_view topic,
+                                   uint32_t hash) const {
+  return std::any_of(_entries.begin(), _entries.end(), [&](const auto& entry) {
+    return entry.hash == hash && entry.topic_view() == topic;
+  });
+}
+
+bool discovery_cache::set_published(std::string_view topic, uint32_t hash) {
+  if (topic.size() >= max_topic_size) {
+    return false;
+  }
+
+  auto it = std::find_if(_entries.begin(), _entries.end(),
+                         [&](const auto& entry) {
+                           return entry.topic_view() == topic;
+                         });
+  if (it == _entries.end()) {
+    if (_entries.size() >= _max_entries) {
+      return false;
+    }
+    it = _entries.insert(_entries.end(), entry{});
+  }
+
+  std::fill(it->topic.begin(), it->topic.end(), '\0');
+  std::copy(topic.begin(), topic.end(), it->topic.begin());
+  it->hash = hash;
+  _dirty = true;
+  return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/*! Remembers the hash of each published (retained) discovery config so
+ * that only added, changed and removed configs need to be published.
+ * The cache is persisted as a blob, see data() and load().
+ */
+class discovery_cache {
+public:
+  static constexpr size_t default_max_entries = 48;
+  static constexpr size_t max_topic_size = 96;
+
+  explicit discovery_cache(size_t max_entries = default_max_entries)
+      : _max_entries{max_entries} {}
+
+  static uint32_t hash(std::string_view topic, std::string_view payload);
+
+  /*! Replaces the cache content with the serialized cache. Returns false
+   * and leaves the cache empty if the data isn't a valid cache.
+   */
+  bool load(std::span<const uint8_t> data);
+
+  /*! Serialized cache content
+   */
+  std::vector<uint8_t> data() const;
+
+  bool is_published(std::string_view topic, uint32_t hash) const;
+
+  /*! Returns false if the topic isn't cached because the cache is full or
+   * the topic is too long. Such configs are published by every sync and
+   * can't be removed once their device is gone.
+   */
+  bool set_published(std::string_view topic, uint32_t hash);
+
+  /*! Calls remove for each cached topic for which keep returns false and
+   * forgets the topic if remove returns true
+   */
+  template <typename Keep, typename Remove>
+  void remove_stale(Keep&& keep, Remove&& remove) {
+    std::erase_if(_entries, [&](const entry& entry) {
+      const auto topic = entry.topic_view();
+      if (keep(topic) || !remove(topic)) {
+        return false;
+      }
+      _dirty = true;
+      return true;
+    });
+  }
+
+  bool empty() const { return _entries.empty(); }
+
+  /*! Returns true if the cache changed since the last call to data() or
+   * load()
+   */
+  bool dirty() const { return _dirty; }
+
+private:
+  struct entry {
+    std::array<char, max_topic_size> topic;
+    uint32_t hash;
+
+    std::string_view topic_view() const { return topic.data(); }
+  };
+
+  size_t _max_entries;
+  std::vector<entry> _entries;
+  mutable bool _dirty{false};
+};
@@ -0,0 +1,181 @@
+#include "duty_cycle.hpp"
+#include "message_buffer.hpp"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+
+namespace {
+
+constexpr auto TAG = "duty_cycle";
+constexpr uint32_t rtc_state_magic = 0x53444332; // "SDC2"
+constexpr size_t max_serialized_devices_size = 2048;
+
+constexpr auto metrics_state_topic = "simarine_esp/duty_cycle/state";
+constexpr auto metrics_discovery_topic =
+    "homeassistant/device/simarine_esp_duty_cycle/config";
+
+/*! Lives in RTC slow memory, which keeps its content during deep sleep but
+ * not across power loss. Needs to be trivially copyable for that reason.
+ */
+struct rtc_state {
+  uint32_t magic;
+  uint32_t cycle;
+
+  bool has_access_point;
+  wifi_access_point access_point;
+
+  bool has_devices;
+  uint16_t devices_size;
+  std::array<uint8_t, max_serialized_devices_size> devices;
+
+  bool has_metrics;
+  uint32_t wake_to_sleep_ms;
+  float energy_mj;
+};
+
+RTC_DATA_ATTR rtc_state s_state;
+
+bool woke_from_timer() {
+  return esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER;
+}
+
+} // namespace
+
+duty_cycle::duty_cycle(duty_cycle_config config) : _config{std::move(config)} {
+  // RTC memory is uninitialized after power on, a reset invalidates the
+  // cached state as well since it might be the cause for the reset
+  if (!woke_from_timer() || s_state.magic != rtc_state_magic) {
+    s_state = {};
+    s_state.magic = rtc_state_magic;
+  }
+}
+
+bool duty_cycle::cold_boot() const { return s_state.cycle == 0; }
+
+std::optional<wifi_access_point> duty_cycle::cached_access_point() const {
+  if (!s_state.has_access_point) {
+    return std::nullopt;
+  }
+  return s_state.access_point;
+}
+
+void duty_cycle::cache_access_point(const wifi_access_point& access_point) {
+  s_state.access_point = access_point;
+  s_state.has_access_point = true;
+}
+
+std::optional<std::vector<cached_devices>>
+duty_cycle::load_cached_devices() const {
+  if (!s_state.has_devices) {
+    return std::nullopt;
+  }
+
+  auto hubs = deserialize_hubs(
+      std::span{s_state.devices.data(), s_state.devices_size});
+  if (!hubs) {
+    ESP_LOGW(TAG, "Discarding invalid cached devices");
+  }
+  return hubs;
+}
+
+void duty_cycle::cache_devices(std::span<const cached_devices> hubs) {
+  const auto data = serialize_hubs(hubs);
+  if (data.size() > s_state.devices.size()) {
+    ESP_LOGW(TAG, "Device list too large to cache (%zu bytes)", data.size());
+    s_state.has_devices = false;
+    return;
+  }
+
+  std::copy(data.begin(), data.end(), s_state.devices.begin());
+  s_state.devices_size = uint16_t(data.size());
+  s_state.has_devices = true;
+}
+
+void duty_cycle::clear_cache() {
+  s_state.has_access_point = false;
+  s_state.has_devices = false;
+}
+
+std::optional<duty_cycle_metrics> duty_cycle::last_cycle_metrics() const {
+  if (!s_state.has_metrics) {
+    return std::nullopt;
+  }
+
+  return duty_cycle_metrics{
+      .cycle = s_state.cycle,
+      .wake_to_sleep = std::chrono::milliseconds{s_state.wake_to_sleep_ms},
+      .energy_mj = s_state.energy_mj,
+  };
+}
+
+void duty_cycle::publish_metrics(mqtt_client& client) const {
+  if (cold_boot()) {
+    constexpr std::string_view discovery_message = R"(
+{
+"dev":{"ids":"simarine_esp_duty_cycle","name":"Simarine ESP Duty Cycle"},
+"o":{"name":"simarine_esp","url":"https://github.com/christopher-strack/esp_simarine_home_assistant"},
+"cmps":{
+"simarine_esp_wake_to_sleep":{"p":"sensor","unique_id":"simarine_esp_wake_to_sleep","name":"Wake to sleep","device_class":"duration","unit_of_measurement":"ms","value_template":"{{ value_json.wake_to_sleep }}"},
+"simarine_esp_cycle_energy":{"p":"sensor","unique_id":"simarine_esp_cycle_energy","name":"Energy per cycle","unit_of_measurement":"mJ","value_template":"{{ value_json.energy_mj }}"}
+},
+"state_topic":"simarine_esp/duty_cycle/state","qos":1
+}
+)";
+    client.publish(metrics_discovery_topic, discovery_message,
+                   mqtt_qos::at_least_once, true);
+  }
+
+  const auto metrics = last_cycle_metrics();
+  if (!metrics) {
+    return;
+  }
+
+  std::array<char, 128> payload_storage;
+  text_writer payload{payload_storage};
+  payload.append(R"({"cycle":)")
+      .append(size_t(metrics->cycle))
+      .append(R"(,"wake_to_sleep":)")
+      .append(size_t(metrics->wake_to_sleep.count()))
+      .append(R"(,"energy_mj":)")
+      .append(metrics->energy_mj, 2)
+      .append('}');
+
+  client.publish(metrics_state_topic, payload.view(), mqtt_qos::at_least_once,
+                 false);
+}
+
+void duty_cycle::sleep() {
+  using namespace std::chrono;
+
+  // Counts from the start of the application, the boot loader time before
+  // that is not included
+  const auto active = duration_cast<milliseconds>(
+      microseconds{esp_timer_get_time()});
+  const auto sleep_duration = std::max<milliseconds>(
+      duration_cast<milliseconds>(_config.interval) - active, seconds{1});
+
+  const auto active_s = duration<float>(active).count();
+  const auto sleep_s = duration<float>(sleep_duration).count();
+  const auto energy_mj =
+      _config.supply_voltage * (_config.active_current_ma * active_s +
+                                _config.sleep_current_ma * sleep_s);
+
+  s_state.cycle++;
+  s_state.wake_to_sleep_ms = uint32_t(active.count());
+  s_state.energy_mj = energy_mj;
+  s_state.has_metrics = true;
+
+  ESP_LOGI(TAG, "Cycle %" PRIu32 " took %" PRIu32 " ms, sleeping for %lld s",
+           s_state.cycle, s_state.wake_to_sleep_ms,
+           duration_cast<seconds>(sleep_duration).count());
+
+  esp_sleep_enable_timer_wakeup(
+      uint64_t(duration_cast<microseconds>(sleep_duration).count()));
+  esp_deep_sleep_start();
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "device_cache.hpp"
+#include "mqtt_client.hpp"
+#include "wifi_reconnect_policy.hpp"
+
+#include "spymarine/device.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+/*! Configures the duty-cycled operating mode. Instead of staying connected,
+ * the device wakes up every interval, reads one averaging window, publishes
+ * it and goes back to deep sleep. The chip can't measure its own consumption,
+ * so the energy per cycle is estimated from the configured currents.
+ */
+struct duty_cycle_config {
+  bool enabled{false};
+  std::chrono::seconds interval{std::chrono::minutes{10}};
+  std::chrono::seconds window{10};
+  float active_current_ma{100.0f};
+  float sleep_current_ma{0.01f};
+  float supply_voltage{3.3f};
+};
+
+struct duty_cycle_metrics {
+  uint32_t cycle;
+  std::chrono::milliseconds wake_to_sleep;
+  float energy_mj;
+};
+
+/*! Keeps the state that survives deep sleep in RTC memory, so a wake up can
+ * skip the Wifi scan, the Simarine discovery and the device enumeration.
+ */
+class duty_cycle {
+public:
+  explicit duty_cycle(duty_cycle_config config);
+
+  const duty_cycle_config& config() const { return _config; }
+
+  /*! True for the first cycle after power on or a reset
+   */
+  bool cold_boot() const;
+
+  std::optional<wifi_access_point> cached_access_point() const;
+  void cache_access_point(const wifi_access_point& access_point);
+
+  std::optional<std::vector<cached_devices>> load_cached_devices() const;
+  void cache_devices(std::span<const cached_devices> hubs);
+
+  /*! Forgets the cached access point and devices, e.g. after the cached
+   * Simarine stopped responding
+   */
+  void clear_cache();
+
+  /*! Metrics of the previous cycle, the current one isn't complete until
+   * sleep() is called
+   */
+  std::optional<duty_cycle_metrics> last_cycle_metrics() const;
+
+  /*! Publishes the metrics of the previous cycle and on a cold boot the Home
+   * Assistant discovery for them
+   */
+  void publish_metrics(mqtt_client& client) const;
+
+  /*! Records the metrics of the current cycle and enters deep sleep until
+   * the next cycle is due
+   */
+  [[noreturn]] void sleep();
+
+private:
+  duty_cycle_config _config;
+};
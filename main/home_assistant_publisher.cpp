@@ -0,0 +1,393 @@
+#include "home_assistant_publisher.hpp"
+#include "binary_snapshot.hpp"
+#include "home_assistant_serializer.hpp"
+#include "metrics.hpp"
+
+#include "esp_log.h"
+
+#include "spymarine/home_assistant.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+constexpr auto TAG = "spymarine";
+
+histogram g_message_build_duration{"message_build", "μs"};
+histogram g_publish_duration{"publish", "μs"};
+counter g_publish_failures{"publish_failures"};
+} // namespace
+
+home_assistant_publisher::home_assistant_publisher(
+    mqtt_client& client, const sensor_publish_mode mode,
+    delta_publish_config delta_config)
+    : _client{client}, _mode{mode}, _filter{std::move(delta_config)},
+      _message{std::make_unique<
+          fixed_message_buffer<max_topic_size, max_payload_size>>()} {}
+
+void home_assistant_publisher::set_publish_queue(mqtt_publish_queue* queue) {
+  _prepared.reset();
+  _queue = queue;
+  if (_queue) {
+    _message.reset();
+  } else if (!_message) {
+    _message = std::make_unique<
+        fixed_message_buffer<max_topic_size, max_payload_size>>();
+  }
+}
+
+void home_assistant_publisher::set_device_namespace(
+    std::string device_namespace) {
+  _device_namespace = std::move(device_namespace);
+}
+
+void home_assistant_publisher::send_device_discovery(
+    const std::vector<spymarine::device>& devices) {
+  ESP_LOGI(TAG, "Sending Home Assistant device discovery messages");
+
+  for (size_t index = 0; index < devices.size(); index++) {
+    const auto aggregated_index = _mode == sensor_publish_mode::aggregated
+                                      ? std::optional<size_t>{index}
+                                      : std::nullopt;
+    const auto message = begin_message();
+    if (!message) {
+      continue;
+    }
+    if (!write_home_assistant_discovery_message(
+            devices[index], aggregated_index, *message, _device_namespace,
+            _availability)) {
+      ESP_LOGE(TAG, "Device discovery message exceeds the buffer size");
+      continue;
+    }
+
+    if (!publish_message(mqtt_qos::at_least_once, true)) {
+      ESP_LOGE(TAG, "Couldn't send device discovery message");
+    }
+  }
+}
+
+bool home_assistant_publisher::sync_device_discovery(
+    const std::vector<spymarine::device>& devices, discovery_cache& cache) {
+  size_t published_count = 0;
+  size_t uncached_count = 0;
+  bool complete = true;
+  std::array<char, max_topic_size> topic_storage;
+  text_writer topic{topic_storage};
+
+  for (size_t index = 0; index < devices.size(); index++) {
+    const auto aggregated_index = _mode == sensor_publish_mode::aggregated
+                                      ? std::optional<size_t>{index}
+                                      : std::nullopt;
+    const auto message = begin_message();
+    if (!message) {
+      complete = false;
+      continue;
+    }
+    if (!write_home_assistant_discovery_message(
+            devices[index], aggregated_index, *message, _device_namespace,
+            _availability)) {
+      ESP_LOGE(TAG, "Device discovery message exceeds the buffer size");
+      complete = false;
+      continue;
+    }
+
+    const auto hash = discovery_cache::hash(message->topic().view(),
+                                            message->payload().view());
+    if (cache.is_published(message->topic().view(), hash)) {
+      continue;
+    }
+
+    // The message is handed to the queue by publishing it
+    topic.clear();
+    topic.append(message->topic().view());
+    if (publish_message(mqtt_qos::at_least_once, true)) {
+      uncached_count += cache.set_published(topic.view(), hash) ? 0 : 1;
+      published_count++;
+    } else {
+      complete = false;
+    }
+  }
+
+  size_t removed_count = 0;
+
+  // Configs of other hubs are kept, see write_device_key for the prefix
+  std::array<char, max_topic_size> prefix_storage;
+  text_writer prefix{prefix_storage};
+  prefix.append("homeassistant/device/")
+      .append(home_assistant_topic_prefix)
+      .append('_');
+  if (!_device_namespace.empty()) {
+    prefix.append_identifier(_device_namespace).append('_');
+  }
+
+  cache.remove_stale(
+      [&](std::string_view cached_topic) {
+        if (!cached_topic.starts_with(prefix.view())) {
+          return true;
+        }
+        return std::any_of(devices.begin(), devices.end(),
+                           [&](const auto& device) {
+                             topic.clear();
+                             write_home_assistant_discovery_topic(
+                                 device, topic, _device_namespace);
+                             return topic.view() == cached_topic;
+                           });
+      },
+      [&](std::string_view cached_topic) {
+        // An empty retained message removes the device from Home Assistant
+        topic.clear();
+        topic.append(cached_topic);
+        const auto removed = publish_message(topic.c_str(), {},
+                                             mqtt_qos::at_least_once, true);
+        complete = complete && removed;
+        removed_count += removed ? 1 : 0;
+        return removed;
+      });
+
+  ESP_LOGI(TAG, "Published %zu and removed %zu device discovery messages",
+           published_count, removed_count);
+  if (uncached_count > 0) {
+    ESP_LOGW(TAG,
+             "%zu device discovery messages don't fit the cache, they are "
+             "published on every sync and not removed with their devices",
+             uncached_count);
+  }
+  return complete;
+}
+
+void home_assistant_publisher::clear_legacy_discovery(
+    const std::vector<spymarine::device>& devices) {
+  // Allocates, but only runs when the discovery cache is empty
+  for (const auto& device : devices) {
+    const auto legacy =
+        spymarine::make_home_assistant_device_discovery_message(device);
+    if (!publish_message(legacy.topic.c_str(), {}, mqtt_qos::at_least_once,
+                         true)) {
+      ESP_LOGW(TAG, "Couldn't clear legacy discovery config %s",
+               legacy.topic.c_str());
+    }
+  }
+}
+
+void home_assistant_publisher::publish_sensor_values(
+    const std::vector<spymarine::device>& devices,
+    std::span<const uint8_t> due) {
+  if (_publish_all_once) {
+    _filter.reset();
+    _publish_all_once = false;
+  }
+
+  switch (_mode) {
+  case sensor_publish_mode::all:
+    publish_all_sensor_values(devices, due);
+    break;
+  case sensor_publish_mode::changed:
+    publish_changed_sensor_values(devices, due);
+    break;
+  case sensor_publish_mode::aggregated:
+    publish_aggregated_sensor_values(devices);
+    break;
+  case sensor_publish_mode::binary:
+    publish_binary_sensor_values(devices, due);
+    break;
+  }
+}
+
+void home_assistant_publisher::reset() {
+  _publish_all_once = true;
+  _binary_layout_id.reset();
+}
+
+message_buffer* home_assistant_publisher::begin_message() {
+  if (!_queue) {
+    return _message.get();
+  }
+
+  _prepared = _queue->prepare();
+  if (!_prepared) {
+    g_publish_failures.increment();
+    ESP_LOGW(TAG, "No free message buffer in the publish queue");
+    return nullptr;
+  }
+  return &_prepared->message();
+}
+
+bool home_assistant_publisher::publish_message(const mqtt_qos qos,
+                                               const bool retain) {
+  if (!_queue) {
+    return publish_message(_message->topic().c_str(),
+                           _message->payload().view(), qos, retain);
+  }
+
+  scoped_timer timer{g_publish_duration};
+  auto message = std::move(_prepared);
+  _prepared.reset();
+  const auto published =
+      message && _queue->publish(std::move(*message), qos, retain).has_value();
+  if (!published) {
+    g_publish_failures.increment();
+  }
+  return published;
+}
+
+bool home_assistant_publisher::publish_message(const char* topic,
+                                               const std::string_view payload,
+                                               const mqtt_qos qos,
+                                               const bool retain) {
+  scoped_timer timer{g_publish_duration};
+  const auto published =
+      _queue ? _queue->publish(topic, payload, qos, retain).has_value()
+             : _client.publish(topic, payload, qos, retain);
+  if (!published) {
+    g_publish_failures.increment();
+  }
+  return published;
+}
+
+bool home_assistant_publisher::write_state_message(
+    const spymarine::device& device, message_buffer& message) {
+  scoped_timer timer{g_message_build_duration};
+  return write_home_assistant_state_message(device, message,
+                                            _device_namespace);
+}
+
+void home_assistant_publisher::publish_all_sensor_values(
+    const std::vector<spymarine::device>& devices,
+    std::span<const uint8_t> due) {
+  ESP_LOGI(TAG, "Sending Home Assistant sensor messags");
+
+  for (size_t index = 0; index < devices.size(); index++) {
+    if (!due.empty() && !due[index]) {
+      continue;
+    }
+
+    const auto message = begin_message();
+    if (!message) {
+      continue;
+    }
+    if (write_state_message(devices[index], *message)) {
+      publish_message(mqtt_qos::at_most_once, false);
+    } else {
+      ESP_LOGE(TAG, "State message exceeds the buffer size");
+    }
+  }
+}
+
+void home_assistant_publisher::publish_changed_sensor_values(
+    const std::vector<spymarine::device>& devices,
+    std::span<const uint8_t> due) {
+  const auto now = delta_publish_filter::clock::now();
+  size_t published_count = 0;
+
+  for (size_t index = 0; index < devices.size(); index++) {
+    const auto& device = devices[index];
+    if ((!due.empty() && !due[index]) || !_filter.is_due(index, device, now)) {
+      continue;
+    }
+
+    const auto message = begin_message();
+    if (!message) {
+      continue;
+    }
+    if (write_state_message(device, *message)) {
+      if (publish_message(mqtt_qos::at_most_once, false)) {
+        _filter.mark_published(index, device, now);
+        published_count++;
+      }
+    } else {
+      ESP_LOGE(TAG, "State message exceeds the buffer size");
+    }
+  }
+
+  ESP_LOGI(TAG, "Sent %zu of %zu Home Assistant sensor messages",
+           published_count, devices.size());
+}
+
+void home_assistant_publisher::publish_aggregated_sensor_values(
+    const std::vector<spymarine::device>& devices) {
+  ESP_LOGI(TAG, "Sending aggregated Home Assistant sensor message");
+
+  const auto message = begin_message();
+  if (!message) {
+    return;
+  }
+
+  bool written;
+  {
+    scoped_timer timer{g_message_build_duration};
+    written = write_home_assistant_aggregated_state_message(devices, *message,
+                                                            _device_namespace);
+  }
+
+  if (written) {
+    publish_message(mqtt_qos::at_most_once, false);
+  } else {
+    ESP_LOGE(TAG, "Aggregated state message exceeds the buffer size");
+  }
+}
+
+void home_assistant_publisher::publish_binary_sensor_values(
+    const std::vector<spymarine::device>& devices,
+    std::span<const uint8_t> due) {
+  // The layout is retained, so it's only sent again after a reset, e.g.
+  // for a new device list
+  if (!_binary_layout_id) {
+    const auto message = begin_message();
+    if (!message) {
+      return;
+    }
+    _binary_layout_id =
+        write_binary_layout_message(devices, *message, _device_namespace);
+    if (!_binary_layout_id) {
+      ESP_LOGE(TAG, "Binary layout message exceeds the buffer size");
+      return;
+    }
+    if (!publish_message(mqtt_qos::at_least_once, true)) {
+      _binary_layout_id.reset();
+      return;
+    }
+  }
+
+  const auto now = delta_publish_filter::clock::now();
+  _binary_include.assign(devices.size(), 0);
+  size_t included_count = 0;
+  for (size_t index = 0; index < devices.size(); index++) {
+    if ((due.empty() || due[index]) &&
+        _filter.is_due(index, devices[index], now)) {
+      _binary_include[index] = 1;
+      included_count++;
+    }
+  }
+
+  if (included_count == 0) {
+    return;
+  }
+
+  const auto message = begin_message();
+  if (!message) {
+    return;
+  }
+
+  bool written;
+  {
+    scoped_timer timer{g_message_build_duration};
+    written = write_binary_snapshot_message(devices, _binary_include,
+                                            *_binary_layout_id, *message,
+                                            _device_namespace);
+  }
+
+  if (!written) {
+    ESP_LOGE(TAG, "Binary snapshot message exceeds the buffer size");
+    return;
+  }
+  if (!publish_message(mqtt_qos::at_most_once, false)) {
+    return;
+  }
+
+  // Devices of a dropped snapshot stay due for the next one
+  for (size_t index = 0; index < devices.size(); index++) {
+    if (_binary_include[index]) {
+      _filter.mark_published(index, devices[index], now);
+    }
+  }
+}
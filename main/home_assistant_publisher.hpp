@@ -0,0 +1,153 @@
+#pragma once
+
+#include "delta_publish_filter.hpp"
+#include "discovery_cache.hpp"
+#include "home_assistant_serializer.hpp"
+#include "message_buffer.hpp"
+#include "mqtt_client.hpp"
+#include "mqtt_publish_queue.hpp"
+
+#include "spymarine/device.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+/*! Which state messages are sent once a sensor window completes
+ */
+enum class sensor_publish_mode {
+  /*! Publish the state of every device
+   */
+  all,
+
+  /*! Publish only the state of devices whose values changed, see
+   * delta_publish_filter
+   */
+  changed,
+
+  /*! Publish the state of all devices as a single message on
+   * aggregated_state_topic
+   */
+  aggregated,
+
+  /*! Publish the changed devices as a single binary snapshot, see
+   * binary_snapshot.hpp. Discovery uses the same state topics as the other
+   * modes, a bridge publishes them from the snapshots.
+   */
+  binary,
+};
+
+/*! Publishes the Home Assistant discovery and state messages of the Simarine
+ * devices. With a publish queue messages are serialized in place into the
+ * queue's slabs, otherwise into a buffer owned by the publisher, so
+ * publishing doesn't allocate.
+ */
+class home_assistant_publisher {
+public:
+  static constexpr size_t max_topic_size = 128;
+  static constexpr size_t max_payload_size = 4096;
+
+  home_assistant_publisher(mqtt_client& client, sensor_publish_mode mode,
+                           delta_publish_config delta_config);
+  home_assistant_publisher(const home_assistant_publisher& other) = delete;
+
+  home_assistant_publisher&
+  operator=(const home_assistant_publisher& other) = delete;
+
+  /*! Publishes messages through the queue instead of waiting for the client.
+   * Pass nullptr to publish directly again.
+   */
+  void set_publish_queue(mqtt_publish_queue* queue);
+
+  /*! Sets the namespace of the hub the devices belong to, see
+   * home_assistant_serializer.hpp. Stale discovery configs are only cleared
+   * within the namespace.
+   */
+  void set_device_namespace(std::string device_namespace);
+
+  /*! Declares the availability in the discovery messages published from
+   * now on
+   */
+  void set_availability(discovery_availability availability) {
+    _availability = availability;
+  }
+
+  /*! Publishes a retained Home Assistant device discovery message for each
+   * device
+   */
+  void send_device_discovery(const std::vector<spymarine::device>& devices);
+
+  /*! Publishes the retained discovery messages of the devices whose config
+   * isn't in the cache yet, and clears the retained configs of cached
+   * devices that no longer exist. Updates the cache accordingly.
+   *
+   * Returns false if not all messages could be published, in which case
+   * the sync should be retried later.
+   */
+  bool sync_device_discovery(const std::vector<spymarine::device>& devices,
+                             discovery_cache& cache);
+
+  /*! Clears the retained discovery configs that spymarine's
+   * make_home_assistant_device_discovery_message published for the devices
+   * before the app wrote its own, so upgraded installations don't keep the
+   * old entities next to the new ones
+   */
+  void clear_legacy_discovery(const std::vector<spymarine::device>& devices);
+
+  /*! Publishes the current sensor values of the devices according to the
+   * publish mode. If due is given only the devices flagged in it are
+   * considered, except for the aggregated mode which always publishes all.
+   */
+  void publish_sensor_values(const std::vector<spymarine::device>& devices,
+                             std::span<const uint8_t> due = {});
+
+  /*! Makes the next call to publish_sensor_values publish the state of
+   * every considered device regardless of the publish mode. Devices that
+   * aren't due keep being skipped, their values may be placeholders.
+   */
+  void reset();
+
+private:
+  /*! Returns the buffer the next message is written to, which
+   * publish_message(qos, retain) then publishes. Returns nullptr if the
+   * queue has no free slab.
+   */
+  message_buffer* begin_message();
+
+  bool publish_message(mqtt_qos qos, bool retain);
+  bool publish_message(const char* topic, std::string_view payload,
+                       mqtt_qos qos, bool retain);
+
+  bool write_state_message(const spymarine::device& device,
+                           message_buffer& message);
+
+  void publish_all_sensor_values(const std::vector<spymarine::device>& devices,
+                                 std::span<const uint8_t> due);
+  void publish_changed_sensor_values(
+      const std::vector<spymarine::device>& devices,
+      std::span<const uint8_t> due);
+  void publish_aggregated_sensor_values(
+      const std::vector<spymarine::device>& devices);
+  void publish_binary_sensor_values(
+      const std::vector<spymarine::device>& devices,
+      std::span<const uint8_t> due);
+
+  mqtt_client& _client;
+  mqtt_publish_queue* _queue{nullptr};
+  sensor_publish_mode _mode;
+  std::string _device_namespace;
+  discovery_availability _availability;
+  delta_publish_filter _filter;
+  bool _publish_all_once{true};
+  std::optional<uint16_t> _binary_layout_id;
+  std::vector<uint8_t> _binary_include;
+  std::optional<mqtt_publish_queue::prepared_message> _prepared;
+
+  /*! Only allocated while publishing without a queue
+   */
+  std::unique_ptr<fixed_message_buffer<max_topic_size, max_payload_size>>
+      _message;
+};
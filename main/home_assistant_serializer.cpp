@@ -0,0 +1,263 @@
+#include "home_assistant_serializer.hpp"
+#include "device_sensors.hpp"
+#include "static_string.hpp"
+
+#include <array>
+#include <string>
+#include <utility>
+#include <variant>
+
+namespace {
+
+constexpr int value_decimals = 2;
+
+constexpr std::string_view slash = "/";
+constexpr std::string_view underscore = "_";
+constexpr std::string_view discovery_topic_root = "homeassistant/device/";
+
+/*! Prefix of state topics
+ */
+constexpr auto state_topic_prefix =
+    concat<home_assistant_topic_prefix, slash>();
+
+/*! Prefix of discovery topics, device ids and unique ids
+ */
+constexpr auto discovery_topic_prefix =
+    concat<discovery_topic_root, home_assistant_topic_prefix, underscore>();
+constexpr auto id_prefix = concat<home_assistant_topic_prefix, underscore>();
+
+constexpr std::string_view discovery_device_start = R"({"dev":{"ids":")";
+constexpr std::string_view discovery_origin =
+    R"(},"o":{"name":"simarine_esp","sw":"0.1",)"
+    R"("url":"https://github.com/christopher-strack/esp_simarine_home_assistant"},)"
+    R"("cmps":{)";
+
+/*! The parts of a sensor's discovery component and state value that only
+ * depend on the sensor description. A component is written as
+ *
+ *   '"' key component_start [aggregated index] value_end key component_end
+ *
+ * where key is the device key written at runtime.
+ */
+struct sensor_fragments {
+  std::string_view component_start;
+  std::string_view value_end;
+  std::string_view component_end;
+  std::string_view state_key;
+};
+
+template <typename T, size_t I> struct sensor_fragment_strings {
+  static constexpr auto description = device_sensor_layout<T>::descriptions[I];
+
+  static constexpr auto component_start = make_static_string<[] {
+    std::string result{"_"};
+    result.append(description.key).append(R"(":{"p":"sensor",)");
+    if (!description.device_class.empty()) {
+      result.append(R"("dev_cla":")")
+          .append(description.device_class)
+          .append(R"(",)");
+    }
+    result.append(R"("unit_of_meas":")")
+        .append(description.unit)
+        .append(R"(","stat_cla":"measurement","val_tpl":"{{ value_json)");
+    return result;
+  }>();
+
+  static constexpr auto value_end = make_static_string<[] {
+    std::string result{"."};
+    result.append(description.key)
+        .append(R"( }}","unique_id":")")
+        .append(id_prefix.view());
+    return result;
+  }>();
+
+  static constexpr auto component_end = make_static_string<[] {
+    std::string result{"_"};
+    result.append(description.key).append(R"("})");
+    return result;
+  }>();
+
+  static constexpr auto state_key = make_static_string<[] {
+    std::string result{"\""};
+    result.append(description.key).append("\":");
+    return result;
+  }>();
+};
+
+template <typename T>
+constexpr std::array<sensor_fragments, max_device_sensors>
+make_device_fragments() {
+  std::array<sensor_fragments, max_device_sensors> result{};
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    ((result[I] = {sensor_fragment_strings<T, I>::component_start.view(),
+                   sensor_fragment_strings<T, I>::value_end.view(),
+                   sensor_fragment_strings<T, I>::component_end.view(),
+                   sensor_fragment_strings<T, I>::state_key.view()}),
+     ...);
+  }(std::make_index_sequence<
+      device_sensor_layout<T>::descriptions.size()>{});
+  return result;
+}
+
+template <size_t... I>
+constexpr auto make_fragment_table(std::index_sequence<I...>) {
+  return std::array{make_device_fragments<
+      std::variant_alternative_t<I, spymarine::device>>()...};
+}
+
+/*! Sensor fragments indexed by the device type index and the sensor's
+ * position in for_each_sensor, built at compile time
+ */
+constexpr auto fragment_table = make_fragment_table(
+    std::make_index_sequence<std::variant_size_v<spymarine::device>>{});
+
+uint8_t first_state_index(const spymarine::device& device) {
+  return std::visit(
+      [](const auto& concrete_device) {
+        using device_type = std::remove_cvref_t<decltype(concrete_device)>;
+        using layout = device_sensor_layout<device_type>;
+        return (concrete_device.*std::get<0>(layout::members)).state_index;
+      },
+      device);
+}
+
+void write_sensor_values(const spymarine::device& device,
+                         text_writer& writer) {
+  const auto& fragments = fragment_table[device.index()];
+  size_t index = 0;
+
+  writer.append('{');
+  for_each_sensor(device, [&](const sensor_description&,
+                              const spymarine::sensor& sensor) {
+    if (index > 0) {
+      writer.append(',');
+    }
+    writer.append(fragments[index++].state_key)
+        .append(sensor.value, value_decimals);
+  });
+  writer.append('}');
+}
+
+} // namespace
+
+void write_device_key(const spymarine::device& device, text_writer& writer,
+                      std::string_view device_namespace) {
+  if (!device_namespace.empty()) {
+    writer.append_identifier(device_namespace).append('_');
+  }
+  writer.append_identifier(device_name(device))
+      .append('_')
+      .append(size_t(first_state_index(device)));
+}
+
+void write_aggregated_state_topic(text_writer& writer,
+                                  std::string_view device_namespace) {
+  if (device_namespace.empty()) {
+    writer.append(aggregated_state_topic);
+    return;
+  }
+  writer.append(state_topic_prefix)
+      .append_identifier(device_namespace)
+      .append("/state");
+}
+
+void write_home_assistant_state_topic(const spymarine::device& device,
+                                      text_writer& writer,
+                                      std::string_view device_namespace) {
+  writer.append(state_topic_prefix);
+  write_device_key(device, writer, device_namespace);
+  writer.append("/state");
+}
+
+void write_home_assistant_discovery_topic(const spymarine::device& device,
+                                          text_writer& writer,
+                                          std::string_view device_namespace) {
+  writer.append(discovery_topic_prefix);
+  write_device_key(device, writer, device_namespace);
+  writer.append("/config");
+}
+
+bool write_home_assistant_discovery_message(
+    const spymarine::device& device,
+    const std::optional<size_t> aggregated_index, message_buffer& message,
+    std::string_view device_namespace,
+    const discovery_availability& availability) {
+  message.clear();
+
+  write_home_assistant_discovery_topic(device, message.topic(),
+                                       device_namespace);
+
+  auto& payload = message.payload();
+  payload.append(discovery_device_start).append(id_prefix);
+  write_device_key(device, payload, device_namespace);
+  payload.append(R"(","name":)")
+      .append_json_string(device_name(device))
+      .append(discovery_origin);
+
+  const auto& fragments = fragment_table[device.index()];
+  size_t index = 0;
+  for_each_sensor(device, [&](const sensor_description&,
+                              const spymarine::sensor&) {
+    const auto& fragment = fragments[index];
+    if (index++ > 0) {
+      payload.append(',');
+    }
+
+    payload.append('"');
+    write_device_key(device, payload, device_namespace);
+    payload.append(fragment.component_start);
+    if (aggregated_index) {
+      payload.append("['").append(*aggregated_index).append("']");
+    }
+    payload.append(fragment.value_end);
+    write_device_key(device, payload, device_namespace);
+    payload.append(fragment.component_end);
+  });
+
+  payload.append(R"(},"stat_t":")");
+  if (aggregated_index) {
+    write_aggregated_state_topic(payload, device_namespace);
+  } else {
+    write_home_assistant_state_topic(device, payload, device_namespace);
+  }
+  payload.append('"');
+  if (!availability.topic.empty()) {
+    payload.append(R"(,"avty_t":")").append(availability.topic).append('"');
+  }
+  if (availability.expire_after.count() > 0) {
+    payload.append(R"(,"exp_aft":)")
+        .append(size_t(availability.expire_after.count()));
+  }
+  payload.append(R"(,"qos":0})");
+
+  return !message.overflowed();
+}
+
+bool write_home_assistant_state_message(const spymarine::device& device,
+                                        message_buffer& message,
+                                        std::string_view device_namespace) {
+  message.clear();
+  write_home_assistant_state_topic(device, message.topic(), device_namespace);
+  write_sensor_values(device, message.payload());
+  return !message.overflowed();
+}
+
+bool write_home_assistant_aggregated_state_message(
+    const std::span<const spymarine::device> devices,
+    message_buffer& message, std::string_view device_namespace) {
+  message.clear();
+  write_aggregated_state_topic(message.topic(), device_namespace);
+
+  auto& payload = message.payload();
+  payload.append('{');
+  for (size_t index = 0; index < devices.size(); index++) {
+    if (index > 0) {
+      payload.append(',');
+    }
+    payload.append('"').append(index).append(R"(":)");
+    write_sensor_values(devices[index], payload);
+  }
+  payload.append('}');
+
+  return !message.overflowed();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "message_buffer.hpp"
+
+#include "spymarine/device.hpp"
+
+#include <chrono>
+#include <optional>
+#include <span>
+#include <string_view>
+
+/*! Prefix of all state topics and unique ids
+ */
+constexpr std::string_view home_assistant_topic_prefix = "simarine_esp";
+
+/*! The topic of the combined state message of all devices
+ */
+constexpr auto aggregated_state_topic = "simarine_esp/state";
+
+/*! Carries "online" or "offline", see mqtt_client::set_availability
+ */
+constexpr auto availability_topic = "simarine_esp/availability";
+
+/*! How Home Assistant tells whether the values of a device are current
+ */
+struct discovery_availability {
+  /*! Topic of the online and offline payloads, none if empty
+   */
+  std::string_view topic;
+
+  /*! The entities become unavailable if no state message arrived for this
+   * long, which catches a publisher that stalled while the connection is
+   * alive. Never if zero.
+   */
+  std::chrono::seconds expire_after{0};
+};
+
+/*! All functions take the namespace of the hub the devices belong to. It
+ * prefixes the device keys and the aggregated state topic to keep devices of
+ * different hubs apart and is empty if there is only one hub.
+ */
+
+/*! Writes the key that identifies the device in topics and unique ids: its
+ * name followed by the state index of its first sensor. The state index is
+ * unique per hub and stable across restarts, so devices whose names are the
+ * same once sanitized don't share topics.
+ */
+void write_device_key(const spymarine::device& device, text_writer& writer,
+                      std::string_view device_namespace = {});
+
+/*! Writes the topic of the combined state message of all devices
+ */
+void write_aggregated_state_topic(text_writer& writer,
+                                  std::string_view device_namespace = {});
+
+/*! Writes the topic of the state message of the device
+ */
+void write_home_assistant_state_topic(const spymarine::device& device,
+                                      text_writer& writer,
+                                      std::string_view device_namespace = {});
+
+/*! Writes the topic of the Home Assistant device discovery message of the
+ * device
+ */
+void write_home_assistant_discovery_topic(
+    const spymarine::device& device, text_writer& writer,
+    std::string_view device_namespace = {});
+
+/*! Writes the Home Assistant device discovery message of the device. If
+ * aggregated_index is set the entities read their values from the
+ * device's entry in the aggregated state message.
+ *
+ * Returns false if the message didn't fit into the buffer.
+ */
+bool write_home_assistant_discovery_message(
+    const spymarine::device& device, std::optional<size_t> aggregated_index,
+    message_buffer& message, std::string_view device_namespace = {},
+    const discovery_availability& availability = {});
+
+/*! Writes the Home Assistant state message with the current sensor values
+ * of the device.
+ *
+ * Returns false if the message didn't fit into the buffer.
+ */
+bool write_home_assistant_state_message(
+    const spymarine::device& device, message_buffer& message,
+    std::string_view device_namespace = {});
+
+/*! Writes the state of all devices into a single message keyed by the
+ * device index.
+ *
+ * Returns false if the message didn't fit into the buffer.
+ */
+bool write_home_assistant_aggregated_state_message(
+    std::span<const spymarine::device> devices, message_buffer& message,
+    std::string_view device_namespace = {});
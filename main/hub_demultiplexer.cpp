@@ -0,0 +1,199 @@
+#include "hub_demultiplexer.hpp"
+#include "udp_capture.hpp"
+
+#include "esp_log.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+constexpr auto TAG = "hub_demultiplexer";
+
+int open_udp_socket(uint16_t port) {
+  const auto fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    ESP_LOGE(TAG, "Failed to create socket: %s", std::strerror(errno));
+    return -1;
+  }
+
+  const int enable = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+    ESP_LOGE(TAG, "Failed to bind port %u: %s", port, std::strerror(errno));
+    ::close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+} // namespace
+
+std::vector<uint32_t> discover_hubs(std::chrono::milliseconds duration,
+                                    size_t max_hubs, uint16_t port) {
+  std::vector<uint32_t> hubs;
+
+  const auto fd = open_udp_socket(port);
+  if (fd < 0) {
+    return hubs;
+  }
+
+  timeval timeout{.tv_sec = 0, .tv_usec = 100'000};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  spymarine::buffer buffer;
+  const auto end = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < end && hubs.size() < max_hubs) {
+    sockaddr_in sender{};
+    socklen_t sender_size = sizeof(sender);
+    const auto size =
+        ::recvfrom(fd, buffer.data(), buffer.size(), 0,
+                   reinterpret_cast<sockaddr*>(&sender), &sender_size);
+    if (size <= 0) {
+      continue;
+    }
+
+    const auto ip = ntohl(sender.sin_addr.s_addr);
+    if (std::find(hubs.begin(), hubs.end(), ip) == hubs.end()) {
+      hubs.push_back(ip);
+    }
+  }
+
+  ::close(fd);
+
+  // Independent of the order in which the hubs happened to broadcast
+  std::sort(hubs.begin(), hubs.end());
+  return hubs;
+}
+
+std::expected<std::span<uint8_t>, spymarine::error>
+hub_socket::receive(std::span<uint8_t> buffer) {
+  const auto pending = std::exchange(*_pending, {});
+  if (pending.empty() || pending.size() > buffer.size()) {
+    return std::unexpected{spymarine::error::socket_error};
+  }
+
+  // read_and_update receives into the reader's buffer, so only datagrams
+  // received into other buffers are copied
+  if (pending.data() != buffer.data()) {
+    std::memmove(buffer.data(), pending.data(), pending.size());
+  }
+  return buffer.first(pending.size());
+}
+
+hub_demultiplexer::hub::hub(uint32_t ip, spymarine::buffer& buffer,
+                            const aggregation_config& config,
+                            std::vector<spymarine::device>& devices)
+    : ip{ip}, reader{buffer, devices, hub_socket{&pending}},
+      aggregator{config, devices} {}
+
+hub_demultiplexer::hub_demultiplexer(aggregation_config config)
+    : _config{std::move(config)} {}
+
+hub_demultiplexer::~hub_demultiplexer() {
+  if (_socket >= 0) {
+    ::close(_socket);
+  }
+}
+
+bool hub_demultiplexer::open(uint16_t port) {
+  _socket = open_udp_socket(port);
+  return _socket >= 0;
+}
+
+void hub_demultiplexer::add_hub(uint32_t ip,
+                                std::vector<spymarine::device>& devices) {
+  _hubs.push_back(std::make_unique<hub>(ip, _buffer, _config, devices));
+}
+
+void hub_demultiplexer::set_aggregation(aggregation_config config) {
+  _config = std::move(config);
+  for (auto& hub : _hubs) {
+    hub->aggregator.reconfigure(_config);
+  }
+}
+
+void hub_demultiplexer::set_receive_timeout(
+    const std::chrono::milliseconds timeout) {
+  const auto microseconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(timeout).count();
+  timeval value{.tv_sec = time_t(microseconds / 1'000'000),
+                .tv_usec = suseconds_t(microseconds % 1'000'000)};
+  ::setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &value, sizeof(value));
+}
+
+std::expected<std::optional<hub_datagram>, spymarine::error>
+hub_demultiplexer::receive(std::span<uint8_t> buffer) {
+  sockaddr_in sender{};
+  socklen_t sender_size = sizeof(sender);
+  const auto size =
+      ::recvfrom(_socket, buffer.data(), buffer.size(), 0,
+                 reinterpret_cast<sockaddr*>(&sender), &sender_size);
+  if (size < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return std::nullopt;
+    }
+    return std::unexpected{spymarine::error::socket_error};
+  }
+
+  const auto ip = ntohl(sender.sin_addr.s_addr);
+  const auto it = std::find_if(_hubs.begin(), _hubs.end(),
+                               [&](const auto& hub) { return hub->ip == ip; });
+  if (it == _hubs.end()) {
+    _unknown_datagrams++;
+    return std::nullopt;
+  }
+
+  const auto datagram = hub_datagram{
+      .hub = size_t(it - _hubs.begin()),
+      .data = buffer.first(size_t(size)),
+  };
+  if (_capture) {
+    _capture->write(datagram.hub, datagram.data,
+                    udp_capture_writer::clock::now());
+  }
+  return datagram;
+}
+
+std::expected<bool, spymarine::error>
+hub_demultiplexer::update(const size_t hub_index,
+                          std::span<const uint8_t> datagram) {
+  auto& hub = *_hubs[hub_index];
+  hub.pending = datagram;
+
+  return hub.reader.read_and_update().transform(
+      [&] { return hub.aggregator.update(); });
+}
+
+std::expected<std::optional<size_t>, spymarine::error>
+hub_demultiplexer::read_and_update() {
+  const auto datagram = receive(_buffer);
+  if (!datagram) {
+    return std::unexpected{datagram.error()};
+  }
+  if (!*datagram) {
+    return std::nullopt;
+  }
+
+  const auto hub = (*datagram)->hub;
+  return update(hub, (*datagram)->data)
+      .transform([&](bool completed) -> std::optional<size_t> {
+        if (!completed) {
+          return std::nullopt;
+        }
+        return hub;
+      });
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "sensor_aggregator.hpp"
+
+#include "spymarine/buffer.hpp"
+#include "spymarine/defaults.hpp"
+#include "spymarine/device.hpp"
+#include "spymarine/error.hpp"
+#include "spymarine/sensor_reader.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+class udp_capture_writer;
+
+/*! Listens for sensor state broadcasts for the given duration and returns the
+ * addresses of all Simarine hubs that sent one, in host byte order like
+ * spymarine::discover
+ */
+std::vector<uint32_t>
+discover_hubs(std::chrono::milliseconds duration, size_t max_hubs,
+              uint16_t port = spymarine::simarine_default_udp_port);
+
+/*! The socket a hub's sensor reader reads from. Hands out the datagram the
+ * hub_demultiplexer received for the hub.
+ */
+class hub_socket {
+public:
+  explicit hub_socket(std::span<const uint8_t>* pending) : _pending{pending} {}
+
+  std::expected<std::span<uint8_t>, spymarine::error>
+  receive(std::span<uint8_t> buffer);
+
+private:
+  std::span<const uint8_t>* _pending;
+};
+
+/*! A datagram received from a known hub
+ */
+struct hub_datagram {
+  size_t hub;
+  std::span<const uint8_t> data;
+};
+
+/*! Receives the sensor state datagrams of all hubs on a single UDP socket
+ * and updates the devices of the hub that sent each of them. Every hub has
+ * its own sensor_aggregator, but no socket or task of its own.
+ *
+ * Receiving and updating can run on different tasks, see sensor_pipeline.
+ * Hubs must be added before either starts.
+ */
+class hub_demultiplexer {
+public:
+  using sensor_reader = spymarine::sensor_reader<hub_socket>;
+
+  explicit hub_demultiplexer(aggregation_config config);
+  hub_demultiplexer(const hub_demultiplexer& other) = delete;
+
+  ~hub_demultiplexer();
+
+  bool open(uint16_t port = spymarine::simarine_default_udp_port);
+
+  /*! Makes receiving return without a datagram if none arrived within the
+   * timeout, so that the receiving task can't block forever
+   */
+  void set_receive_timeout(std::chrono::milliseconds timeout);
+
+  /*! Writes every datagram received from a known hub to the capture on the
+   * receiving task. Pass nullptr to stop capturing.
+   */
+  void set_capture(udp_capture_writer* capture) { _capture = capture; }
+
+  /*! Adds a hub with the given address in host byte order. The devices are
+   * updated in place with the raw sensor values and need to outlive the
+   * demultiplexer.
+   */
+  void add_hub(uint32_t ip, std::vector<spymarine::device>& devices);
+
+  /*! Switches all hubs to the aggregation of the config, must be called on
+   * the task that updates the devices
+   */
+  void set_aggregation(aggregation_config config);
+
+  size_t hub_count() const { return _hubs.size(); }
+
+  /*! The hub's devices with the values of their last completed window
+   */
+  const std::vector<spymarine::device>& aggregated_devices(size_t hub) const {
+    return _hubs[hub]->aggregator.devices();
+  }
+
+  /*! Flags per device of the hub whether its window completed with the last
+   * datagram
+   */
+  std::span<const uint8_t> completed_devices(size_t hub) const {
+    return _hubs[hub]->aggregator.completed();
+  }
+
+  /*! Receives the next datagram into the buffer. Returns nothing if it came
+   * from an unknown sender or the receive timeout passed.
+   */
+  std::expected<std::optional<hub_datagram>, spymarine::error>
+  receive(std::span<uint8_t> buffer);
+
+  /*! Updates the devices of the hub with a datagram it sent. Returns true if
+   * the window of any of its devices completed.
+   */
+  std::expected<bool, spymarine::error>
+  update(size_t hub, std::span<const uint8_t> datagram);
+
+  /*! Receives the next datagram and updates the devices of its hub. Returns
+   * the index of the hub if the window of any of its devices completed.
+   * Datagrams of unknown senders are ignored.
+   */
+  std::expected<std::optional<size_t>, spymarine::error> read_and_update();
+
+  /*! Number of datagrams ignored because they came from an unknown sender
+   */
+  size_t unknown_datagrams() const { return _unknown_datagrams; }
+
+  hub_demultiplexer& operator=(const hub_demultiplexer& other) = delete;
+
+private:
+  struct hub {
+    hub(uint32_t ip, spymarine::buffer& buffer,
+        const aggregation_config& config,
+        std::vector<spymarine::device>& devices);
+
+    uint32_t ip;
+    std::span<const uint8_t> pending;
+    sensor_reader reader;
+    sensor_aggregator aggregator;
+  };
+
+  aggregation_config _config;
+  int _socket{-1};
+  spymarine::buffer _buffer{};
+  std::vector<std::unique_ptr<hub>> _hubs;
+  std::atomic<size_t> _unknown_datagrams{0};
+  udp_capture_writer* _capture{nullptr};
+};
@@ -1,125 +1,599 @@
+#include "alert_rules.hpp"
 #include "config.hpp"
+#include "device_cache.hpp"
+#include "diagnostics_publisher.hpp"
+#include "discovery_cache.hpp"
+#include "duty_cycle.hpp"
 #include "esp_system.h"
+#include "home_assistant_publisher.hpp"
+#include "hub_demultiplexer.hpp"
 #include "mqtt_client.hpp"
 #include "mqtt_logger.hpp"
+#include "mqtt_publish_queue.hpp"
+#include "nvs_storage.hpp"
+#include "offline_store.hpp"
+#include "runtime_settings.hpp"
+#include "sensor_history.hpp"
+#include "sensor_pipeline.hpp"
+#include "task_watchdog.hpp"
 #include "wifi_connector.hpp"
 #include "wifi_utils.hpp"
 
 #include "spymarine/buffer.hpp"
 #include "spymarine/device_ostream.hpp"
-#include "spymarine/discover.hpp"
-#include "spymarine/home_assistant.hpp"
 #include "spymarine/read_devices.hpp"
 #include "spymarine/sensor_reader.hpp"
 
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_netif_sntp.h"
 #include "nvs_flash.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
 
 namespace {
 constexpr auto TAG = "spymarine";
+constexpr auto discovery_namespace = "discovery";
+constexpr auto discovery_key = "configs";
+// The cache of all hubs is a single blob of about 100 bytes per config, which
+// keeps it well within the 24 KiB NVS partition
+constexpr size_t discovery_configs_per_hub = 32;
 
-void send_home_assistant_device_discovery(
-    const std::vector<spymarine::device>& devices, mqtt_client& client) {
-  ESP_LOGI(TAG, "Sending Home Assistant device discovery messages");
+// Lets the publisher feed the watchdog and replay offline values while no
+// window completes
+constexpr auto publisher_wait = std::chrono::milliseconds{200};
 
-  for (const auto& device : devices) {
-    const auto message =
-        spymarine::make_home_assistant_device_discovery_message(device);
-    const auto published = client.publish(
-        message.topic.c_str(), message.payload, mqtt_qos::at_least_once, false);
-    if (!published) {
-      ESP_LOGE(TAG, "Couldn't send device discovery message");
+// Network settings from the config topic are dropped if connecting with them
+// takes longer
+constexpr auto network_settings_timeout = std::chrono::seconds{60};
+
+device_type_filter device_filter(const runtime_settings& settings) {
+  return settings.device_types.value_or(make_device_filter());
+}
+
+std::optional<std::vector<cached_devices>>
+enumerate_hubs(const device_type_filter filter) {
+  const auto ips = discover_hubs(hub_discovery_duration, max_hubs);
+  if (ips.empty()) {
+    ESP_LOGE(TAG, "No Simarine hub found");
+    return std::nullopt;
+  }
+
+  spymarine::buffer buffer;
+  std::vector<cached_devices> hubs;
+  for (const auto ip : ips) {
+    ESP_LOGI(TAG, "Read devices of hub %" PRIu32, ip & 0xff);
+    auto devices = spymarine::read_devices<spymarine::tcp_socket>(
+        buffer, ip, spymarine::simarine_default_tcp_port, filter);
+
+    // Fails as a whole, a partial result would look like a topology change
+    if (!devices) {
+      ESP_LOGE(TAG, "Failed to read devices: %s",
+               spymarine::error_message(devices.error()).c_str());
+      return std::nullopt;
     }
+
+    ESP_LOGI(TAG, "Found %zu devices", devices->size());
+    if (!devices->empty()) {
+      // Reading the devices put the hub in the ARP table
+      const auto mac = neighbor_mac_address(ip);
+      if (!mac) {
+        ESP_LOGW(TAG, "Unknown MAC address, hub %" PRIu32 " is named by its IP",
+                 ip & 0xff);
+      }
+      hubs.push_back({ip, std::move(*devices), mac});
+    }
+  }
+
+  if (hubs.empty()) {
+    ESP_LOGE(TAG, "No devices found");
+    return std::nullopt;
+  }
+  return hubs;
+}
+
+/*! Keeps devices of different hubs apart in topics and unique ids. A single
+ * hub keeps the names it had before multiple hubs were supported. Hubs are
+ * named by the device specific part of their MAC address, so a new DHCP lease
+ * keeps their entities, and by their IP if it's unknown.
+ */
+std::string hub_namespace(const cached_devices& hub, size_t hub_count) {
+  if (hub_count == 1) {
+    return {};
+  }
+  if (!hub.mac) {
+    return "hub_" + std::to_string(hub.ip & 0xff);
   }
+  std::array<char, 11> name;
+  std::snprintf(name.data(), name.size(), "hub_%02x%02x%02x", (*hub.mac)[3],
+                (*hub.mac)[4], (*hub.mac)[5]);
+  return name.data();
 }
 
-void publish_sensor_values(const std::vector<spymarine::device>& devices,
-                           mqtt_client& client) {
-  ESP_LOGI(TAG, "Sending Home Assistant sensor messags");
+/*! Remembers the ids of the discovery configs that sync_discovery queued.
+ * The cache marks them published when they are queued, so a config that
+ * the queue failed to send makes the next sync publish all configs again.
+ * Configs that were sent but lost with the session are republished because
+ * the session was lost.
+ */
+class discovery_completions {
+public:
+  void begin(const mqtt_publish_queue& queue) {
+    const std::lock_guard lock{_mutex};
+    _first_id = queue.next_id();
+    _syncing = true;
+  }
+
+  void end(const mqtt_publish_queue& queue) {
+    const std::lock_guard lock{_mutex};
+    _end_id = queue.next_id();
+    _syncing = false;
+  }
+
+  /*! Forwards the completion callback of the publish queue
+   */
+  void completed(const uint32_t id, const bool published) {
+    if (published) {
+      return;
+    }
+    const std::lock_guard lock{_mutex};
+    // Ids wrap around, all ids since begin() are configs while syncing
+    if (_syncing || id - _first_id < _end_id - _first_id) {
+      _failed = true;
+    }
+  }
+
+  bool take_failed() { return _failed.exchange(false); }
+
+private:
+  std::mutex _mutex;
+  uint32_t _first_id{0};
+  uint32_t _end_id{0};
+  bool _syncing{false};
+  std::atomic<bool> _failed{false};
+};
 
-  for (const auto& device : devices) {
-    const auto message = make_home_assistant_state_message(device);
-    client.publish(message.topic.c_str(), message.payload,
-                   mqtt_qos::at_most_once, false);
+bool sync_discovery(const std::vector<spymarine::device>& devices,
+                    home_assistant_publisher& publisher,
+                    mqtt_publish_queue* queue = nullptr,
+                    discovery_completions* completions = nullptr) {
+  // Discovery configs are retained, so Home Assistant gets them from the
+  // broker when it comes online. Only changes since the last boot are sent.
+  discovery_cache discovery{max_hubs * discovery_configs_per_hub};
+  if (const auto data = nvs_read_blob(discovery_namespace, discovery_key)) {
+    discovery.load(*data);
   }
+  // Nothing was published with the current keys yet, e.g. right after
+  // upgrading from the configs of spymarine
+  if (discovery.empty()) {
+    publisher.clear_legacy_discovery(devices);
+  }
+  if (completions) {
+    completions->begin(*queue);
+  }
+  const auto complete = publisher.sync_device_discovery(devices, discovery);
+  if (completions) {
+    completions->end(*queue);
+  }
+  if (discovery.dirty()) {
+    nvs_write_blob(discovery_namespace, discovery_key, discovery.data());
+  }
+  return complete;
 }
 
-void process_sensor_values(
-    const std::vector<spymarine::device>& devices,
-    spymarine::moving_average_sensor_reader<spymarine::udp_socket>&
-        sensor_reader,
-    mqtt_client& client) {
-  ESP_LOGI(TAG, "Start processing sensor values");
+/*! Makes the next sync publish all discovery configs again, e.g. after the
+ * broker lost its retained messages
+ */
+void forget_discovery() {
+  nvs_write_blob(discovery_namespace, discovery_key, discovery_cache{}.data());
+}
 
-  std::atomic<bool> reinitialize = false;
-  client.subscribe("homeassistant/status", mqtt_qos::at_least_once,
-                   [&](std::string_view data) {
-                     if (data == "online") {
-                       reinitialize = true;
-                     }
-                   });
+/*! Every device publishes its state at least once per window, and in the
+ * changed mode at least every max_interval, which is the heartbeat Home
+ * Assistant expects. Twice that tolerates a lost message.
+ */
+std::chrono::seconds state_expiry(const aggregation_config& aggregation,
+                                  const delta_publish_config& delta_config) {
+  auto longest_window = aggregation.defaults.window;
+  for (const auto& type_aggregation : aggregation.per_type) {
+    if (type_aggregation) {
+      longest_window = std::max(longest_window, type_aggregation->window);
+    }
+  }
+  return 2 * (delta_config.max_interval +
+              std::chrono::ceil<std::chrono::seconds>(longest_window));
+}
+
+std::vector<std::unique_ptr<home_assistant_publisher>>
+make_publishers(mqtt_client& client, std::span<const cached_devices> hubs,
+                mqtt_publish_queue* publish_queue,
+                const discovery_availability& availability) {
+  std::vector<std::unique_ptr<home_assistant_publisher>> publishers;
+  for (const auto& hub : hubs) {
+    // Owns the message buffer, too large for the main task's stack
+    auto publisher = std::make_unique<home_assistant_publisher>(
+        client, publish_mode, make_delta_publish_config());
+    publisher->set_device_namespace(hub_namespace(hub, hubs.size()));
+    publisher->set_publish_queue(publish_queue);
+    publisher->set_availability(availability);
+    publishers.push_back(std::move(publisher));
+  }
+  return publishers;
+}
+
+std::unique_ptr<device_enumerator>
+start_enumerator(const device_type_filter filter) {
+  auto enumerator = std::make_unique<device_enumerator>(
+      [filter] { return enumerate_hubs(filter); });
+  enumerator->start();
+  return enumerator;
+}
+
+bool open_hubs(hub_demultiplexer& demultiplexer,
+               std::vector<cached_devices>& hubs) {
+  if (!demultiplexer.open()) {
+    return false;
+  }
+  for (auto& hub : hubs) {
+    demultiplexer.add_hub(hub.ip, hub.devices);
+  }
+  return true;
+}
+
+void publish_alert(const alert_engine& alerts, const alert_event& event,
+                   mqtt_publish_queue& publish_queue) {
+  auto prepared = publish_queue.prepare();
+  if (!prepared || !alerts.write_event_message(event, prepared->message())) {
+    ESP_LOGE(TAG, "Couldn't write alert message");
+    return;
+  }
+  publish_queue.publish(std::move(*prepared), mqtt_qos::at_least_once, false);
+}
+
+/*! Publishes the sensor values of the sensor pipeline until the background
+ * enumeration reports a changed device topology, returns the new hubs in
+ * that case. Runs as the publisher task of the pipeline on the main task and
+ * applies changed settings: a new aggregation window is handed to the running
+ * pipeline, a new device filter starts an enumeration.
+ */
+std::vector<cached_devices> process_sensor_values(
+    const std::vector<cached_devices>& hubs,
+    hub_demultiplexer& demultiplexer,
+    std::span<const std::unique_ptr<home_assistant_publisher>> publishers,
+    mqtt_client& client, mqtt_publish_queue& publish_queue,
+    offline_store& offline_values, sensor_history& history,
+    diagnostics_publisher& diagnostics, settings_store& settings,
+    std::atomic<bool>& reinitialize, std::atomic<bool>& session_lost,
+    discovery_completions& completions,
+    std::unique_ptr<device_enumerator>& enumerator) {
+  ESP_LOGI(TAG, "Start processing sensor values of %zu hubs", hubs.size());
+
+  bool discovery_pending = false;
+  for (size_t i = 0; i < hubs.size(); i++) {
+    discovery_pending |= !sync_discovery(hubs[i].devices, *publishers[i],
+                                         &publish_queue, &completions);
+  }
+
+  // The last completed window of each hub, for publishing everything again.
+  // Devices flag whether a window completed at all, until then their values
+  // are placeholders.
+  std::vector<std::vector<spymarine::device>> latest_devices;
+  std::vector<std::vector<uint8_t>> completed_devices;
+  for (size_t i = 0; i < hubs.size(); i++) {
+    latest_devices.push_back(demultiplexer.aggregated_devices(i));
+    completed_devices.emplace_back(latest_devices.back().size(), 0);
+  }
+
+  alert_engine alerts{make_alert_rules()};
+  for (const auto& hub : hubs) {
+    alerts.add_hub(hub.devices);
+  }
+
+  // Receiving and aggregating run on their own tasks from here on, so a slow
+  // network only delays publishing
+  sensor_pipeline pipeline{demultiplexer, sensor_pipeline_config{}, &alerts};
+  pipeline.start();
+  task_watchdog watchdog;
+  // Discovery, replays and history answers queue many messages per
+  // iteration and each may wait for the sender
+  publish_queue.set_watchdog(&watchdog);
+
+  auto applied_settings = settings.current();
+
+  // Set while an enumeration with the previous device filter still runs
+  bool enumeration_pending = false;
 
   while (true) {
+    watchdog.feed();
+
+    if (session_lost.exchange(false)) {
+      ESP_LOGI(TAG, "Broker lost the session, republishing discovery");
+      forget_discovery();
+      discovery_pending = true;
+      diagnostics.reset();
+    }
+
+    if (completions.take_failed()) {
+      ESP_LOGW(TAG, "Failed to send a discovery config, republishing");
+      forget_discovery();
+      discovery_pending = true;
+    }
+
     if (reinitialize) {
-      send_mqtt_logger_device_discovery();
-      send_home_assistant_device_discovery(devices, client);
-      sensor_reader.read_and_update().transform(
-          [&](bool) { publish_sensor_values(devices, client); });
+      for (size_t i = 0; i < hubs.size(); i++) {
+        publishers[i]->reset();
+        const auto& completed = completed_devices[i];
+        if (std::any_of(completed.begin(), completed.end(),
+                        [](uint8_t flag) { return flag != 0; })) {
+          publishers[i]->publish_sensor_values(latest_devices[i], completed);
+        }
+      }
       reinitialize = false;
     }
 
-    const auto result =
-        sensor_reader.read_and_update().transform([&](bool window_completed) {
-          if (window_completed) {
-            publish_sensor_values(devices, client);
+    if (const auto changed = settings.take_changes()) {
+      if (changed->window != applied_settings.window) {
+        ESP_LOGI(TAG, "Switching to the new aggregation window");
+        auto aggregation = apply_settings(make_aggregation_config(), *changed);
+
+        // The discovery configs declare an expiry based on the window
+        const auto expire_after =
+            state_expiry(aggregation, make_delta_publish_config());
+        for (const auto& publisher : publishers) {
+          publisher->set_availability(
+              {.topic = availability_topic, .expire_after = expire_after});
+        }
+        discovery_pending = true;
+        pipeline.set_aggregation(std::move(aggregation));
+      }
+      if (changed->device_types != applied_settings.device_types) {
+        ESP_LOGI(TAG, "Device filter changed, enumerating devices");
+        enumeration_pending = true;
+      }
+      if (changed->wifi_ssid != applied_settings.wifi_ssid ||
+          changed->wifi_password != applied_settings.wifi_password ||
+          changed->mqtt_broker_uri != applied_settings.mqtt_broker_uri) {
+        ESP_LOGI(TAG, "Network settings take effect after a restart");
+      }
+      applied_settings = *changed;
+    }
+
+    const auto snapshot = pipeline.wait_for_snapshot(publisher_wait);
+
+    // Queued while disconnected as well, the broker gets them on reconnect
+    while (const auto alert = pipeline.take_alert()) {
+      publish_alert(alerts, *alert, publish_queue);
+    }
+
+    if (snapshot) {
+      const auto hub_index = snapshot->hub;
+      latest_devices[hub_index] = snapshot->devices;
+      auto& completed = completed_devices[hub_index];
+      completed.resize(snapshot->devices.size(), 0);
+      for (size_t i = 0; i < completed.size(); i++) {
+        completed[i] |= snapshot->due.empty() ||
+                        (i < snapshot->due.size() && snapshot->due[i] != 0);
+      }
+      history.record(hub_index, snapshot->devices, snapshot->due,
+                     uint32_t(std::time(nullptr)));
+      auto& publisher = *publishers[hub_index];
+
+      if (client.is_connected()) {
+        if (discovery_pending) {
+          discovery_pending = false;
+          for (size_t i = 0; i < hubs.size(); i++) {
+            discovery_pending |=
+                !sync_discovery(hubs[i].devices, *publishers[i],
+                                &publish_queue, &completions);
           }
-        });
+        }
+        publisher.publish_sensor_values(snapshot->devices, snapshot->due);
+      } else {
+        offline_values.record(snapshot->devices, uint8_t(hub_index),
+                              snapshot->due);
+      }
+      pipeline.release_snapshot();
+    }
 
-    if (!result) {
-      ESP_LOGE(TAG, "Failed to read sensor values: %s",
-               spymarine::error_message(result.error()).c_str());
+    if (client.is_connected()) {
+      offline_values.replay(publish_queue);
+      history.answer_queries(publish_queue);
+      diagnostics.update();
+    }
+
+    if (enumerator) {
+      if (auto enumerated = enumerator->take_result()) {
+        if (enumeration_pending) {
+          ESP_LOGI(TAG, "Ignoring devices enumerated with the old filter");
+        } else if (!same_topology(hubs, *enumerated)) {
+          ESP_LOGI(TAG, "Device topology changed, switching devices");
+          store_device_cache(*enumerated);
+          publish_queue.set_watchdog(nullptr);
+          return std::move(*enumerated);
+        }
+        ESP_LOGI(TAG, "Cached devices are up to date");
+      }
+    }
+
+    // The topology switch above picks up the devices of the new filter
+    if (enumeration_pending && (!enumerator || enumerator->finished())) {
+      enumerator = start_enumerator(device_filter(applied_settings));
+      enumeration_pending = false;
     }
   }
 }
 
-bool start(mqtt_client& client) {
-  spymarine::buffer buffer;
+bool run_duty_cycle(duty_cycle& cycle, mqtt_client& client,
+                    const runtime_settings& settings) {
+  auto hubs = cycle.load_cached_devices();
+  if (!hubs) {
+    hubs = enumerate_hubs(device_filter(settings));
+    if (!hubs) {
+      return false;
+    }
+    cycle.cache_devices(*hubs);
+  }
 
-  auto devices = spymarine::discover().and_then([&](const auto ip) {
-    ESP_LOGI(TAG, "Read devices");
+  // A single window for all devices, so that all complete before sleeping
+  aggregation_config aggregation;
+  aggregation.defaults.window = cycle.config().window;
+  hub_demultiplexer demultiplexer{aggregation};
+  if (!open_hubs(demultiplexer, *hubs)) {
+    return false;
+  }
 
-    return spymarine::read_devices<spymarine::tcp_socket>(
-        buffer, ip, spymarine::simarine_default_tcp_port, make_device_filter());
-  });
+  // Sleeping between cycles would make the devices unavailable, so the
+  // discovery doesn't declare an availability
+  const auto publishers = make_publishers(client, *hubs, nullptr, {});
+  for (size_t i = 0; i < hubs->size(); i++) {
+    sync_discovery((*hubs)[i].devices, *publishers[i]);
+  }
+  cycle.publish_metrics(client);
 
-  if (!devices) {
-    ESP_LOGE(TAG, "Failed to read devices: %s",
-             spymarine::error_message(devices.error()).c_str());
-    return false;
+  // Every hub publishes once its first window completes
+  std::vector<bool> published(hubs->size(), false);
+  while (std::find(published.begin(), published.end(), false) !=
+         published.end()) {
+    const auto completed_hub = demultiplexer.read_and_update();
+    if (!completed_hub) {
+      ESP_LOGE(TAG, "Failed to read sensor values: %s",
+               spymarine::error_message(completed_hub.error()).c_str());
+      return false;
+    }
+    if (*completed_hub && !published[**completed_hub]) {
+      const auto hub_index = **completed_hub;
+      publishers[hub_index]->publish_sensor_values(
+          demultiplexer.aggregated_devices(hub_index));
+      published[hub_index] = true;
+    }
   }
 
-  if (devices->size() == 0) {
-    ESP_LOGE(TAG, "No devices found");
-    return false;
+  return true;
+}
+
+bool start(mqtt_client& client, settings_store& settings) {
+  // Starts right away with the devices of the last boot and confirms them
+  // with a full enumeration in the background
+  auto hubs = load_device_cache();
+  std::unique_ptr<device_enumerator> enumerator;
+  if (hubs) {
+    ESP_LOGI(TAG, "Starting with the cached devices of %zu hubs",
+             hubs->size());
+    enumerator = start_enumerator(device_filter(settings.current()));
+  } else {
+    hubs = enumerate_hubs(device_filter(settings.current()));
+    if (!hubs) {
+      return false;
+    }
+    store_device_cache(*hubs);
   }
 
-  ESP_LOGI(TAG, "Found %d devices", devices->size());
+  // Outlive the publish queue, which reports the completions to them
+  auto offline_values =
+      std::make_unique<offline_store>(offline_store::config{});
+  discovery_completions completions;
 
-  auto sensor_reader = spymarine::make_moving_average_sensor_reader(
-      buffer, sensor_update_interval, *devices);
+  // Keeps the sensor loop draining UDP while messages are sent. All
+  // messages are queued from this task: each hub's publisher may hold a
+  // prepared message, one more slab is for the diagnostics, alert, history
+  // and offline messages, which are written and queued one at a time. The
+  // MQTT logger publishes on its own task through the client.
+  mqtt_publish_queue publish_queue{client, max_hubs + 1};
+  publish_queue.set_completion_callback([&](uint32_t id, bool published) {
+    offline_values->completed(id, published);
+    completions.completed(id, published);
+    if (!published) {
+      ESP_LOGW(TAG, "Failed to publish message %" PRIu32, id);
+    }
+  });
+  publish_queue.start();
 
-  if (!sensor_reader) {
-    ESP_LOGE(TAG, "Failed to make sensor reader: %s",
-             spymarine::error_message(sensor_reader.error()).c_str());
-    return false;
+  // The MQTT callbacks can't be removed and may still run after start()
+  // returned, so the state they use is shared with them
+  const auto history = std::make_shared<sensor_history>(history_config{});
+  client.subscribe(
+      sensor_history::query_topic, mqtt_qos::at_most_once,
+      [history](std::string_view data) { history->request(data); });
+
+  auto diagnostics = std::make_unique<diagnostics_publisher>(
+      client, diagnostics_interval);
+  diagnostics->set_publish_queue(&publish_queue);
+
+  // Retained, so the broker sends the current settings after subscribing.
+  // The settings live as long as app_main.
+  client.subscribe(
+      settings_store::config_topic, mqtt_qos::at_least_once,
+      [&settings](std::string_view data) { settings.request(data); });
+
+  struct connection_flags {
+    std::atomic<bool> reinitialize{false};
+    std::atomic<bool> session_lost{false};
+  };
+  const auto flags = std::make_shared<connection_flags>();
+  client.subscribe("homeassistant/status", mqtt_qos::at_least_once,
+                   [flags](std::string_view data) {
+                     if (data == "online") {
+                       flags->reinitialize = true;
+                     }
+                   });
+
+  // The client restores the subscriptions itself after reconnecting. The
+  // values published while disconnected went to the offline store, so the
+  // current state is published again. A broker that lost the session may
+  // have lost the retained discovery configs as well.
+  client.add_connection_callback([flags](const mqtt_connection_event& event) {
+    if (event.connected) {
+      flags->reinitialize = true;
+      if (!event.session_present) {
+        flags->session_lost = true;
+      }
+    }
+  });
+
+  while (true) {
+    // A single socket serves all hubs, it's reopened for the new hubs after
+    // a topology change
+    const auto aggregation =
+        apply_settings(make_aggregation_config(), settings.current());
+    hub_demultiplexer demultiplexer{aggregation};
+    if (!open_hubs(demultiplexer, *hubs)) {
+      return false;
+    }
+
+    const auto publishers = make_publishers(
+        client, *hubs, &publish_queue,
+        {.topic = availability_topic,
+         .expire_after =
+             state_expiry(aggregation, make_delta_publish_config())});
+    history->set_hubs(*hubs);
+
+    auto next_hubs = process_sensor_values(
+        *hubs, demultiplexer, publishers, client, publish_queue,
+        *offline_values, *history, *diagnostics, settings,
+        flags->reinitialize, flags->session_lost, completions, enumerator);
+
+    hubs = std::move(next_hubs);
   }
+}
 
-  process_sensor_values(*devices, *sensor_reader, client);
-  return true;
+[[noreturn]] void restart_without_network_settings(settings_store& settings) {
+  ESP_LOGE(TAG, "Failed to connect with the network settings of the config "
+                "topic, restarting with the configured ones");
+  settings.clear_network_settings();
+  esp_restart();
 }
 
 } // namespace
@@ -129,24 +603,88 @@ extern "C" void app_main(void) {
   ESP_ERROR_CHECK(esp_netif_init());
   ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-  wifi_connector connector{wifi_ssid, wifi_password};
+  duty_cycle cycle{make_duty_cycle_config()};
+  const auto duty_cycled = cycle.config().enabled;
+
+  settings_store settings;
+  const auto network_overridden = settings.current().has_network_settings();
+  const auto wifi_overridden = !settings.current().wifi_ssid.empty();
+
+  wifi_connector connector{
+      wifi_overridden ? std::string_view{settings.current().wifi_ssid}
+                      : wifi_ssid,
+      wifi_overridden ? std::string_view{settings.current().wifi_password}
+                      : wifi_password,
+      make_wifi_reconnect_config()};
+  if (duty_cycled) {
+    if (const auto access_point = cycle.cached_access_point()) {
+      connector.set_access_point(*access_point);
+    }
+  }
   {
     auto wifi_connected_promise = connector.make_connected_promise();
     connector.start();
-    wifi_connected_promise.wait();
+    if (network_overridden) {
+      if (!wifi_connected_promise.wait_for(network_settings_timeout)) {
+        restart_without_network_settings(settings);
+      }
+    } else if (!duty_cycled) {
+      wifi_connected_promise.wait();
+    } else if (!wifi_connected_promise.wait_for(wifi_connect_timeout)) {
+      ESP_LOGE(TAG, "Failed to connect to wifi, sleeping until next cycle");
+      cycle.clear_cache();
+      cycle.sleep();
+    }
+  }
+  if (duty_cycled) {
+    if (const auto access_point = connector.connected_access_point()) {
+      cycle.cache_access_point(*access_point);
+    }
   }
 
-  mqtt_client mqtt_client{make_mqtt_config()};
+  // Timestamps values that are kept while the broker is unreachable
+  esp_sntp_config_t sntp_config = ESP_NETIF_SNTP_DEFAULT_CONFIG(ntp_server);
+  ESP_ERROR_CHECK(esp_netif_sntp_init(&sntp_config));
+
+  // Copied, the settings may change while the client runs
+  const auto broker_uri = settings.current().mqtt_broker_uri;
+  auto mqtt_config = make_mqtt_config();
+  if (!broker_uri.empty()) {
+    mqtt_config.broker.address.uri = broker_uri.c_str();
+  }
+
+  mqtt_client mqtt_client{mqtt_config};
+  if (!duty_cycled) {
+    mqtt_client.set_availability(availability_topic);
+  }
   {
     auto mqtt_client_connected_promise = mqtt_client.make_connected_promise();
     mqtt_client.start();
-    mqtt_client_connected_promise.wait();
+    if (network_overridden) {
+      if (!mqtt_client_connected_promise.wait_for(network_settings_timeout)) {
+        restart_without_network_settings(settings);
+      }
+    } else if (!duty_cycled) {
+      mqtt_client_connected_promise.wait();
+    } else if (!mqtt_client_connected_promise.wait_for(wifi_connect_timeout)) {
+      // Waiting would keep the ESP32 awake until the broker is back
+      ESP_LOGE(TAG, "Failed to connect to broker, sleeping until next cycle");
+      cycle.sleep();
+    }
+  }
+
+  if (duty_cycled) {
+    if (!run_duty_cycle(cycle, mqtt_client, settings.current())) {
+      ESP_LOGE(TAG, "Duty cycle failed, rediscovering on the next wake up");
+      cycle.clear_cache();
+    }
+    cycle.sleep();
   }
 
-  setup_mqtt_logger(mqtt_client);
+  setup_mqtt_logger(mqtt_client, make_mqtt_logger_config());
   send_mqtt_logger_device_discovery();
 
-  if (!start(mqtt_client)) {
+  if (!start(mqtt_client, settings)) {
     ESP_LOGE(TAG, "Failed to initialize, restarting in a moment...");
     std::this_thread::sleep_for(wifi_retry_interval);
     esp_restart();
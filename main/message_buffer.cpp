@@ -0,0 +1,86 @@
+#include "message_buffer.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+
+text_writer::text_writer(std::span<char> storage) : _storage{storage} {
+  clear();
+}
+
+text_writer& text_writer::append(const std::string_view text) {
+  if (_overflowed || _size + text.size() >= _storage.size()) {
+    _overflowed = true;
+    return *this;
+  }
+
+  std::copy(text.begin(), text.end(), _storage.begin() + _size);
+  _size += text.size();
+  _storage[_size] = '\0';
+  return *this;
+}
+
+text_writer& text_writer::append(const char c) {
+  return append(std::string_view{&c, 1});
+}
+
+text_writer& text_writer::append(const size_t value) {
+  std::array<char, 24> digits;
+  const auto result =
+      std::to_chars(digits.data(), digits.data() + digits.size(), value);
+  return append(std::string_view{digits.data(), result.ptr});
+}
+
+text_writer& text_writer::append(const float value, const int decimals) {
+  if (!std::isfinite(value)) {
+    return append("null");
+  }
+
+  // Fits the sign, the 39 integer digits of the largest float and decimals
+  std::array<char, 64> digits;
+  const auto result =
+      std::to_chars(digits.data(), digits.data() + digits.size(), value,
+                    std::chars_format::fixed, decimals);
+  if (result.ec != std::errc{}) {
+    _overflowed = true;
+    return *this;
+  }
+  return append(std::string_view{digits.data(), result.ptr});
+}
+
+text_writer& text_writer::append_json_string(const std::string_view text) {
+  append('"');
+  for (const auto c : text) {
+    if (c == '"' || c == '\\') {
+      append('\\').append(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      std::array<char, 7> escaped;
+      std::snprintf(escaped.data(), escaped.size(), "\\u%04x", c);
+      append(std::string_view{escaped.data(), 6});
+    } else {
+      append(c);
+    }
+  }
+  return append('"');
+}
+
+text_writer& text_writer::append_identifier(const std::string_view text) {
+  for (const auto c : text) {
+    if (c >= 'A' && c <= 'Z') {
+      append(char(c - 'A' + 'a'));
+    } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+      append(c);
+    } else {
+      append('_');
+    }
+  }
+  return *this;
+}
+
+void text_writer::clear() {
+  _size = 0;
+  _overflowed = _storage.empty();
+  if (!_storage.empty()) {
+    _storage[0] = '\0';
+  }
+}
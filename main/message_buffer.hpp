@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+/*! Appends text to a fixed, caller-provided buffer without allocating.
+ * Writes that don't fit are dropped and mark the writer as overflowed.
+ * The text is always null terminated.
+ */
+class text_writer {
+public:
+  explicit text_writer(std::span<char> storage);
+
+  text_writer& append(std::string_view text);
+  text_writer& append(char c);
+  text_writer& append(size_t value);
+
+  /*! Appends the value in fixed notation with the given number of decimals,
+   * or null if it's NaN or infinite, which JSON can't represent
+   */
+  text_writer& append(float value, int decimals);
+
+  /*! Appends the text as JSON string including the quotes
+   */
+  text_writer& append_json_string(std::string_view text);
+
+  /*! Appends the text lower cased and with every character that isn't
+   * alphanumeric replaced by '_' to make it usable in topics and ids
+   */
+  text_writer& append_identifier(std::string_view text);
+
+  void clear();
+
+  bool overflowed() const { return _overflowed; }
+
+  std::string_view view() const { return {_storage.data(), _size}; }
+  const char* c_str() const { return _storage.data(); }
+
+private:
+  std::span<char> _storage;
+  size_t _size{0};
+  bool _overflowed{false};
+};
+
+/*! A MQTT topic and payload written to caller-provided storage. Moving
+ * keeps referring to the same storage.
+ */
+class message_buffer {
+public:
+  message_buffer(std::span<char> topic_storage,
+                 std::span<char> payload_storage)
+      : _topic{topic_storage}, _payload{payload_storage} {}
+
+  message_buffer(const message_buffer& other) = delete;
+  message_buffer(message_buffer&& other) = default;
+
+  message_buffer& operator=(const message_buffer& other) = delete;
+  message_buffer& operator=(message_buffer&& other) = default;
+
+  text_writer& topic() { return _topic; }
+  const text_writer& topic() const { return _topic; }
+
+  text_writer& payload() { return _payload; }
+  const text_writer& payload() const { return _payload; }
+
+  void clear() {
+    _topic.clear();
+    _payload.clear();
+  }
+
+  bool overflowed() const {
+    return _topic.overflowed() || _payload.overflowed();
+  }
+
+private:
+  text_writer _topic;
+  text_writer _payload;
+};
+
+/*! Storage of fixed_message_buffer, a base class so that it's constructed
+ * before the message_buffer base that refers to it
+ */
+template <size_t TopicCapacity, size_t PayloadCapacity>
+struct fixed_message_storage {
+  std::array<char, TopicCapacity> _topic_storage{};
+  std::array<char, PayloadCapacity> _payload_storage{};
+};
+
+/*! A message_buffer that owns its storage
+ */
+template <size_t TopicCapacity, size_t PayloadCapacity>
+class fixed_message_buffer
+    : private fixed_message_storage<TopicCapacity, PayloadCapacity>,
+      public message_buffer {
+  using storage = fixed_message_storage<TopicCapacity, PayloadCapacity>;
+
+public:
+  fixed_message_buffer()
+      : message_buffer{storage::_topic_storage, storage::_payload_storage} {}
+  fixed_message_buffer(fixed_message_buffer&& other) = delete;
+
+  fixed_message_buffer& operator=(fixed_message_buffer&& other) = delete;
+};
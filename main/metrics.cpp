@@ -0,0 +1,117 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Constant initialized, so metrics defined in any translation unit can
+// register themselves during static initialization
+constinit metric* g_first_metric = nullptr;
+
+void write_key(text_writer& writer, std::string_view key) {
+  writer.append_json_string(key).append(':');
+}
+
+} // namespace
+
+metric::metric(std::string_view name, std::string_view unit)
+    : _name{name}, _unit{unit}, _next{g_first_metric} {
+  g_first_metric = this;
+}
+
+metric* first_metric() { return g_first_metric; }
+
+void counter::write_value(text_writer& writer) const {
+  writer.append(size_t(value()));
+}
+
+void keyed_counter::increment(uint16_t key) {
+  for (auto& slot : _slots) {
+    auto slot_key = slot.key.load(std::memory_order_relaxed);
+    if (slot_key == empty_key &&
+        slot.key.compare_exchange_strong(slot_key, key,
+                                         std::memory_order_relaxed)) {
+      slot_key = key;
+    }
+    if (slot_key == key) {
+      slot.count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  _other.fetch_add(1, std::memory_order_relaxed);
+}
+
+void keyed_counter::write_value(text_writer& writer) const {
+  size_t total = _other.load(std::memory_order_relaxed);
+  writer.append('{');
+  for (const auto& slot : _slots) {
+    const auto key = slot.key.load(std::memory_order_relaxed);
+    if (key == empty_key) {
+      break;
+    }
+    const auto count = slot.count.load(std::memory_order_relaxed);
+    total += count;
+    writer.append('"').append(size_t(key)).append("\":");
+    writer.append(size_t(count)).append(',');
+  }
+  write_key(writer, "other");
+  writer.append(size_t(_other.load(std::memory_order_relaxed))).append(',');
+  write_key(writer, "total");
+  writer.append(total).append('}');
+}
+
+void gauge::write_value(text_writer& writer) const {
+  const auto current = value();
+  if (current < 0) {
+    writer.append('-');
+  }
+  writer.append(size_t(current < 0 ? -int64_t(current) : current));
+}
+
+void histogram::record(uint32_t value) {
+  const auto bucket =
+      std::lower_bound(_upper_bounds.begin(), _upper_bounds.end(), value) -
+      _upper_bounds.begin();
+  _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+  auto max = _max.load(std::memory_order_relaxed);
+  while (value > max && !_max.compare_exchange_weak(
+                            max, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint32_t histogram::percentile(uint32_t total, uint32_t percent) const {
+  const auto rank = (uint64_t(total) * percent + 99) / 100;
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < _upper_bounds.size(); i++) {
+    cumulative += _buckets[i].load(std::memory_order_relaxed);
+    if (cumulative >= rank) {
+      return std::min(_upper_bounds[i], _max.load(std::memory_order_relaxed));
+    }
+  }
+  return _max.load(std::memory_order_relaxed);
+}
+
+void histogram::write_value(text_writer& writer) const {
+  uint32_t total = 0;
+  for (const auto& bucket : _buckets) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+
+  writer.append('{');
+  write_key(writer, "count");
+  writer.append(size_t(total)).append(',');
+  write_key(writer, "max");
+  writer.append(size_t(_max.load(std::memory_order_relaxed))).append(',');
+  write_key(writer, "p50");
+  writer.append(size_t(total ? percentile(total, 50) : 0)).append(',');
+  write_key(writer, "p95");
+  writer.append(size_t(total ? percentile(total, 95) : 0)).append('}');
+}
+
+void histogram::reset_window() {
+  for (auto& bucket : _buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  _max.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "message_buffer.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+/*! Base of all metrics. Metrics are meant to be defined with static storage
+ * duration, they add themselves to a process wide list on construction which
+ * is iterated with for_each_metric. Updating a metric is a relaxed atomic
+ * operation and never allocates.
+ */
+class metric {
+public:
+  metric(const metric& other) = delete;
+  virtual ~metric() = default;
+
+  std::string_view name() const { return _name; }
+  std::string_view unit() const { return _unit; }
+
+  /*! Writes the current value as JSON value
+   */
+  virtual void write_value(text_writer& writer) const = 0;
+
+  /*! Appended to value_json.<name> to select the value shown in Home
+   * Assistant if the JSON value is an object
+   */
+  virtual std::string_view value_selector() const { return {}; }
+
+  /*! Called after the value was published, for metrics that only cover the
+   * time since the last publish
+   */
+  virtual void reset_window() {}
+
+  metric* next() const { return _next; }
+
+  metric& operator=(const metric& other) = delete;
+
+protected:
+  metric(std::string_view name, std::string_view unit);
+
+private:
+  std::string_view _name;
+  std::string_view _unit;
+  metric* _next{nullptr};
+};
+
+metric* first_metric();
+
+template <typename F> void for_each_metric(F&& f) {
+  for (auto m = first_metric(); m != nullptr; m = m->next()) {
+    f(*m);
+  }
+}
+
+/*! A monotonically increasing count of events
+ */
+class counter : public metric {
+public:
+  explicit counter(std::string_view name) : metric{name, {}} {}
+
+  void increment(uint32_t count = 1) {
+    _value.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  uint32_t value() const { return _value.load(std::memory_order_relaxed); }
+
+  void write_value(text_writer& writer) const override;
+
+private:
+  std::atomic<uint32_t> _value{0};
+};
+
+/*! Counts events per key, e.g. per error code. Keys beyond the first
+ * max_keys ones are counted as "other".
+ */
+class keyed_counter : public metric {
+public:
+  static constexpr size_t max_keys = 8;
+
+  explicit keyed_counter(std::string_view name) : metric{name, {}} {}
+
+  void increment(uint16_t key);
+
+  void write_value(text_writer& writer) const override;
+  std::string_view value_selector() const override { return ".total"; }
+
+private:
+  static constexpr uint16_t empty_key = 0xffff;
+
+  struct slot {
+    std::atomic<uint16_t> key{empty_key};
+    std::atomic<uint32_t> count{0};
+  };
+
+  std::array<slot, max_keys> _slots;
+  std::atomic<uint32_t> _other{0};
+};
+
+/*! The last measured value of something
+ */
+class gauge : public metric {
+public:
+  explicit gauge(std::string_view name, std::string_view unit = {})
+      : metric{name, unit} {}
+
+  void set(int32_t value) { _value.store(value, std::memory_order_relaxed); }
+
+  int32_t value() const { return _value.load(std::memory_order_relaxed); }
+
+  void write_value(text_writer& writer) const override;
+
+private:
+  std::atomic<int32_t> _value{0};
+};
+
+/*! Counts values in fixed buckets since the last publish. Publishes the
+ * count, the maximum and approximate 50th and 95th percentiles, which are the
+ * upper bounds of the buckets containing them.
+ */
+class histogram : public metric {
+public:
+  static constexpr size_t bucket_count = 10;
+  using bounds = std::array<uint32_t, bucket_count - 1>;
+
+  /*! Bucket upper bounds suitable for durations in microseconds
+   */
+  static constexpr bounds duration_bounds_us{
+      100, 300, 1'000, 3'000, 10'000, 30'000, 100'000, 300'000, 1'000'000};
+
+  histogram(std::string_view name, std::string_view unit,
+            const bounds& upper_bounds = duration_bounds_us)
+      : metric{name, unit}, _upper_bounds{upper_bounds} {}
+
+  void record(uint32_t value);
+
+  void write_value(text_writer& writer) const override;
+  std::string_view value_selector() const override { return ".p95"; }
+  void reset_window() override;
+
+private:
+  uint32_t percentile(uint32_t total, uint32_t percent) const;
+
+  bounds _upper_bounds;
+  std::array<std::atomic<uint32_t>, bucket_count> _buckets{};
+  std::atomic<uint32_t> _max{0};
+};
+
+/*! Records the time from its construction to its destruction in
+ * microseconds
+ */
+class scoped_timer {
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit scoped_timer(histogram& target)
+      : _target{target}, _start{clock::now()} {}
+  scoped_timer(const scoped_timer& other) = delete;
+
+  ~scoped_timer() {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        clock::now() - _start);
+    _target.record(uint32_t(elapsed.count()));
+  }
+
+  scoped_timer& operator=(const scoped_timer& other) = delete;
+
+private:
+  histogram& _target;
+  clock::time_point _start;
+};
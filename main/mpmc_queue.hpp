@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*! Bounded lock-free queue for any number of producer and consumer tasks
+ * (Dmitry Vyukov's bounded MPMC queue). Pushing never blocks, it fails if
+ * the queue is full.
+ */
+template <typename T, size_t Capacity> class mpmc_queue {
+public:
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+  mpmc_queue() {
+    for (size_t i = 0; i < Capacity; i++) {
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  mpmc_queue(const mpmc_queue& other) = delete;
+
+  mpmc_queue& operator=(const mpmc_queue& other) = delete;
+
+  /*! Calls write with the reserved slot and makes it visible to consumers
+   * afterwards. Returns false without calling write if the queue is full.
+   */
+  template <typename Write> bool try_push_with(Write&& write) {
+    auto position = _enqueue_position.load(std::memory_order_relaxed);
+    cell* target;
+
+    while (true) {
+      target = &_cells[position & (Capacity - 1)];
+      const auto sequence = target->sequence.load(std::memory_order_acquire);
+      const auto difference = intptr_t(sequence) - intptr_t(position);
+      if (difference == 0) {
+        if (_enqueue_position.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = _enqueue_position.load(std::memory_order_relaxed);
+      }
+    }
+
+    write(target->data);
+    target->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  /*! Calls read with the oldest element and releases its slot afterwards.
+   * Returns false without calling read if the queue is empty.
+   */
+  template <typename Read> bool try_pop_with(Read&& read) {
+    auto position = _dequeue_position.load(std::memory_order_relaxed);
+    cell* target;
+
+    while (true) {
+      target = &_cells[position & (Capacity - 1)];
+      const auto sequence = target->sequence.load(std::memory_order_acquire);
+      const auto difference = intptr_t(sequence) - intptr_t(position + 1);
+      if (difference == 0) {
+        if (_dequeue_position.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = _dequeue_position.load(std::memory_order_relaxed);
+      }
+    }
+
+    read(target->data);
+    target->sequence.store(position + Capacity, std::memory_order_release);
+    return true;
+  }
+
+private:
+  struct cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  std::array<cell, Capacity> _cells;
+  alignas(64) std::atomic<size_t> _enqueue_position{0};
+  alignas(64) std::atomic<size_t> _dequeue_position{0};
+};
@@ -31,6 +31,18 @@ void mqtt_client::start() {
   _started = true;
 }
 
+void mqtt_client::set_availability(const char* topic, const char* online,
+                                   const char* offline) {
+  _availability_topic = topic;
+  _availability_online = online;
+
+  _config.session.last_will.topic = topic;
+  _config.session.last_will.msg = offline;
+  _config.session.last_will.qos = static_cast<int>(mqtt_qos::at_least_once);
+  _config.session.last_will.retain = 1;
+  ESP_ERROR_CHECK(esp_mqtt_set_config(_client, &_config));
+}
+
 namespace {
 
 void report_error(esp_mqtt_error_codes_t error_handle) {
@@ -45,12 +57,38 @@ void report_error(esp_mqtt_error_codes_t error_handle) {
 
 void mqtt_client::mqtt_event_handler(void* arg, esp_event_base_t eventBase,
                                      int32_t event_id, void* event_data) {
+  auto _this = static_cast<mqtt_client*>(arg);
+
   switch (static_cast<esp_mqtt_event_id_t>(event_id)) {
-  case MQTT_EVENT_CONNECTED:
-    ESP_LOGI(TAG, "Connected");
+  case MQTT_EVENT_CONNECTED: {
+    const auto event = static_cast<esp_mqtt_event_handle_t>(event_data);
+    const auto session_present = event->session_present != 0;
+    ESP_LOGI(TAG, "Connected, session %s",
+             session_present ? "resumed" : "new");
+
+    // Set first, so that subscribe() either sees the connection or its
+    // filter is subscribed here
+    _this->_connected = true;
+
+    // A resumed session still has the subscriptions on the broker
+    _this->resubscribe(session_present);
+
+    // Replaces the offline will the broker may have published after the
+    // last connection was lost. Enqueued, publishing blocks the event task.
+    if (_this->_availability_topic) {
+      esp_mqtt_client_enqueue(
+          _this->_client, _this->_availability_topic,
+          _this->_availability_online, 0,
+          static_cast<int>(mqtt_qos::at_least_once), 1, true);
+    }
+    _this->notify_connection({.connected = true,
+                              .session_present = session_present});
     break;
+  }
   case MQTT_EVENT_DISCONNECTED:
     ESP_LOGI(TAG, "Disconnected");
+    _this->_connected = false;
+    _this->notify_connection({.connected = false, .session_present = false});
     break;
   case MQTT_EVENT_ERROR: {
     const auto event = static_cast<esp_mqtt_event_handle_t>(event_data);
@@ -64,7 +102,6 @@ void mqtt_client::mqtt_event_handler(void* arg, esp_event_base_t eventBase,
     ESP_LOGI(TAG, "Unsubscribed");
     break;
   case MQTT_EVENT_DATA: {
-    auto _this = static_cast<mqtt_client*>(arg);
     const auto event = static_cast<esp_mqtt_event_handle_t>(event_data);
     _this->notify_data(std::string_view{event->topic, size_t(event->topic_len)},
                        std::string_view{event->data, size_t(event->data_len)});
@@ -84,16 +121,82 @@ bool mqtt_client::publish(const char* topic, const std::string_view data,
 
 bool mqtt_client::subscribe(const char* topic, mqtt_qos qos,
                             subscribe_callback callback) {
+  // Register the callback first to not miss retained messages
+  {
+    std::unique_lock lock{_subscribe_mutex};
+    _subscriptions = std::make_shared<const subscription_table>(
+        _subscriptions.load()->with(topic, std::move(callback)));
+    _filters.insert_or_assign(topic,
+                              filter_state{.qos = qos, .pending = true});
+  }
+
+  // Subscribed by the event task once connected
+  if (!_connected) {
+    return true;
+  }
+
+  // Not locked, the event task takes the lock to resubscribe and esp-mqtt
+  // may wait for it
   const auto result =
       esp_mqtt_client_subscribe_single(_client, topic, static_cast<int>(qos));
-  if (result >= 0) {
-    std::unique_lock lock{_subscribe_map_mutex};
-    _subscribe_map.emplace(std::string{topic}, std::move(callback));
-    return true;
-  } else {
+  if (result < 0) {
     ESP_LOGE(TAG, "Failed to subscribe %i", result);
+    return false;
+  }
+  mark_subscribed(topic);
+  return true;
+}
+
+void mqtt_client::resubscribe(const bool pending_only) {
+  // Copied, subscribing while holding the lock could deadlock with
+  // subscribe() waiting for esp-mqtt
+  std::vector<std::pair<std::string, mqtt_qos>> filters;
+  {
+    std::unique_lock lock{_subscribe_mutex};
+    for (const auto& [filter, state] : _filters) {
+      if (!pending_only || state.pending) {
+        filters.emplace_back(filter, state.qos);
+      }
+    }
+  }
+
+  ESP_LOGI(TAG, "Restoring %zu subscriptions", filters.size());
+  for (const auto& [filter, qos] : filters) {
+    const auto result = esp_mqtt_client_subscribe_single(
+        _client, filter.c_str(), static_cast<int>(qos));
+    if (result < 0) {
+      ESP_LOGE(TAG, "Failed to resubscribe %i", result);
+    } else {
+      mark_subscribed(filter);
+    }
+  }
+}
+
+void mqtt_client::mark_subscribed(const std::string_view filter) {
+  std::unique_lock lock{_subscribe_mutex};
+  if (const auto state = _filters.find(filter); state != _filters.end()) {
+    state->second.pending = false;
+  }
+}
+
+uint32_t mqtt_client::add_connection_callback(connection_callback callback) {
+  std::unique_lock lock{_connection_mutex};
+  const auto id = _next_connection_callback_id++;
+  _connection_callbacks.emplace_back(id, std::move(callback));
+  return id;
+}
+
+void mqtt_client::remove_connection_callback(const uint32_t id) {
+  std::unique_lock lock{_connection_mutex};
+  std::erase_if(_connection_callbacks,
+                [&](const auto& entry) { return entry.first == id; });
+}
+
+void mqtt_client::notify_connection(const mqtt_connection_event& event) {
+  std::unique_lock lock{_connection_mutex};
+  for (const auto& [id, callback] : _connection_callbacks) {
+    callback(event);
   }
-  return false;
 }
 
 mqtt_connected_promise mqtt_client::make_connected_promise() {
@@ -101,11 +204,8 @@ mqtt_connected_promise mqtt_client::make_connected_promise() {
 }
 
 void mqtt_client::notify_data(std::string_view topic, std::string_view data) {
-  std::unique_lock lock{_subscribe_map_mutex};
-  auto it = _subscribe_map.find(topic);
-  if (it != _subscribe_map.end()) {
-    it->second(data);
-  }
+  const auto subscriptions = _subscriptions.load();
+  subscriptions->dispatch(topic, data);
 }
 
 mqtt_connected_promise::mqtt_connected_promise(esp_mqtt_client_handle_t client)
@@ -1,16 +1,22 @@
 #pragma once
 
-#include "string_hash.hpp"
+#include "message_buffer.hpp"
+#include "subscription_table.hpp"
 
 #include "mqtt_client.h"
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 /*! The quality of service to use for publishing messages
  */
@@ -20,7 +26,20 @@ enum class mqtt_qos {
   exactly_once = 2,
 };
 
-using subscribe_callback = std::function<void(std::string_view)>;
+/*! Passed to the connection callbacks when the client connects to or
+ * disconnects from the broker
+ */
+struct mqtt_connection_event {
+  bool connected;
+
+  /*! The broker kept the session of the previous connection, including its
+   * subscriptions and undelivered messages. Only possible with
+   * session.disable_clean_session set in the config.
+   */
+  bool session_present;
+};
+
+using connection_callback = std::function<void(const mqtt_connection_event&)>;
 
 class mqtt_connected_promise {
 public:
@@ -29,6 +48,13 @@ public:
 
   void wait();
 
+  /*! Returns false if the client didn't connect in time
+   */
+  template <typename Rep, typename Period>
+  bool wait_for(std::chrono::duration<Rep, Period> timeout) {
+    return _future.wait_for(timeout) == std::future_status::ready;
+  }
+
 private:
   static void mqtt_event_handler(void* arg, esp_event_base_t eventBase,
                                  int32_t event_id, void* event_data);
@@ -53,34 +79,91 @@ public:
 
   void start();
 
+  /*! Makes the broker publish the offline payload retained on the topic if
+   * the connection is lost without a disconnect, e.g. after a brown out, and
+   * publishes the online payload retained after every connect. Must be
+   * called before start().
+   */
+  void set_availability(const char* topic, const char* online = "online",
+                        const char* offline = "offline");
+
   /*! Send a message to the broker for the given topic. Blocks
    * until the message has been sent and a response is received (
    * depending on the quality of service).
    *
    * Returns true if the message was published successfully or
    * false otherwise. The result depends on the quaility of service.
+   *
+   * See mqtt_publish_queue for publishing without blocking.
    */
   bool publish(const char* topic, std::string_view data, mqtt_qos qos,
                bool retain);
 
+  /*! Sends the topic and payload of the message buffer without copying
+   * them, see publish above.
+   */
+  bool publish(const message_buffer& message, mqtt_qos qos, bool retain) {
+    return publish(message.topic().c_str(), message.payload().view(), qos,
+                   retain);
+  }
+
+  /*! Subscribes to the topic filter, which may contain MQTT wildcards. The
+   * callback is called on the MQTT event task without holding any lock, so
+   * it may subscribe itself. While disconnected, or if subscribing fails,
+   * the filter is subscribed once the client connects. Returns false if
+   * subscribing failed while connected.
+   */
   bool subscribe(const char* topic, mqtt_qos qos, subscribe_callback callback);
 
+  /*! Returns true while the client is connected to the broker
+   */
+  bool is_connected() const { return _connected; }
+
+  /*! Calls the callback on the MQTT event task whenever the client connects
+   * or disconnects, after the subscriptions were restored. The callback must
+   * not add or remove connection callbacks. Returns an id for removing it.
+   */
+  uint32_t add_connection_callback(connection_callback callback);
+  void remove_connection_callback(uint32_t id);
+
   mqtt_connected_promise make_connected_promise();
 
 private:
   void notify_data(std::string_view topic, std::string_view data);
+  void notify_connection(const mqtt_connection_event& event);
+  /*! Subscribes all filters or only those that aren't subscribed on the
+   * broker yet
+   */
+  void resubscribe(bool pending_only);
+  void mark_subscribed(std::string_view filter);
 
   static void mqtt_event_handler(void* arg, esp_event_base_t eventBase,
                                  int32_t event_id, void* event_data);
 
   esp_mqtt_client_config_t _config;
   esp_mqtt_client_handle_t _client;
+  const char* _availability_topic{nullptr};
+  const char* _availability_online{nullptr};
   subscribe_callback _callback;
 
   std::atomic<bool> _started = false;
-
-  std::mutex _subscribe_map_mutex;
-  std::unordered_map<std::string, subscribe_callback, string_hash,
-                     std::equal_to<>>
-      _subscribe_map;
+  std::atomic<bool> _connected = false;
+
+  // Serializes modifications of the subscriptions, dispatching only loads
+  // the current table
+  std::mutex _subscribe_mutex;
+  std::atomic<std::shared_ptr<const subscription_table>> _subscriptions{
+      std::make_shared<const subscription_table>()};
+  struct filter_state {
+    mqtt_qos qos;
+
+    // Not subscribed on the broker yet, e.g. subscribed while disconnected
+    bool pending;
+  };
+  std::unordered_map<std::string, filter_state, string_hash, std::equal_to<>>
+      _filters;
+
+  std::mutex _connection_mutex;
+  std::vector<std::pair<uint32_t, connection_callback>> _connection_callbacks;
+  uint32_t _next_connection_callback_id{0};
 };
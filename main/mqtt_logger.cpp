@@ -1,24 +1,136 @@
 #include "mqtt_logger.hpp"
+#include "message_buffer.hpp"
+#include "mpmc_queue.hpp"
 
-#include "esp_log.h"
+#ifdef ESP_PLATFORM
+#include "esp_pthread.h"
+#endif
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
 #include <optional>
+#include <string_view>
+#include <thread>
 
 namespace {
 
+constexpr size_t max_line_size = 160;
+constexpr size_t ring_capacity = 32;
+constexpr size_t max_batch_capacity = 2048;
+// Escaping the batch as JSON adds at least 5 characters per line break
+constexpr size_t max_payload_capacity = 4096;
+// Home Assistant drops longer states
+constexpr size_t max_state_size = 255;
+constexpr size_t shipper_stack_size = 6144;
+
+// Set on the shipper task so that messages logged while publishing don't
+// feed back into the ring
+thread_local bool t_shipping = false;
+
+struct log_line {
+  uint8_t size;
+  std::array<char, max_line_size> text;
+};
+
+std::string_view truncate(const std::string_view text, size_t size) {
+  if (text.size() <= size) {
+    return text;
+  }
+  // Doesn't cut a multi-byte character in half
+  while (size > 0 &&
+         (static_cast<unsigned char>(text[size]) & 0xc0) == 0x80) {
+    size--;
+  }
+  return text.substr(0, size);
+}
+
+esp_log_level_t level_from_letter(char letter) {
+  switch (letter) {
+  case 'E':
+    return ESP_LOG_ERROR;
+  case 'W':
+    return ESP_LOG_WARN;
+  case 'I':
+    return ESP_LOG_INFO;
+  case 'D':
+    return ESP_LOG_DEBUG;
+  default:
+    return ESP_LOG_VERBOSE;
+  }
+}
+
+struct parsed_line {
+  esp_log_level_t level;
+  std::string_view tag;
+  std::string_view message;
+};
+
+/*! Splits a formatted line like "I (1234) tag: message" that might be
+ * wrapped in color escape sequences
+ */
+std::optional<parsed_line> parse_line(std::string_view line) {
+  if (line.starts_with("\033[")) {
+    line.remove_prefix(std::min(line.size(), line.find('m') + 1));
+  }
+  if (const auto pos = line.find("\033["); pos != std::string_view::npos) {
+    line = line.substr(0, pos);
+  }
+  while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+    line.remove_suffix(1);
+  }
+
+  const auto timestamp_end = line.find(") ");
+  const auto tag_end = line.find(": ", timestamp_end);
+  if (line.empty() || timestamp_end == std::string_view::npos ||
+      tag_end == std::string_view::npos) {
+    return std::nullopt;
+  }
+
+  return parsed_line{
+      .level = level_from_letter(line.front()),
+      .tag = line.substr(timestamp_end + 2, tag_end - timestamp_end - 2),
+      .message = line.substr(tag_end + 2),
+  };
+}
+
 struct mqtt_logger {
-  explicit mqtt_logger(mqtt_client& client) : _client{client} {}
-
-  int log(const char* str, va_list list) {
-    const auto result = vsprintf(_buffer.data(), str, list);
-    if (result > 0) {
-      const auto data = std::string_view{_buffer.data(), size_t(result)};
-      if (const auto pos = data.find(')'); pos + 2 < data.size()) {
-        _client.publish("simarine_esp/log", data.substr(pos + 2),
-                        mqtt_qos::at_least_once, false);
-      }
+  mqtt_logger(mqtt_client& client, mqtt_logger_config config)
+      : _client{client}, _config{std::move(config)} {
+    _config.max_batch_size =
+        std::clamp<size_t>(_config.max_batch_size, 1, max_batch_capacity);
+  }
+
+  void start() {
+#ifdef ESP_PLATFORM
+    auto config = esp_pthread_get_default_config();
+    config.stack_size = shipper_stack_size;
+    config.thread_name = "mqtt_logger";
+    ESP_ERROR_CHECK(esp_pthread_set_cfg(&config));
+#endif
+
+    _shipper = std::thread{[this] { ship(); }};
+
+#ifdef ESP_PLATFORM
+    config = esp_pthread_get_default_config();
+    ESP_ERROR_CHECK(esp_pthread_set_cfg(&config));
+#endif
+  }
+
+  int log(const char* format, va_list list) {
+    va_list copy;
+    va_copy(copy, list);
+    const auto result = vprintf(format, list);
+
+    if (!t_shipping) {
+      enqueue(format, copy);
     }
-    return vprintf(str, list);
+
+    va_end(copy);
+    return result;
   }
 
   void send_device_discovery() {
@@ -27,26 +139,138 @@ struct mqtt_logger {
 "dev":{"ids": "simarine_esp_log", "name": "Simarine ESP Log"},
 "o":{"name": "simarine_esp_log","sw": "0.1","url": "https://github.com/christopher-strack/esp_simarine_home_assistant"},
 "cmps": {"simarine_esp_log": {"p": "sensor","unique_id": "simarine_esp_log"}},
-"state_topic": "simarine_esp/log","qos": 1
+"state_topic": "simarine_esp/log","qos": 1,
+"value_template": "{{ value_json.state }}",
+"json_attributes_topic": "simarine_esp/log",
+"availability_topic": "simarine_esp/availability"
 }
 )";
 
     _client.publish("homeassistant/device/esp_log/config", discovery_message,
-                    mqtt_qos::at_least_once, false);
+                    mqtt_qos::at_least_once, true);
   }
 
 private:
+  void enqueue(const char* format, va_list list) {
+    std::array<char, max_line_size> formatted;
+    const auto result =
+        vsnprintf(formatted.data(), formatted.size(), format, list);
+    if (result <= 0) {
+      return;
+    }
+
+    const auto line = parse_line(std::string_view{
+        formatted.data(), std::min(size_t(result), formatted.size() - 1)});
+    if (!line || line->level > _config.level || line->message.empty() ||
+        is_excluded(line->tag)) {
+      return;
+    }
+
+    const auto pushed = _ring.try_push_with([&](log_line& slot) {
+      slot.size = uint8_t(line->message.size());
+      std::copy(line->message.begin(), line->message.end(), slot.text.begin());
+    });
+    if (!pushed) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  bool is_excluded(std::string_view tag) const {
+    return std::find(_config.excluded_tags.begin(),
+                     _config.excluded_tags.end(), tag) !=
+           _config.excluded_tags.end();
+  }
+
+  void ship() {
+    t_shipping = true;
+
+    std::optional<log_line> pending;
+    while (true) {
+      std::this_thread::sleep_for(_config.batch_interval);
+      if (!_client.is_connected()) {
+        continue;
+      }
+
+      size_t size = 0;
+      size_t last_line = 0;
+      const auto append = [&](std::string_view text) {
+        if (size > 0) {
+          _batch[size++] = '\n';
+        }
+        last_line = size;
+        std::copy(text.begin(), text.end(), _batch.begin() + size);
+        size += text.size();
+      };
+      const auto fits = [&](size_t text_size) {
+        return size + text_size + 1 <= _config.max_batch_size;
+      };
+
+      if (const auto dropped = _dropped.exchange(0); dropped > 0) {
+        std::array<char, 48> text;
+        const auto length = snprintf(text.data(), text.size(),
+                                     "%zu log messages dropped", dropped);
+        append(std::string_view{text.data(), size_t(length)});
+      }
+
+      if (pending) {
+        append(std::string_view{pending->text.data(), pending->size});
+        pending.reset();
+      }
+
+      while (!pending && _ring.try_pop_with([&](const log_line& line) {
+        if (fits(line.size)) {
+          append(std::string_view{line.text.data(), line.size});
+        } else {
+          pending = line;
+        }
+      })) {
+      }
+
+      if (size > 0) {
+        const auto batch = std::string_view{_batch.data(), size};
+        publish_batch(batch, batch.substr(last_line));
+      }
+    }
+  }
+
+  /*! The state is the last line, short enough for Home Assistant, and the
+   * whole batch is the "lines" attribute
+   */
+  void publish_batch(std::string_view batch, std::string_view last_line) {
+    const auto state = truncate(last_line, max_state_size);
+    text_writer payload{_payload};
+    payload.append(R"({"state":)")
+        .append_json_string(state)
+        .append(R"(,"lines":)")
+        .append_json_string(batch)
+        .append('}');
+    // Only lines full of escaped characters exceed the buffer
+    if (payload.overflowed()) {
+      payload.clear();
+      payload.append(R"({"state":)").append_json_string(state).append('}');
+    }
+
+    _client.publish("simarine_esp/log", payload.view(),
+                    mqtt_qos::at_least_once, false);
+  }
+
   mqtt_client& _client;
-  std::array<char, 256> _buffer;
+  mqtt_logger_config _config;
+  mpmc_queue<log_line, ring_capacity> _ring;
+  std::atomic<size_t> _dropped{0};
+  std::array<char, max_batch_capacity> _batch;
+  std::array<char, max_payload_capacity> _payload;
+  std::thread _shipper;
 };
 
-std::optional<mqtt_logger> g_logger;
+std::unique_ptr<mqtt_logger> g_logger;
 
 int mqtt_log(const char* str, va_list list) { return g_logger->log(str, list); }
 } // namespace
 
-void setup_mqtt_logger(mqtt_client& client) {
-  g_logger.emplace(client);
+void setup_mqtt_logger(mqtt_client& client, mqtt_logger_config config) {
+  g_logger = std::make_unique<mqtt_logger>(client, std::move(config));
+  g_logger->start();
   esp_log_set_vprintf(mqtt_log);
 }
 
@@ -2,8 +2,37 @@
 
 #include "mqtt_client.hpp"
 
-#include <array>
+#include "esp_log.h"
 
-void setup_mqtt_logger(mqtt_client& client);
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct mqtt_logger_config {
+  /*! Only messages of this level or more severe are sent
+   */
+  esp_log_level_t level{ESP_LOG_INFO};
+
+  /*! Messages with these tags aren't sent
+   */
+  std::vector<std::string> excluded_tags;
+
+  /*! Time between two batches of log messages. Messages logged in between
+   * are sent together.
+   */
+  std::chrono::milliseconds batch_interval{std::chrono::seconds{2}};
+
+  /*! Maximum size of a batch. Messages that don't fit are sent with the
+   * next batch. A batch is published as JSON with the last message as
+   * "state" and the batch as "lines".
+   */
+  size_t max_batch_size{1024};
+};
+
+/*! Forwards log messages to MQTT. Logging only formats the message into a
+ * lock-free ring, a background task sends the ring's content in batches.
+ * Messages are dropped if the ring is full.
+ */
+void setup_mqtt_logger(mqtt_client& client, mqtt_logger_config config = {});
 
 void send_mqtt_logger_device_discovery();
@@ -0,0 +1,224 @@
+#include "mqtt_publish_queue.hpp"
+
+#include "esp_log.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_pthread.h"
+#endif
+
+#include <algorithm>
+
+namespace {
+
+const char* TAG = "mqtt_publish_queue";
+
+// Publishing runs TLS on the sender task
+constexpr size_t sender_stack_size = 6144;
+
+} // namespace
+
+mqtt_publish_queue::prepared_message::prepared_message(
+    buffer_arena::handle slab)
+    : _slab{std::move(slab)},
+      _message{_slab.chars().first(max_topic_size),
+               _slab.chars().subspan(max_topic_size)} {}
+
+mqtt_publish_queue::mqtt_publish_queue(mqtt_client& client,
+                                       const size_t writers)
+    : _client{client}, _arena{"mqtt_publish_queue", capacity + writers,
+                              slab_size},
+      _queue{std::make_unique<spsc_queue<entry, capacity>>()} {
+  _connection_callback_id =
+      _client.add_connection_callback([this](const mqtt_connection_event&) {
+        // Taking the lock orders the state change before the wait's check
+        {
+          std::unique_lock lock{_connection_mutex};
+        }
+        _connection_changed.notify_all();
+        // Producers stop waiting for space once disconnected
+        {
+          std::unique_lock lock{_space_mutex};
+        }
+        _space_freed.notify_all();
+      });
+}
+
+mqtt_publish_queue::~mqtt_publish_queue() {
+  _client.remove_connection_callback(_connection_callback_id);
+
+  if (_running.exchange(false)) {
+    _pending.release();
+    {
+      std::unique_lock lock{_connection_mutex};
+    }
+    _connection_changed.notify_all();
+    _thread.join();
+  }
+}
+
+void mqtt_publish_queue::set_completion_callback(
+    completion_callback callback) {
+  _completion_callback = std::move(callback);
+}
+
+void mqtt_publish_queue::start() {
+#ifdef ESP_PLATFORM
+  auto config = esp_pthread_get_default_config();
+  config.stack_size = sender_stack_size;
+  config.thread_name = "mqtt_publish";
+  ESP_ERROR_CHECK(esp_pthread_set_cfg(&config));
+#endif
+
+  _running = true;
+  _thread = std::thread{[this] { run(); }};
+
+#ifdef ESP_PLATFORM
+  config = esp_pthread_get_default_config();
+  ESP_ERROR_CHECK(esp_pthread_set_cfg(&config));
+#endif
+}
+
+template <typename TryAcquire>
+auto mqtt_publish_queue::wait_for_space(TryAcquire try_acquire) {
+  auto acquired = try_acquire();
+  if (acquired || !_client.is_connected()) {
+    return acquired;
+  }
+
+  if (_watchdog) {
+    _watchdog->feed();
+  }
+  std::unique_lock lock{_space_mutex};
+  _space_freed.wait_for(lock, max_wait, [&] {
+    acquired = try_acquire();
+    return acquired || !_client.is_connected();
+  });
+  return acquired;
+}
+
+std::optional<mqtt_publish_queue::prepared_message>
+mqtt_publish_queue::prepare() {
+  auto slab = wait_for_space([this] { return _arena.acquire(); });
+  if (!slab) {
+    return std::nullopt;
+  }
+  return prepared_message{std::move(slab)};
+}
+
+std::optional<uint32_t>
+mqtt_publish_queue::publish(prepared_message message, const mqtt_qos qos,
+                            const bool retain) {
+  if (message._message.overflowed()) {
+    _dropped++;
+    ESP_LOGW(TAG, "Dropped message for %s", message._message.topic().c_str());
+    return std::nullopt;
+  }
+  const auto payload_size = message._message.payload().view().size();
+  return enqueue(std::move(message._slab), payload_size, qos, retain);
+}
+
+std::optional<uint32_t> mqtt_publish_queue::publish(const char* topic,
+                                                    std::string_view data,
+                                                    mqtt_qos qos,
+                                                    bool retain) {
+  const auto topic_size = std::string_view{topic}.size();
+  auto slab = topic_size < max_topic_size && data.size() <= max_payload_size
+                  ? wait_for_space([this] { return _arena.acquire(); })
+                  : buffer_arena::handle{};
+  if (!slab) {
+    _dropped++;
+    ESP_LOGW(TAG, "Dropped message for %s", topic);
+    return std::nullopt;
+  }
+
+  const auto storage = slab.chars();
+  std::copy_n(topic, topic_size + 1, storage.begin());
+  std::copy(data.begin(), data.end(), storage.begin() + max_topic_size);
+  return enqueue(std::move(slab), data.size(), qos, retain);
+}
+
+std::optional<uint32_t> mqtt_publish_queue::enqueue(buffer_arena::handle slab,
+                                                    const size_t payload_size,
+                                                    const mqtt_qos qos,
+                                                    const bool retain) {
+  const auto entry =
+      wait_for_space([this] { return _queue->producer_slot(); });
+  if (!entry) {
+    _dropped++;
+    ESP_LOGW(TAG, "Dropped message for %s", slab.chars().data());
+    return std::nullopt;
+  }
+
+  entry->id = _next_id++;
+  entry->qos = qos;
+  entry->retain = retain;
+  entry->payload_size = payload_size;
+  entry->slab = std::move(slab);
+
+  const auto id = entry->id;
+  _queue->push();
+  _enqueued++;
+  _pending.release();
+  return id;
+}
+
+mqtt_publish_queue::statistics mqtt_publish_queue::get_statistics() const {
+  return {
+      .enqueued = _enqueued,
+      .published = _published,
+      .failed = _failed,
+      .dropped = _dropped,
+  };
+}
+
+void mqtt_publish_queue::run() {
+  while (true) {
+    _pending.acquire();
+
+    auto entry = _queue->consumer_slot();
+    if (!entry) {
+      if (!_running) {
+        return;
+      }
+      continue;
+    }
+
+    // Publishing while disconnected would fail or reorder the messages
+    if (!wait_until_connected()) {
+      return;
+    }
+
+    const auto storage = entry->slab.chars();
+    const auto published = _client.publish(
+        storage.data(),
+        std::string_view{storage.data() + max_topic_size, entry->payload_size},
+        entry->qos, entry->retain);
+    const auto id = entry->id;
+    // Returns the slab to the arena right away instead of when the queue
+    // slot is reused
+    entry->slab.reset();
+    _queue->pop();
+    {
+      std::unique_lock lock{_space_mutex};
+    }
+    _space_freed.notify_all();
+
+    if (published) {
+      _published++;
+    } else {
+      _failed++;
+    }
+
+    if (_completion_callback) {
+      _completion_callback(id, published);
+    }
+  }
+}
+
+bool mqtt_publish_queue::wait_until_connected() {
+  std::unique_lock lock{_connection_mutex};
+  _connection_changed.wait(
+      lock, [this] { return _client.is_connected() || !_running; });
+  // Messages are still sent while stopping if possible
+  return _client.is_connected();
+}
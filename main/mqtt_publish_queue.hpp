@@ -0,0 +1,180 @@
+#pragma once
+
+#include "buffer_arena.hpp"
+#include "message_buffer.hpp"
+#include "mqtt_client.hpp"
+#include "spsc_queue.hpp"
+#include "task_watchdog.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <string_view>
+#include <thread>
+
+/*! Publishes messages from a dedicated sender task so that the publishing
+ * task doesn't block on the network.
+ *
+ * Messages live in the slabs of a buffer_arena that is allocated with the
+ * queue, so queued messages never allocate. A message can be written into
+ * its slab in place with prepare() and is then queued by handle, or copied
+ * into a slab by publish(). The slabs are passed through a bounded
+ * lock-free queue. If there is no free slab or the queue is full while the
+ * client is connected, publishing waits up to max_wait for the sender task
+ * to free one, so bursts like the discovery configs of all devices are
+ * paced instead of dropped. Otherwise the message is dropped and counted.
+ *
+ * Only a single task may publish to the queue. It may hold a prepared
+ * message per writer, see the constructor. While the client is
+ * disconnected the sender task holds the queued messages and publishes
+ * them in order once it reconnects.
+ */
+class mqtt_publish_queue {
+public:
+  static constexpr size_t capacity = 8;
+  static constexpr size_t max_topic_size = 128;
+  static constexpr size_t max_payload_size = 4096;
+  static constexpr size_t slab_size = max_topic_size + max_payload_size;
+
+  /*! How long publishing waits for a free slab or queue slot while the
+   * client is connected. Shorter than the task watchdog timeout, see
+   * set_watchdog().
+   */
+  static constexpr std::chrono::milliseconds max_wait{1000};
+
+  /*! A message written in place into a slab of the queue's arena, see
+   * prepare()
+   */
+  class prepared_message {
+  public:
+    message_buffer& message() { return _message; }
+
+  private:
+    friend class mqtt_publish_queue;
+
+    explicit prepared_message(buffer_arena::handle slab);
+
+    buffer_arena::handle _slab;
+    message_buffer _message;
+  };
+
+  /*! Called on the sender task once a message has been handed to the
+   * client, with the id returned by publish() and the publish result
+   */
+  using completion_callback =
+      std::function<void(uint32_t message_id, bool published)>;
+
+  struct statistics {
+    size_t enqueued{0};
+    size_t published{0};
+    size_t failed{0};
+    size_t dropped{0};
+  };
+
+  /*! The arena has a slab for each queue slot and one for each of the
+   * given number of writers, which may each hold a prepared message
+   */
+  mqtt_publish_queue(mqtt_client& client, size_t writers = 1);
+  mqtt_publish_queue(const mqtt_publish_queue& other) = delete;
+
+  ~mqtt_publish_queue();
+
+  mqtt_publish_queue& operator=(const mqtt_publish_queue& other) = delete;
+
+  /*! Must be set before start()
+   */
+  void set_completion_callback(completion_callback callback);
+
+  /*! The watchdog of the publishing task, fed before publishing waits for
+   * space. Publishing many messages in a row may then take longer than the
+   * watchdog timeout. May be nullptr.
+   */
+  void set_watchdog(task_watchdog* watchdog) { _watchdog = watchdog; }
+
+  void start();
+
+  /*! Returns an empty message in a free slab or std::nullopt if all slabs
+   * stay in use, see max_wait. Dropping the prepared message returns the
+   * slab.
+   */
+  std::optional<prepared_message> prepare();
+
+  /*! Queues the prepared message without copying it, see publish() below
+   */
+  std::optional<uint32_t> publish(prepared_message message, mqtt_qos qos,
+                                  bool retain);
+
+  /*! Copies the message into the queue and returns its id without waiting
+   * for it to be sent. Returns std::nullopt if the message was dropped
+   * because the queue stayed full or the message is too large.
+   */
+  std::optional<uint32_t> publish(const char* topic, std::string_view data,
+                                  mqtt_qos qos, bool retain);
+
+  std::optional<uint32_t> publish(const message_buffer& message, mqtt_qos qos,
+                                  bool retain) {
+    return publish(message.topic().c_str(), message.payload().view(), qos,
+                   retain);
+  }
+
+  /*! The id the next queued message gets. Lets the publishing task expect
+   * a completion before publishing, since it may arrive before publish()
+   * returns.
+   */
+  uint32_t next_id() const { return _next_id; }
+
+  statistics get_statistics() const;
+
+  const buffer_arena& arena() const { return _arena; }
+
+private:
+  /*! The topic is null terminated at the start of the slab, the payload
+   * starts at max_topic_size
+   */
+  struct entry {
+    uint32_t id;
+    mqtt_qos qos;
+    bool retain;
+    size_t payload_size;
+    buffer_arena::handle slab;
+  };
+
+  std::optional<uint32_t> enqueue(buffer_arena::handle slab,
+                                  size_t payload_size, mqtt_qos qos,
+                                  bool retain);
+
+  /*! Calls try_acquire until it returns a truthy value, waiting for the
+   * sender task to free space for up to max_wait while connected
+   */
+  template <typename TryAcquire> auto wait_for_space(TryAcquire try_acquire);
+
+  void run();
+  bool wait_until_connected();
+
+  mqtt_client& _client;
+  buffer_arena _arena;
+  completion_callback _completion_callback;
+  task_watchdog* _watchdog{nullptr};
+  std::unique_ptr<spsc_queue<entry, capacity>> _queue;
+  std::counting_semaphore<capacity + 1> _pending{0};
+  std::atomic<bool> _running{false};
+  std::thread _thread;
+  uint32_t _next_id{0};
+
+  uint32_t _connection_callback_id;
+  std::mutex _connection_mutex;
+  std::condition_variable _connection_changed;
+  std::mutex _space_mutex;
+  std::condition_variable _space_freed;
+
+  std::atomic<size_t> _enqueued{0};
+  std::atomic<size_t> _published{0};
+  std::atomic<size_t> _failed{0};
+  std::atomic<size_t> _dropped{0};
+};
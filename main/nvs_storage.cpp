@@ -0,0 +1,50 @@
+#include "nvs_storage.hpp"
+
+#include "esp_log.h"
+#include "nvs.h"
+
+namespace {
+
+const char* TAG = "nvs_storage";
+
+} // namespace
+
+std::optional<std::vector<uint8_t>> nvs_read_blob(const char* name_space,
+                                                  const char* key) {
+  nvs_handle_t handle;
+  if (nvs_open(name_space, NVS_READONLY, &handle) != ESP_OK) {
+    return std::nullopt;
+  }
+
+  std::optional<std::vector<uint8_t>> result;
+  size_t size = 0;
+  if (nvs_get_blob(handle, key, nullptr, &size) == ESP_OK) {
+    result.emplace(size);
+    if (nvs_get_blob(handle, key, result->data(), &size) != ESP_OK) {
+      result.reset();
+    }
+  }
+
+  nvs_close(handle);
+  return result;
+}
+
+bool nvs_write_blob(const char* name_space, const char* key,
+                    std::span<const uint8_t> data) {
+  nvs_handle_t handle;
+  auto err = nvs_open(name_space, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(handle, key, data.data(), data.size());
+    if (err == ESP_OK) {
+      err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to write %s/%s: %s", name_space, key,
+             esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
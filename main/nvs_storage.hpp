@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+/*! Reads the blob stored under the key in the NVS namespace. Returns
+ * std::nullopt if it doesn't exist or can't be read.
+ */
+std::optional<std::vector<uint8_t>> nvs_read_blob(const char* name_space,
+                                                  const char* key);
+
+/*! Stores the blob under the key in the NVS namespace and commits it
+ */
+bool nvs_write_blob(const char* name_space, const char* key,
+                    std::span<const uint8_t> data);
@@ -0,0 +1,321 @@
+#include "offline_store.hpp"
+#include "device_sensors.hpp"
+
+#include "esp_log.h"
+#include "esp_random.h"
+
+#include <algorithm>
+#include <ctime>
+#include <utility>
+
+namespace {
+
+const char* TAG = "offline_store";
+
+constexpr uint32_t sector_magic = 0x53494d52; // "SIMR"
+
+// The clock starts at the epoch until SNTP synchronized it
+constexpr uint32_t min_valid_timestamp = 1'600'000'000;
+
+uint32_t uptime_seconds() {
+  return uint32_t(std::chrono::duration_cast<std::chrono::seconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count());
+}
+
+} // namespace
+
+offline_store::offline_store(config config)
+    : _config{std::move(config)}, _boot_id{esp_random() | 1} {
+  _config.replay_batch_size =
+      std::clamp<size_t>(_config.replay_batch_size, 1, records_per_sector);
+
+  _partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+      _config.partition_label);
+  if (!_partition) {
+    ESP_LOGW(TAG, "No %s partition, keeping offline values in RAM only",
+             _config.partition_label);
+    return;
+  }
+
+  load_flash_state();
+}
+
+void offline_store::record(const std::vector<spymarine::device>& devices,
+                           uint8_t hub_index,
+                           std::span<const uint8_t> due) {
+  // Until the clock is synchronized records keep the time since boot, which
+  // is resolved when they are replayed
+  const auto now = std::time(nullptr);
+  const auto timestamp =
+      now >= min_valid_timestamp ? uint32_t(now) : uptime_seconds();
+
+  for (size_t device_index = 0; device_index < devices.size();
+       device_index++) {
+    if (!due.empty() && !due[device_index]) {
+      continue;
+    }
+
+    uint8_t sensor_index = 0;
+    for_each_sensor(devices[device_index],
+                    [&](const sensor_description&,
+                        const spymarine::sensor& sensor) {
+                      append({
+                          .timestamp = timestamp,
+                          .device_index = uint16_t(device_index),
+                          .sensor_index = sensor_index++,
+                          .hub_index = hub_index,
+                          .value = sensor.value,
+                      });
+                    });
+  }
+}
+
+void offline_store::replay(mqtt_publish_queue& queue) {
+  if (_in_flight) {
+    std::optional<bool> published;
+    {
+      const std::lock_guard lock{_completion_mutex};
+      published = std::exchange(_in_flight_published, std::nullopt);
+    }
+    if (!published) {
+      return;
+    }
+    // A batch that failed is taken again from the same records
+    if (*published) {
+      commit_batch(*_in_flight);
+    }
+    _in_flight.reset();
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (empty() || now - _last_replay < _config.replay_interval ||
+      std::time(nullptr) < min_valid_timestamp) {
+    return;
+  }
+  _last_replay = now;
+
+  batch_source source{};
+  const auto count =
+      peek_batch(std::span{_batch}.first(_config.replay_batch_size), source);
+  if (count == 0) {
+    return;
+  }
+  const auto data =
+      std::string_view{reinterpret_cast<const char*>(_batch.data()),
+                       count * sizeof(offline_record)};
+
+  {
+    const std::lock_guard lock{_completion_mutex};
+    _in_flight_id = queue.next_id();
+    _in_flight_published.reset();
+  }
+  if (!queue.publish(replay_topic, data, mqtt_qos::at_least_once, false)) {
+    ESP_LOGW(TAG, "Failed to queue %zu offline values, retrying", count);
+    return;
+  }
+  _in_flight = source;
+}
+
+void offline_store::completed(const uint32_t message_id,
+                              const bool published) {
+  const std::lock_guard lock{_completion_mutex};
+  if (message_id == _in_flight_id) {
+    _in_flight_published = published;
+  }
+}
+
+bool offline_store::empty() const {
+  return _ram_count == 0 && _used_sectors == 0;
+}
+
+void offline_store::append(const offline_record& record) {
+  if (_ram_count == _ram_records.size()) {
+    if (_partition) {
+      spill_to_flash();
+    } else {
+      _ram_first = (_ram_first + 1) % _ram_records.size();
+      _ram_count--;
+      _ram_first_serial++;
+      _dropped++;
+    }
+  }
+
+  _ram_records[(_ram_first + _ram_count) % _ram_records.size()] = record;
+  _ram_count++;
+}
+
+void offline_store::spill_to_flash() {
+  if (_used_sectors == sector_count()) {
+    ESP_LOGW(TAG, "Offline partition full, overwriting oldest values");
+    _dropped += records_per_sector - _first_sector_consumed;
+    _first_sector = (_first_sector + 1) % sector_count();
+    _first_sector_consumed = 0;
+    _used_sectors--;
+  }
+
+  const auto sector = (_first_sector + _used_sectors) % sector_count();
+  const auto offset = sector * sector_size;
+
+  const sector_header header{
+      .magic = sector_magic,
+      .sequence = _next_sequence++,
+      .count = uint16_t(_ram_count),
+      .reserved = 0,
+      .boot_id = _boot_id,
+  };
+
+  // Move the oldest record to the front so the sector is written in one go
+  std::rotate(_ram_records.begin(), _ram_records.begin() + _ram_first,
+              _ram_records.end());
+
+  auto err = esp_partition_erase_range(_partition, offset, sector_size);
+  if (err == ESP_OK) {
+    err = esp_partition_write(_partition, offset, &header, sizeof(header));
+  }
+  if (err == ESP_OK) {
+    err = esp_partition_write(_partition, offset + sizeof(header),
+                              _ram_records.data(),
+                              _ram_count * sizeof(offline_record));
+  }
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to write offline values: %s", esp_err_to_name(err));
+    _dropped += _ram_count;
+  } else {
+    _used_sectors++;
+  }
+
+  _ram_first = 0;
+  _ram_first_serial += _ram_count;
+  _ram_count = 0;
+}
+
+void offline_store::load_flash_state() {
+  size_t oldest_sector = 0;
+  uint32_t oldest_sequence = UINT32_MAX;
+
+  for (size_t sector = 0; sector < sector_count(); sector++) {
+    sector_header header{};
+    if (esp_partition_read(_partition, sector * sector_size, &header,
+                           sizeof(header)) != ESP_OK ||
+        header.magic != sector_magic) {
+      continue;
+    }
+
+    _used_sectors++;
+    _next_sequence = std::max(_next_sequence, header.sequence + 1);
+    if (header.sequence < oldest_sequence) {
+      oldest_sequence = header.sequence;
+      oldest_sector = sector;
+    }
+  }
+
+  _first_sector = oldest_sector;
+
+  ESP_LOGI(TAG, "Found %zu sectors of offline values", _used_sectors);
+}
+
+size_t offline_store::sector_count() const {
+  return _partition ? _partition->size / sector_size : 0;
+}
+
+size_t offline_store::peek_batch(std::span<offline_record> batch,
+                                 batch_source& source) {
+  if (_used_sectors > 0) {
+    const auto offset = _first_sector * sector_size;
+
+    sector_header header{};
+    auto err = esp_partition_read(_partition, offset, &header, sizeof(header));
+    const auto count = std::min<size_t>(batch.size(),
+                                        header.count - _first_sector_consumed);
+    if (err == ESP_OK) {
+      err = esp_partition_read(
+          _partition,
+          offset + sizeof(header) +
+              _first_sector_consumed * sizeof(offline_record),
+          batch.data(), count * sizeof(offline_record));
+    }
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to read offline values: %s", esp_err_to_name(err));
+      drop_first_sector();
+      return 0;
+    }
+
+    resolve_timestamps(batch.first(count), header.boot_id);
+    source = {
+        .from_flash = true,
+        .sequence = header.sequence,
+        .first = _first_sector_consumed,
+        .count = count,
+    };
+    return count;
+  }
+
+  const auto count = std::min(batch.size(), _ram_count);
+  for (size_t i = 0; i < count; i++) {
+    batch[i] = _ram_records[(_ram_first + i) % _ram_records.size()];
+  }
+  resolve_timestamps(batch.first(count), _boot_id);
+  source = {
+      .from_flash = false,
+      .sequence = 0,
+      .first = _ram_first_serial,
+      .count = count,
+  };
+  return count;
+}
+
+void offline_store::commit_batch(const batch_source& source) {
+  if (source.from_flash) {
+    sector_header header{};
+    if (_used_sectors == 0 ||
+        esp_partition_read(_partition, _first_sector * sector_size, &header,
+                           sizeof(header)) != ESP_OK ||
+        header.sequence != source.sequence ||
+        _first_sector_consumed != source.first) {
+      // The sector was overwritten while the batch was published
+      return;
+    }
+
+    _first_sector_consumed += source.count;
+    if (_first_sector_consumed >= header.count) {
+      drop_first_sector();
+    }
+    return;
+  }
+
+  // Records that were spilled to flash meanwhile are replayed from there
+  const auto end = source.first + source.count;
+  if (end <= _ram_first_serial) {
+    return;
+  }
+  const auto count = std::min(end - _ram_first_serial, _ram_count);
+  _ram_first = (_ram_first + count) % _ram_records.size();
+  _ram_count -= count;
+  _ram_first_serial += count;
+}
+
+void offline_store::drop_first_sector() {
+  // Erasing the sector keeps it from being replayed after a restart
+  esp_partition_erase_range(_partition, _first_sector * sector_size,
+                            sector_size);
+  _first_sector = (_first_sector + 1) % sector_count();
+  _first_sector_consumed = 0;
+  _used_sectors--;
+}
+
+void offline_store::resolve_timestamps(std::span<offline_record> records,
+                                       const uint32_t boot_id) const {
+  const auto now = uint32_t(std::time(nullptr));
+  const auto uptime = uptime_seconds();
+  for (auto& record : records) {
+    if (record.timestamp >= min_valid_timestamp) {
+      continue;
+    }
+    // The time since an earlier boot can't be related to the clock
+    record.timestamp =
+        boot_id == _boot_id ? now - (uptime - record.timestamp) : 0;
+  }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "mqtt_publish_queue.hpp"
+
+#include "spymarine/device.hpp"
+
+#include "esp_partition.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+
+/*! A sensor value recorded while the broker wasn't reachable. Replayed
+ * batches consist of these records in little endian byte order.
+ */
+struct offline_record {
+  /*! Unix time in seconds. Replayed records of an earlier boot that were
+   * taken before the clock was synchronized have the timestamp 0.
+   */
+  uint32_t timestamp;
+
+  /*! Index of the device in the device list, as in the aggregated state
+   * message
+   */
+  uint16_t device_index;
+
+  /*! Index of the sensor within the device, see for_each_sensor
+   */
+  uint8_t sensor_index;
+
+  /*! Index of the hub the device belongs to
+   */
+  uint8_t hub_index;
+
+  float value;
+};
+
+static_assert(sizeof(offline_record) == 12);
+
+/*! Keeps sensor values while the broker is unreachable and replays them in
+ * rate-limited batches once it's reachable again.
+ *
+ * Records are collected in RAM. Once a flash sector worth of records is
+ * collected they are written to the "offline" data partition, which is used
+ * as ring buffer of sectors. If the partition is full the oldest sector is
+ * overwritten. Without the partition only the records in RAM are kept.
+ * Records in flash survive a restart. A partially replayed sector is
+ * replayed from its start after a restart.
+ *
+ * Records are only removed once their batch was published, a batch that
+ * failed is replayed again. Records taken before SNTP synchronized the
+ * clock keep the time since boot and are held until the clock is valid.
+ */
+class offline_store {
+public:
+  struct config {
+    const char* partition_label{"offline"};
+    size_t replay_batch_size{64};
+    std::chrono::milliseconds replay_interval{std::chrono::seconds{2}};
+  };
+
+  static constexpr auto replay_topic = "simarine_esp/history";
+
+  explicit offline_store(config config);
+  offline_store(const offline_store& other) = delete;
+
+  offline_store& operator=(const offline_store& other) = delete;
+
+  /*! Records the current sensor values of all devices
+   */
+  void record(const std::vector<spymarine::device>& devices,
+              uint8_t hub_index = 0, std::span<const uint8_t> due = {});
+
+  /*! Publishes the next batch of records on replay_topic if the replay
+   * interval elapsed since the last batch and the previous batch completed
+   */
+  void replay(mqtt_publish_queue& queue);
+
+  /*! Forwards the completion callback of the publish queue, may be called
+   * from any task
+   */
+  void completed(uint32_t message_id, bool published);
+
+  bool empty() const;
+
+  /*! Number of records lost because the store was full
+   */
+  size_t dropped() const { return _dropped; }
+
+private:
+  static constexpr size_t sector_size = 4096;
+
+  struct sector_header {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t count;
+    uint16_t reserved;
+
+    /*! Tells which timestamps since boot belong to the current boot
+     */
+    uint32_t boot_id;
+  };
+
+  /*! Where the records of the published batch are taken from once it
+   * completed
+   */
+  struct batch_source {
+    bool from_flash;
+    uint32_t sequence;
+    size_t first;
+    size_t count;
+  };
+
+  static constexpr size_t records_per_sector =
+      (sector_size - sizeof(sector_header)) / sizeof(offline_record);
+
+  void append(const offline_record& record);
+  void spill_to_flash();
+  void load_flash_state();
+  size_t sector_count() const;
+  size_t peek_batch(std::span<offline_record> batch, batch_source& source);
+  void commit_batch(const batch_source& source);
+  void drop_first_sector();
+  void resolve_timestamps(std::span<offline_record> records,
+                          uint32_t boot_id) const;
+
+  config _config;
+  const esp_partition_t* _partition{nullptr};
+
+  std::array<offline_record, records_per_sector> _ram_records{};
+  size_t _ram_first{0};
+  size_t _ram_count{0};
+  // Number of records that ever left RAM, identifies the first RAM record
+  size_t _ram_first_serial{0};
+
+  size_t _first_sector{0};
+  size_t _used_sectors{0};
+  size_t _first_sector_consumed{0};
+  uint32_t _next_sequence{0};
+
+  uint32_t _boot_id;
+
+  size_t _dropped{0};
+  std::chrono::steady_clock::time_point _last_replay{};
+  std::array<offline_record, records_per_sector> _batch{};
+
+  std::optional<batch_source> _in_flight;
+  uint32_t _in_flight_id{0};
+  std::mutex _completion_mutex;
+  std::optional<bool> _in_flight_published;
+};
@@ -0,0 +1,304 @@
+#include "runtime_settings.hpp"
+#include "nvs_storage.hpp"
+
+#include "esp_log.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <utility>
+#include <variant>
+
+// Layout: the format version (u8), the window in seconds (u32, 0 if unset),
+// the device type mask (u32, 0 if unset) followed by the Wifi SSID, the
+// Wifi password and the broker URI, each as length (u8) and characters.
+
+namespace {
+
+constexpr auto TAG = "runtime_settings";
+constexpr auto settings_namespace = "settings";
+constexpr auto settings_key = "runtime";
+constexpr auto rejected_key = "rejected";
+
+// Longest window accepted from a config message, a day
+constexpr uint32_t max_window_seconds = 86'400;
+
+template <typename T> constexpr std::string_view device_type_name() {
+  return std::is_same_v<T, spymarine::pico_internal_device> ? "pico"
+         : std::is_same_v<T, spymarine::voltage_device>     ? "voltage"
+         : std::is_same_v<T, spymarine::current_device>     ? "current"
+         : std::is_same_v<T, spymarine::temperature_device> ? "temperature"
+         : std::is_same_v<T, spymarine::barometer_device>   ? "barometer"
+         : std::is_same_v<T, spymarine::resistive_device>   ? "resistive"
+         : std::is_same_v<T, spymarine::tank_device>        ? "tank"
+         : std::is_same_v<T, spymarine::battery_device>     ? "battery"
+                                                            : "";
+}
+
+// Names of the device types by their index in the spymarine::device variant
+constexpr auto device_type_names =
+    []<size_t... I>(std::index_sequence<I...>) {
+      return std::array{device_type_name<
+          std::variant_alternative_t<I, spymarine::device>>()...};
+    }(std::make_index_sequence<std::variant_size_v<spymarine::device>>{});
+
+std::optional<uint32_t> parse_device_types(std::string_view text) {
+  uint32_t mask = 0;
+  while (!text.empty()) {
+    const auto name_end = text.find(',');
+    const auto name = text.substr(0, name_end);
+    text = name_end == std::string_view::npos ? std::string_view{}
+                                              : text.substr(name_end + 1);
+
+    const auto it =
+        std::find(device_type_names.begin(), device_type_names.end(), name);
+    if (name.empty() || it == device_type_names.end()) {
+      return std::nullopt;
+    }
+    mask |= uint32_t{1} << (it - device_type_names.begin());
+  }
+  return mask;
+}
+
+bool parse_window(const std::string_view text,
+                  std::optional<std::chrono::seconds>& window) {
+  uint32_t seconds = 0;
+  const auto end = text.data() + text.size();
+  const auto result = std::from_chars(text.data(), end, seconds);
+  if (result.ec != std::errc{} || result.ptr != end || seconds == 0 ||
+      seconds > max_window_seconds) {
+    return false;
+  }
+  window = std::chrono::seconds{seconds};
+  return true;
+}
+
+bool parse_device_filter(const std::string_view text,
+                         std::optional<device_type_filter>& filter) {
+  const auto mask = parse_device_types(text);
+  if (!mask) {
+    return false;
+  }
+  filter = device_type_filter{*mask};
+  return true;
+}
+
+bool parse_string(const std::string_view text, std::string& value) {
+  if (text.size() > UINT8_MAX) {
+    return false;
+  }
+  value = text;
+  return true;
+}
+
+void write_u32(std::vector<uint8_t>& data, const uint32_t value) {
+  for (int shift = 0; shift < 32; shift += 8) {
+    data.push_back(uint8_t(value >> shift));
+  }
+}
+
+void write_string(std::vector<uint8_t>& data, const std::string_view value) {
+  data.push_back(uint8_t(value.size()));
+  data.insert(data.end(), value.begin(), value.end());
+}
+
+bool read_u32(std::span<const uint8_t>& data, uint32_t& value) {
+  if (data.size() < 4) {
+    return false;
+  }
+  value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= uint32_t(data[i]) << (8 * i);
+  }
+  data = data.subspan(4);
+  return true;
+}
+
+bool read_string(std::span<const uint8_t>& data, std::string& value) {
+  if (data.empty() || data.size() < size_t(1 + data[0])) {
+    return false;
+  }
+  value.assign(reinterpret_cast<const char*>(data.data() + 1), data[0]);
+  data = data.subspan(1 + data[0]);
+  return true;
+}
+
+// FNV-1a over the network settings, each followed by a separator
+uint32_t network_hash(const runtime_settings& settings) {
+  uint32_t hash = 2166136261u;
+  for (const auto value : {std::string_view{settings.wifi_ssid},
+                           std::string_view{settings.wifi_password},
+                           std::string_view{settings.mqtt_broker_uri}}) {
+    for (const auto c : value) {
+      hash = (hash ^ uint8_t(c)) * 16777619u;
+    }
+    hash = (hash ^ 0xffu) * 16777619u;
+  }
+  return hash;
+}
+
+void log_settings(const char* prefix, const runtime_settings& settings) {
+  ESP_LOGI(TAG, "%s: window %lds, device types 0x%lx, network %s", prefix,
+           long(settings.window ? settings.window->count() : 0),
+           static_cast<unsigned long>(
+               settings.device_types ? settings.device_types->mask : 0),
+           settings.has_network_settings() ? "overridden" : "from config");
+}
+
+} // namespace
+
+std::optional<runtime_settings> parse_settings_message(std::string_view text) {
+  runtime_settings settings;
+
+  while (!text.empty()) {
+    const auto field_end = text.find('&');
+    const auto field = text.substr(0, field_end);
+    text = field_end == std::string_view::npos ? std::string_view{}
+                                               : text.substr(field_end + 1);
+
+    const auto separator = field.find('=');
+    if (separator == std::string_view::npos) {
+      return std::nullopt;
+    }
+    const auto key = field.substr(0, separator);
+    const auto value = field.substr(separator + 1);
+    if (value.empty()) {
+      continue;
+    }
+
+    const auto parsed =
+        key == "window"          ? parse_window(value, settings.window)
+        : key == "devices"       ? parse_device_filter(value,
+                                                       settings.device_types)
+        : key == "wifi_ssid"     ? parse_string(value, settings.wifi_ssid)
+        : key == "wifi_password" ? parse_string(value, settings.wifi_password)
+        : key == "mqtt_uri"      ? parse_string(value, settings.mqtt_broker_uri)
+                                 : false;
+    if (!parsed) {
+      return std::nullopt;
+    }
+  }
+
+  return settings;
+}
+
+std::vector<uint8_t> serialize_settings(const runtime_settings& settings) {
+  std::vector<uint8_t> data;
+  data.push_back(settings_serialization_version);
+  write_u32(data, settings.window ? uint32_t(settings.window->count()) : 0);
+  write_u32(data, settings.device_types ? settings.device_types->mask : 0);
+  write_string(data, settings.wifi_ssid);
+  write_string(data, settings.wifi_password);
+  write_string(data, settings.mqtt_broker_uri);
+  return data;
+}
+
+std::optional<runtime_settings>
+deserialize_settings(std::span<const uint8_t> data) {
+  if (data.empty() || data[0] != settings_serialization_version) {
+    return std::nullopt;
+  }
+  data = data.subspan(1);
+
+  runtime_settings settings;
+  uint32_t window = 0;
+  uint32_t mask = 0;
+  if (!read_u32(data, window) || !read_u32(data, mask) ||
+      !read_string(data, settings.wifi_ssid) ||
+      !read_string(data, settings.wifi_password) ||
+      !read_string(data, settings.mqtt_broker_uri) || !data.empty()) {
+    return std::nullopt;
+  }
+  if (window > 0) {
+    settings.window = std::chrono::seconds{window};
+  }
+  if (mask > 0) {
+    settings.device_types = device_type_filter{mask};
+  }
+  return settings;
+}
+
+aggregation_config apply_settings(aggregation_config config,
+                                  const runtime_settings& settings) {
+  if (settings.window) {
+    config.defaults.window = *settings.window;
+    for (auto& aggregation : config.per_type) {
+      if (aggregation) {
+        aggregation->window = *settings.window;
+      }
+    }
+  }
+  return config;
+}
+
+settings_store::settings_store() {
+  if (const auto data = nvs_read_blob(settings_namespace, settings_key)) {
+    if (auto settings = deserialize_settings(*data)) {
+      _current = std::move(*settings);
+    }
+  }
+  if (const auto data = nvs_read_blob(settings_namespace, rejected_key)) {
+    auto rejected = std::span<const uint8_t>{*data};
+    uint32_t hash = 0;
+    if (read_u32(rejected, hash) && rejected.empty()) {
+      _rejected_network = hash;
+    }
+  }
+  log_settings("Loaded settings", _current);
+}
+
+bool settings_store::request(const std::string_view message) {
+  auto settings = parse_settings_message(message);
+  if (!settings) {
+    ESP_LOGW(TAG, "Ignoring malformed config message");
+    return false;
+  }
+
+  const std::lock_guard lock{_mutex};
+  _requested = std::move(*settings);
+  return true;
+}
+
+std::optional<runtime_settings> settings_store::take_changes() {
+  std::optional<runtime_settings> requested;
+  {
+    const std::lock_guard lock{_mutex};
+    requested = std::exchange(_requested, std::nullopt);
+  }
+  if (!requested) {
+    return std::nullopt;
+  }
+  // The retained message still holds the settings that failed to connect
+  if (requested->has_network_settings() &&
+      network_hash(*requested) == _rejected_network) {
+    ESP_LOGW(TAG, "Ignoring the network settings that failed to connect");
+    requested->wifi_ssid = _current.wifi_ssid;
+    requested->wifi_password = _current.wifi_password;
+    requested->mqtt_broker_uri = _current.mqtt_broker_uri;
+  }
+  if (*requested == _current) {
+    return std::nullopt;
+  }
+
+  _current = std::move(*requested);
+  store();
+  log_settings("Changed settings", _current);
+  return _current;
+}
+
+void settings_store::clear_network_settings() {
+  _rejected_network = network_hash(_current);
+  std::vector<uint8_t> rejected;
+  write_u32(rejected, *_rejected_network);
+  nvs_write_blob(settings_namespace, rejected_key, rejected);
+
+  _current.wifi_ssid.clear();
+  _current.wifi_password.clear();
+  _current.mqtt_broker_uri.clear();
+  store();
+}
+
+void settings_store::store() {
+  nvs_write_blob(settings_namespace, settings_key,
+                 serialize_settings(_current));
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "device_sensors.hpp"
+#include "sensor_aggregator.hpp"
+
+#include "spymarine/device.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*! Incremented whenever the binary representation changes, older data is
+ * rejected by deserialize_settings
+ */
+constexpr uint8_t settings_serialization_version = 1;
+
+/*! Reads the devices whose type is set in the mask, a bit per index in the
+ * spymarine::device variant. Can be passed to spymarine::read_devices.
+ */
+struct device_type_filter {
+  uint32_t mask;
+
+  bool operator()(const spymarine::device& device) const {
+    return (mask >> device.index()) & 1;
+  }
+
+  bool operator==(const device_type_filter& other) const = default;
+};
+
+template <typename... T> constexpr device_type_filter filter_device_types() {
+  return {((uint32_t{1} << device_type_index<T>()) | ...)};
+}
+
+/*! Settings that can be changed at runtime and override the values of
+ * config.hpp. Unset values use config.hpp.
+ */
+struct runtime_settings {
+  /*! Replaces the window of every device type of make_aggregation_config(),
+   * the reductions are kept
+   */
+  std::optional<std::chrono::seconds> window;
+
+  /*! Replaces make_device_filter()
+   */
+  std::optional<device_type_filter> device_types;
+
+  /*! Network settings only take effect after a restart. If the ESP32 can't
+   * connect with them it drops them and restarts with config.hpp.
+   */
+  std::string wifi_ssid;
+  std::string wifi_password;
+  std::string mqtt_broker_uri;
+
+  bool has_network_settings() const {
+    return !wifi_ssid.empty() || !mqtt_broker_uri.empty();
+  }
+
+  bool operator==(const runtime_settings& other) const = default;
+};
+
+/*! Parses a config message of the form
+ * "window=30&devices=battery,tank&wifi_ssid=boat". The message describes
+ * all settings, fields that are missing or empty use config.hpp. Returns
+ * std::nullopt if the message is malformed.
+ */
+std::optional<runtime_settings> parse_settings_message(std::string_view text);
+
+std::vector<uint8_t> serialize_settings(const runtime_settings& settings);
+
+/*! Restores settings serialized with serialize_settings. Returns
+ * std::nullopt if the data is malformed or was written in an older format.
+ */
+std::optional<runtime_settings>
+deserialize_settings(std::span<const uint8_t> data);
+
+/*! Applies the window of the settings to the aggregation of config.hpp
+ */
+aggregation_config apply_settings(aggregation_config config,
+                                  const runtime_settings& settings);
+
+/*! Keeps the runtime settings in NVS and takes changes from the retained
+ * config topic. Changes are requested on the MQTT task and taken and
+ * applied by the publisher on the main task.
+ */
+class settings_store {
+public:
+  static constexpr auto config_topic = "simarine_esp/config";
+
+  /*! Loads the settings stored in NVS
+   */
+  settings_store();
+  settings_store(const settings_store& other) = delete;
+
+  settings_store& operator=(const settings_store& other) = delete;
+
+  const runtime_settings& current() const { return _current; }
+
+  /*! Parses a message of the config topic, may be called from any task.
+   * Returns false if it's malformed.
+   */
+  bool request(std::string_view message);
+
+  /*! Stores the requested settings in NVS and returns them if they differ
+   * from the current settings
+   */
+  std::optional<runtime_settings> take_changes();
+
+  /*! Drops the network settings, e.g. after connecting with them failed.
+   * They are remembered and ignored by take_changes, so the retained config
+   * message doesn't bring them back.
+   */
+  void clear_network_settings();
+
+private:
+  void store();
+
+  runtime_settings _current;
+  std::mutex _mutex;
+  std::optional<runtime_settings> _requested;
+
+  // Hash of the network settings dropped by clear_network_settings
+  std::optional<uint32_t> _rejected_network;
+};
@@ -0,0 +1,114 @@
+#include "sensor_aggregator.hpp"
+
+#include <algorithm>
+
+sensor_aggregator::sensor_aggregator(
+    aggregation_config config,
+    const std::vector<spymarine::device>& raw_devices,
+    const clock::time_point now)
+    : _raw_devices{raw_devices}, _devices{raw_devices},
+      _completed(raw_devices.size(), 0) {
+  size_t sensor_count = 0;
+  _device_states.reserve(raw_devices.size());
+  for (const auto& device : raw_devices) {
+    const auto& device_config = config.get(device);
+    _device_states.push_back({
+        .config = device_config,
+        .window_end = now + device_config.window,
+        .first_sensor = sensor_count,
+    });
+    for_each_sensor(device, [&](const sensor_description&,
+                                const spymarine::sensor&) { sensor_count++; });
+  }
+  _sensor_states.resize(sensor_count);
+}
+
+bool sensor_aggregator::update(const clock::time_point now) {
+  bool any_completed = false;
+
+  for (size_t index = 0; index < _raw_devices.size(); index++) {
+    auto& device_state = _device_states[index];
+    const auto& config = device_state.config;
+    auto state = _sensor_states.begin() + device_state.first_sensor;
+
+    for_each_sensor(_raw_devices[index],
+                    [&](const sensor_description&,
+                        const spymarine::sensor& sensor) {
+                      add_sample(*state++, config, sensor.value);
+                    });
+
+    const auto completed = now >= device_state.window_end;
+    _completed[index] = completed;
+    if (!completed) {
+      continue;
+    }
+    any_completed = true;
+
+    state = _sensor_states.begin() + device_state.first_sensor;
+    for_each_sensor(
+        _devices[index],
+        [&](const sensor_description&, spymarine::sensor& sensor) {
+          if (state->count > 0) {
+            sensor.value = reduce(*state, config);
+          }
+          state++;
+        });
+
+    // Keeps windows aligned unless updates stalled for a whole window
+    device_state.window_end += config.window;
+    if (device_state.window_end <= now) {
+      device_state.window_end = now + config.window;
+    }
+  }
+
+  return any_completed;
+}
+
+void sensor_aggregator::reconfigure(const aggregation_config& config,
+                                    const clock::time_point now) {
+  for (size_t index = 0; index < _raw_devices.size(); index++) {
+    auto& device_state = _device_states[index];
+    device_state.config = config.get(_raw_devices[index]);
+    device_state.window_end = now + device_state.config.window;
+  }
+}
+
+void sensor_aggregator::add_sample(sensor_state& state,
+                                   const aggregation& config,
+                                   const float sample) const {
+  const auto first = state.count == 0;
+  state.count++;
+
+  switch (config.reduction) {
+  case sensor_reduction::mean:
+    state.value = first ? sample : state.value + sample;
+    break;
+  case sensor_reduction::minimum:
+    state.value = first ? sample : std::min(state.value, sample);
+    break;
+  case sensor_reduction::maximum:
+    state.value = first ? sample : std::max(state.value, sample);
+    break;
+  case sensor_reduction::ema:
+    state.value = first ? sample
+                        : config.ema_alpha * sample +
+                              (1.0f - config.ema_alpha) * state.value;
+    break;
+  case sensor_reduction::last:
+    state.value = sample;
+    break;
+  }
+}
+
+float sensor_aggregator::reduce(sensor_state& state,
+                                const aggregation& config) const {
+  const auto value = config.reduction == sensor_reduction::mean && state.count
+                         ? state.value / float(state.count)
+                         : state.value;
+
+  // The moving average carries over into the next window
+  if (config.reduction != sensor_reduction::ema) {
+    state.count = 0;
+  }
+  return value;
+}
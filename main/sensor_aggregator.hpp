@@ -0,0 +1,120 @@
+#pragma once
+
+#include "device_sensors.hpp"
+
+#include "spymarine/device.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <variant>
+#include <vector>
+
+/*! How the samples of a window are reduced to the published value
+ */
+enum class sensor_reduction {
+  /*! Average of the samples in the window
+   */
+  mean,
+
+  minimum,
+
+  maximum,
+
+  /*! Exponential moving average, continues across windows
+   */
+  ema,
+
+  /*! The most recent sample
+   */
+  last,
+};
+
+struct aggregation {
+  std::chrono::milliseconds window{std::chrono::minutes{1}};
+  sensor_reduction reduction{sensor_reduction::mean};
+
+  /*! Weight of a new sample for sensor_reduction::ema
+   */
+  float ema_alpha{0.2f};
+};
+
+struct aggregation_config {
+  /*! Used for device types without an aggregation of their own
+   */
+  aggregation defaults;
+
+  std::array<std::optional<aggregation>, std::variant_size_v<spymarine::device>>
+      per_type{};
+
+  /*! Sets the aggregation for all sensors of the given device type
+   */
+  template <typename T> void set_aggregation(aggregation value) {
+    per_type[device_type_index<T>()] = value;
+  }
+
+  const aggregation& get(const spymarine::device& device) const {
+    const auto& value = per_type[device.index()];
+    return value ? *value : defaults;
+  }
+};
+
+/*! Reduces the raw samples of every sensor over a window that depends on
+ * the device type. Keeps a fixed amount of state per sensor regardless of
+ * the window length and doesn't allocate after construction.
+ */
+class sensor_aggregator {
+public:
+  using clock = std::chrono::steady_clock;
+
+  /*! The raw devices are updated by a sensor reader and need to outlive the
+   * aggregator
+   */
+  sensor_aggregator(aggregation_config config,
+                    const std::vector<spymarine::device>& raw_devices,
+                    clock::time_point now = clock::now());
+
+  /*! Adds the current values of the raw devices as samples. Returns true if
+   * the window of at least one device completed, see completed().
+   */
+  bool update(clock::time_point now = clock::now());
+
+  /*! Switches to the aggregation of the config. The windows of all devices
+   * restart at the given time, the samples of the current windows are kept.
+   */
+  void reconfigure(const aggregation_config& config,
+                   clock::time_point now = clock::now());
+
+  /*! The devices with the reduced values of their last completed window
+   */
+  const std::vector<spymarine::device>& devices() const { return _devices; }
+
+  /*! Flags per device whether its window completed in the last update
+   */
+  std::span<const uint8_t> completed() const { return _completed; }
+
+private:
+  struct sensor_state {
+    float value{0.0f};
+    uint32_t count{0};
+  };
+
+  struct device_state {
+    aggregation config;
+    clock::time_point window_end;
+    size_t first_sensor;
+  };
+
+  void add_sample(sensor_state& state, const aggregation& config,
+                  float sample) const;
+  float reduce(sensor_state& state, const aggregation& config) const;
+
+  const std::vector<spymarine::device>& _raw_devices;
+  std::vector<spymarine::device> _devices;
+  std::vector<device_state> _device_states;
+  std::vector<sensor_state> _sensor_states;
+  std::vector<uint8_t> _completed;
+};
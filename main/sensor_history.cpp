@@ -0,0 +1,335 @@
+#include "sensor_history.hpp"
+#include "device_sensors.hpp"
+
+#include "esp_log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <limits>
+
+namespace {
+
+constexpr auto TAG = "sensor_history";
+
+// The clock starts at the epoch until SNTP synchronized it
+constexpr uint32_t min_valid_timestamp = 1'600'000'000;
+
+constexpr auto nan = std::numeric_limits<float>::quiet_NaN();
+constexpr auto infinity = std::numeric_limits<float>::infinity();
+constexpr history_bucket empty_bucket{nan, nan, nan};
+
+template <typename T>
+bool parse_number(const std::string_view text, T& value) {
+  uint32_t parsed = 0;
+  const auto end = text.data() + text.size();
+  const auto result = std::from_chars(text.data(), end, parsed);
+  if (result.ec != std::errc{} || result.ptr != end ||
+      parsed > std::numeric_limits<T>::max()) {
+    return false;
+  }
+  value = T(parsed);
+  return true;
+}
+
+bool parse_id(const std::string_view text, std::array<char, 17>& id) {
+  if (text.empty() || text.size() >= id.size() ||
+      !std::all_of(text.begin(), text.end(), [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+               c == '-';
+      })) {
+    return false;
+  }
+  id.fill('\0');
+  std::copy(text.begin(), text.end(), id.begin());
+  return true;
+}
+
+template <typename T> std::string_view as_bytes(const T& value) {
+  return {reinterpret_cast<const char*>(&value), sizeof(value)};
+}
+
+} // namespace
+
+std::optional<history_query> parse_history_query(std::string_view text) {
+  history_query query;
+
+  while (!text.empty()) {
+    const auto field_end = text.find('&');
+    const auto field = text.substr(0, field_end);
+    text = field_end == std::string_view::npos ? std::string_view{}
+                                               : text.substr(field_end + 1);
+
+    const auto separator = field.find('=');
+    if (separator == std::string_view::npos) {
+      return std::nullopt;
+    }
+    const auto key = field.substr(0, separator);
+    const auto value = field.substr(separator + 1);
+
+    const auto parsed =
+        key == "hub"          ? parse_number(value, query.hub_index)
+        : key == "device"     ? parse_number(value, query.device_index)
+        : key == "sensor"     ? parse_number(value, query.sensor_index)
+        : key == "resolution" ? parse_number(value, query.resolution)
+        : key == "from"       ? parse_number(value, query.from)
+        : key == "to"         ? parse_number(value, query.to)
+        : key == "id"         ? parse_id(value, query.id)
+                              : false;
+    if (!parsed) {
+      return std::nullopt;
+    }
+  }
+
+  return query;
+}
+
+void sensor_history::accumulator::add(const accumulator& other) {
+  if (other.count == 0) {
+    return;
+  }
+  minimum = std::min(minimum, other.minimum);
+  maximum = std::max(maximum, other.maximum);
+  sum += other.sum;
+  count += other.count;
+}
+
+history_bucket sensor_history::accumulator::bucket() const {
+  if (count == 0) {
+    return empty_bucket;
+  }
+  return {minimum, maximum, sum / float(count)};
+}
+
+sensor_history::sensor_history(history_config config)
+    : _config{config},
+      _queries{std::make_unique<
+          spsc_queue<history_query, max_pending_queries>>()} {
+  for (size_t index = 0; index < level_count; index++) {
+    const auto& resolution = _config.resolutions[index];
+    _levels[index].bucket_seconds =
+        uint32_t(std::max<int64_t>(resolution.bucket_duration.count(), 1));
+    _levels[index].bucket_count = std::max<size_t>(resolution.bucket_count, 1);
+  }
+}
+
+void sensor_history::set_hubs(std::span<const cached_devices> hubs) {
+  std::vector<std::vector<uint32_t>> device_slots;
+  uint32_t sensor_count = 0;
+  for (const auto& hub : hubs) {
+    auto& slots = device_slots.emplace_back();
+    for (const auto& device : hub.devices) {
+      slots.push_back(sensor_count);
+      for_each_sensor(device, [&](const sensor_description&,
+                                  const spymarine::sensor&) {
+        sensor_count++;
+      });
+    }
+    slots.push_back(sensor_count);
+  }
+
+  if (device_slots == _device_slots) {
+    return;
+  }
+
+  _device_slots = std::move(device_slots);
+  _sensor_count = sensor_count;
+  for (auto& level : _levels) {
+    level.current = 0;
+    level.next_slot = 0;
+    level.size = 0;
+    level.buckets.assign(_sensor_count * level.bucket_count, empty_bucket);
+    level.open.assign(_sensor_count, {infinity, -infinity, 0.0f, 0});
+  }
+
+  ESP_LOGI(TAG, "Keeping the history of %zu sensors in %zu bytes",
+           _sensor_count, memory_size());
+}
+
+void sensor_history::record(const size_t hub_index,
+                            const std::vector<spymarine::device>& devices,
+                            std::span<const uint8_t> due,
+                            const uint32_t timestamp) {
+  if (timestamp < min_valid_timestamp || hub_index >= _device_slots.size()) {
+    return;
+  }
+
+  advance(timestamp);
+
+  const auto& slots = _device_slots[hub_index];
+  auto& open = _levels.front().open;
+  const auto device_count = std::min(devices.size(), slots.size() - 1);
+  for (size_t device_index = 0; device_index < device_count;
+       device_index++) {
+    if (!due.empty() && !due[device_index]) {
+      continue;
+    }
+
+    auto slot = slots[device_index];
+    for_each_sensor(devices[device_index],
+                    [&](const sensor_description&,
+                        const spymarine::sensor& sensor) {
+                      if (slot < slots[device_index + 1]) {
+                        open[slot].add({sensor.value, sensor.value,
+                                        sensor.value, 1});
+                      }
+                      slot++;
+                    });
+  }
+}
+
+bool sensor_history::request(const std::string_view query) {
+  const auto parsed = parse_history_query(query);
+  if (!parsed) {
+    ESP_LOGW(TAG, "Ignoring malformed history query %.*s", int(query.size()),
+             query.data());
+    return false;
+  }
+  if (!_queries->try_push(*parsed)) {
+    ESP_LOGW(TAG, "Too many pending history queries, dropped %s",
+             parsed->id.data());
+    return false;
+  }
+  return true;
+}
+
+void sensor_history::answer_queries(mqtt_publish_queue& queue) {
+  while (const auto query = _queries->try_pop()) {
+    answer(*query, queue);
+  }
+}
+
+size_t sensor_history::memory_size() const {
+  size_t size = 0;
+  for (const auto& level : _levels) {
+    size += level.buckets.size() * sizeof(history_bucket) +
+            level.open.size() * sizeof(accumulator);
+  }
+  return size;
+}
+
+void sensor_history::advance(const uint32_t timestamp) {
+  // Finer levels are closed first so their last bucket is rolled up into
+  // the coarser level's bucket it belongs to
+  for (size_t index = 0; index < level_count; index++) {
+    auto& level = _levels[index];
+    const auto bucket = timestamp / level.bucket_seconds;
+    if (level.current == 0) {
+      level.current = bucket;
+      continue;
+    }
+    if (bucket <= level.current) {
+      continue;
+    }
+
+    close_bucket(index);
+    push_empty_buckets(level, std::min<size_t>(bucket - level.current - 1,
+                                               level.bucket_count));
+    level.current = bucket;
+  }
+}
+
+void sensor_history::close_bucket(const size_t level_index) {
+  auto& level = _levels[level_index];
+  for (size_t sensor = 0; sensor < _sensor_count; sensor++) {
+    auto& open = level.open[sensor];
+    level.buckets[sensor * level.bucket_count + level.next_slot] =
+        open.bucket();
+    if (level_index + 1 < level_count) {
+      _levels[level_index + 1].open[sensor].add(open);
+    }
+    open = {infinity, -infinity, 0.0f, 0};
+  }
+  level.next_slot = (level.next_slot + 1) % level.bucket_count;
+  level.size = std::min(level.size + 1, level.bucket_count);
+}
+
+void sensor_history::push_empty_buckets(level& level, const size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    for (size_t sensor = 0; sensor < _sensor_count; sensor++) {
+      level.buckets[sensor * level.bucket_count + level.next_slot] =
+          empty_bucket;
+    }
+    level.next_slot = (level.next_slot + 1) % level.bucket_count;
+    level.size = std::min(level.size + 1, level.bucket_count);
+  }
+}
+
+std::optional<size_t>
+sensor_history::sensor_slot(const history_query& query) const {
+  if (query.hub_index >= _device_slots.size()) {
+    return std::nullopt;
+  }
+  const auto& slots = _device_slots[query.hub_index];
+  if (size_t(query.device_index) + 1 >= slots.size()) {
+    return std::nullopt;
+  }
+  const auto slot = slots[query.device_index] + query.sensor_index;
+  if (slot >= slots[query.device_index + 1]) {
+    return std::nullopt;
+  }
+  return slot;
+}
+
+void sensor_history::answer(const history_query& query,
+                            mqtt_publish_queue& queue) {
+  // The finest level that is at least as coarse as requested
+  const auto found =
+      std::find_if(_levels.begin(), _levels.end(), [&](const auto& level) {
+        return level.bucket_seconds >= query.resolution;
+      });
+  const auto& level = found != _levels.end() ? *found : _levels.back();
+
+  auto prepared = queue.prepare();
+  if (!prepared) {
+    ESP_LOGW(TAG, "No message buffer for history query %s", query.id.data());
+    return;
+  }
+  auto& message = prepared->message();
+  message.topic().append(response_topic_prefix).append(query.id.data());
+
+  history_response_header header{
+      .start = 0,
+      .resolution = level.bucket_seconds,
+      .bucket_count = 0,
+      .device_index = query.device_index,
+      .sensor_index = query.sensor_index,
+      .hub_index = query.hub_index,
+      .reserved = 0,
+  };
+
+  // Unknown sensors and empty ranges are answered without buckets, so the
+  // requester doesn't wait for a response
+  const auto slot = sensor_slot(query);
+  uint32_t first = 0;
+  uint32_t last = 0;
+  if (slot && level.size > 0) {
+    const auto oldest = uint32_t(level.current - level.size);
+    first = std::max(oldest, query.from / level.bucket_seconds);
+    last = std::min(level.current - 1, query.to / level.bucket_seconds);
+    if (first <= last) {
+      // One byte is left for the text writer's terminator
+      constexpr auto max_buckets =
+          (mqtt_publish_queue::max_payload_size - 1 -
+           sizeof(history_response_header)) /
+          sizeof(history_bucket);
+      header.bucket_count =
+          uint16_t(std::min<size_t>(last - first + 1, max_buckets));
+      header.start = first * level.bucket_seconds;
+    }
+  }
+
+  auto& payload = message.payload();
+  payload.append(as_bytes(header));
+  for (uint32_t bucket = first; bucket < first + header.bucket_count;
+       bucket++) {
+    const auto age = level.current - bucket;
+    const auto index =
+        (level.next_slot + level.bucket_count - age) % level.bucket_count;
+    payload.append(as_bytes(level.buckets[*slot * level.bucket_count + index]));
+  }
+
+  if (!queue.publish(std::move(*prepared), mqtt_qos::at_most_once, false)) {
+    ESP_LOGW(TAG, "Failed to answer history query %s", query.id.data());
+  }
+}
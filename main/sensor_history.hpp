@@ -0,0 +1,202 @@
+#pragma once
+
+#include "device_cache.hpp"
+#include "mqtt_publish_queue.hpp"
+#include "spsc_queue.hpp"
+
+#include "spymarine/device.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/*! How long and how finely sensor values are kept at one resolution
+ */
+struct history_resolution {
+  std::chrono::seconds bucket_duration;
+
+  /*! Closed buckets kept per sensor, each takes sizeof(history_bucket)
+   */
+  size_t bucket_count;
+};
+
+struct history_config {
+  /*! From fine to coarse, each duration must be a multiple of the previous
+   * one since coarse buckets are rolled up from the fine ones
+   */
+  std::array<history_resolution, 3> resolutions{{
+      {std::chrono::minutes{1}, 60},
+      {std::chrono::minutes{15}, 48},
+      {std::chrono::hours{1}, 72},
+  }};
+};
+
+/*! The values of a sensor within a bucket. All values are NaN if there were
+ * none. Responses consist of these in little endian byte order.
+ */
+struct history_bucket {
+  float minimum;
+  float maximum;
+  float mean;
+};
+
+static_assert(sizeof(history_bucket) == 12);
+
+/*! Precedes the buckets of a query response
+ */
+struct history_response_header {
+  /*! Unix time in seconds of the start of the first bucket
+   */
+  uint32_t start;
+
+  /*! Bucket duration in seconds
+   */
+  uint32_t resolution;
+
+  uint16_t bucket_count;
+  uint16_t device_index;
+  uint8_t sensor_index;
+  uint8_t hub_index;
+  uint16_t reserved;
+};
+
+static_assert(sizeof(history_response_header) == 16);
+
+/*! A range of buckets of a single sensor
+ */
+struct history_query {
+  uint8_t hub_index{0};
+  uint16_t device_index{0};
+  uint8_t sensor_index{0};
+  uint32_t resolution{60};
+
+  /*! Unix times in seconds, the buckets overlapping [from, to] are returned
+   */
+  uint32_t from{0};
+  uint32_t to{UINT32_MAX};
+
+  /*! Identifies the response topic, see response_topic_prefix
+   */
+  std::array<char, 17> id{'0'};
+};
+
+/*! Parses a query of the form
+ * "hub=0&device=3&sensor=0&resolution=900&from=1700000000&to=1700086400&id=a"
+ * where every field is optional. Returns std::nullopt if it's malformed.
+ */
+std::optional<history_query> parse_history_query(std::string_view text);
+
+/*! Keeps the recent history of every sensor on the device with a min, max
+ * and mean rollup per bucket at several resolutions, fed by the aggregated
+ * values of completed windows.
+ *
+ * Each resolution is a circular buffer of buckets per sensor allocated when
+ * the hubs are set, so recording never allocates. Finished buckets of a
+ * resolution are rolled up into the next coarser one. Buckets are aligned to
+ * the wall clock and only closed buckets are kept, so values are recorded
+ * once the time is synchronized.
+ *
+ * Queries received on query_topic are answered on response_topic_prefix
+ * followed by the query's id with a history_response_header and the buckets
+ * of a single sensor in the requested range, so answering costs time in
+ * proportion to the range and at most one message buffer of memory. Ranges
+ * that don't fit a single message are cut off at the end and can be
+ * requested in pages.
+ */
+class sensor_history {
+public:
+  static constexpr auto query_topic = "simarine_esp/history/query";
+
+  /*! Followed by the id of the query
+   */
+  static constexpr auto response_topic_prefix =
+      "simarine_esp/history/response/";
+
+  static constexpr size_t max_pending_queries = 4;
+
+  explicit sensor_history(history_config config);
+  sensor_history(const sensor_history& other) = delete;
+
+  sensor_history& operator=(const sensor_history& other) = delete;
+
+  /*! Allocates the buffers for the sensors of the hubs. The history is kept
+   * if the hubs didn't change.
+   */
+  void set_hubs(std::span<const cached_devices> hubs);
+
+  /*! Records the values of the devices flagged in due, all if it's empty.
+   * Closes the buckets that ended before timestamp.
+   */
+  void record(size_t hub_index, const std::vector<spymarine::device>& devices,
+              std::span<const uint8_t> due, uint32_t timestamp);
+
+  /*! Queues a query to be answered by answer_queries(). May be called from a
+   * single other task, e.g. the MQTT client's. Returns false if the query is
+   * malformed or too many queries are pending.
+   */
+  bool request(std::string_view query);
+
+  void answer_queries(mqtt_publish_queue& queue);
+
+  /*! The memory of all buckets in bytes
+   */
+  size_t memory_size() const;
+
+private:
+  static constexpr size_t level_count =
+      std::tuple_size_v<decltype(history_config::resolutions)>;
+
+  struct accumulator {
+    float minimum;
+    float maximum;
+    float sum;
+    uint32_t count;
+
+    void add(const accumulator& other);
+    history_bucket bucket() const;
+  };
+
+  struct level {
+    uint32_t bucket_seconds;
+    size_t bucket_count;
+
+    /*! Number of the open bucket since the epoch, 0 until the first record
+     */
+    uint32_t current{0};
+
+    /*! Slot the next closed bucket is written to
+     */
+    size_t next_slot{0};
+
+    /*! Number of closed buckets, which are the ones before current
+     */
+    size_t size{0};
+
+    /*! bucket_count buckets per sensor
+     */
+    std::vector<history_bucket> buckets;
+    std::vector<accumulator> open;
+  };
+
+  void advance(uint32_t timestamp);
+  void close_bucket(size_t level_index);
+  void push_empty_buckets(level& level, size_t count);
+  std::optional<size_t> sensor_slot(const history_query& query) const;
+  void answer(const history_query& query, mqtt_publish_queue& queue);
+
+  history_config _config;
+  std::array<level, level_count> _levels;
+
+  /*! First sensor slot of each device per hub followed by the end of the
+   * hub's slots
+   */
+  std::vector<std::vector<uint32_t>> _device_slots;
+  size_t _sensor_count{0};
+
+  std::unique_ptr<spsc_queue<history_query, max_pending_queries>> _queries;
+};
@@ -0,0 +1,232 @@
+#include "sensor_pipeline.hpp"
+#include "metrics.hpp"
+#include "task_watchdog.hpp"
+
+#include "esp_log.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_pthread.h"
+#include "freertos/FreeRTOS.h"
+#endif
+
+#include <algorithm>
+
+namespace {
+
+constexpr auto TAG = "sensor_pipeline";
+
+constexpr size_t ingest_stack_size = 4096;
+constexpr size_t aggregation_stack_size = 6144;
+
+// Lets the aggregation task feed the watchdog while no datagrams arrive
+constexpr auto aggregation_wait = std::chrono::milliseconds{500};
+
+histogram g_read_duration{"read_and_update", "μs"};
+counter g_read_failures{"read_failures"};
+counter g_ingest_dropped{"ingest_dropped"};
+counter g_snapshots_dropped{"snapshots_dropped"};
+gauge g_datagram_slabs_peak{"datagram_slabs_peak"};
+counter g_alert_events{"alert_events"};
+counter g_alerts_dropped{"alerts_dropped"};
+
+template <typename Function>
+std::thread start_pinned_thread(const char* name, size_t stack_size,
+                                int priority, int core, Function function) {
+#ifdef ESP_PLATFORM
+  auto config = esp_pthread_get_default_config();
+  config.stack_size = stack_size;
+  config.thread_name = name;
+  config.prio = priority;
+  config.pin_to_core = std::min(core, portNUM_PROCESSORS - 1);
+  ESP_ERROR_CHECK(esp_pthread_set_cfg(&config));
+#endif
+
+  auto thread = std::thread{std::move(function)};
+
+#ifdef ESP_PLATFORM
+  config = esp_pthread_get_default_config();
+  ESP_ERROR_CHECK(esp_pthread_set_cfg(&config));
+#endif
+
+  return thread;
+}
+
+} // namespace
+
+sensor_pipeline::sensor_pipeline(hub_demultiplexer& demultiplexer,
+                                 sensor_pipeline_config config,
+                                 alert_engine* alerts)
+    : _demultiplexer{demultiplexer}, _config{config},
+      _datagram_arena{"sensor_pipeline", datagram_slabs,
+                      sizeof(spymarine::buffer)},
+      _alerts{alerts},
+      _datagrams{std::make_unique<spsc_queue<datagram, datagram_capacity>>()},
+      _snapshots{std::make_unique<
+          spsc_queue<sensor_snapshot, snapshot_capacity>>()},
+      _alert_events{
+          std::make_unique<spsc_queue<alert_event, alert_capacity>>()} {}
+
+sensor_pipeline::~sensor_pipeline() {
+  if (_running.exchange(false)) {
+    // The ingest task returns with the next receive timeout
+    _datagrams_pending.release();
+    _ingest_thread.join();
+    _aggregation_thread.join();
+  }
+}
+
+void sensor_pipeline::start() {
+  _demultiplexer.set_receive_timeout(_config.receive_timeout);
+  _running = true;
+
+  _ingest_thread = start_pinned_thread(
+      "sensor_ingest", ingest_stack_size, _config.ingest_priority,
+      _config.core, [this] { run_ingest(); });
+  _aggregation_thread = start_pinned_thread(
+      "sensor_aggregate", aggregation_stack_size,
+      _config.aggregation_priority, _config.core,
+      [this] { run_aggregation(); });
+}
+
+const sensor_snapshot*
+sensor_pipeline::wait_for_snapshot(const std::chrono::milliseconds timeout) {
+  std::unique_lock lock{_publisher_mutex};
+  _publisher_wakeup.wait_for(lock, timeout, [this] {
+    return _snapshots->consumer_slot() || _alert_events->consumer_slot();
+  });
+  return _snapshots->consumer_slot();
+}
+
+void sensor_pipeline::wake_publisher() {
+  // Taking the lock orders the push before the wait's check
+  {
+    std::unique_lock lock{_publisher_mutex};
+  }
+  _publisher_wakeup.notify_one();
+}
+
+void sensor_pipeline::release_snapshot() { _snapshots->pop(); }
+
+std::optional<alert_event> sensor_pipeline::take_alert() {
+  return _alert_events->try_pop();
+}
+
+void sensor_pipeline::set_aggregation(aggregation_config config) {
+  const std::lock_guard lock{_aggregation_mutex};
+  _pending_aggregation = std::move(config);
+  _aggregation_pending = true;
+}
+
+void sensor_pipeline::run_ingest() {
+  task_watchdog watchdog;
+  buffer_arena::handle slab;
+
+  while (_running) {
+    watchdog.feed();
+
+    if (!slab) {
+      slab = _datagram_arena.acquire();
+      g_datagram_slabs_peak.set(int32_t(_datagram_arena.peak_in_use()));
+    }
+    auto slot = _datagrams->producer_slot();
+    if (!slot || !slab) {
+      // Still drain the socket, the aggregation task catches up with newer
+      // datagrams
+      if (const auto result = _demultiplexer.receive(_discarded);
+          result && *result) {
+        g_ingest_dropped.increment();
+      }
+      continue;
+    }
+
+    const auto result = _demultiplexer.receive(slab.bytes());
+    if (!result) {
+      g_read_failures.increment();
+      ESP_LOGE(TAG, "Failed to receive sensor values: %s",
+               spymarine::error_message(result.error()).c_str());
+      std::this_thread::sleep_for(std::chrono::milliseconds{100});
+      continue;
+    }
+    if (!*result) {
+      continue;
+    }
+
+    slot->hub = (*result)->hub;
+    slot->size = (*result)->data.size();
+    slot->slab = std::move(slab);
+    _datagrams->push();
+    _datagrams_pending.release();
+  }
+}
+
+void sensor_pipeline::run_aggregation() {
+  task_watchdog watchdog;
+
+  while (_running) {
+    watchdog.feed();
+
+    if (_aggregation_pending.exchange(false)) {
+      const std::lock_guard lock{_aggregation_mutex};
+      if (_pending_aggregation) {
+        _demultiplexer.set_aggregation(std::move(*_pending_aggregation));
+        _pending_aggregation.reset();
+      }
+    }
+
+    if (!_datagrams_pending.try_acquire_for(aggregation_wait)) {
+      continue;
+    }
+    const auto slot = _datagrams->consumer_slot();
+    if (!slot) {
+      continue;
+    }
+
+    // Taking the slab frees the queue slot before the datagram is parsed
+    const auto hub = slot->hub;
+    const auto size = slot->size;
+    auto slab = std::move(slot->slab);
+    _datagrams->pop();
+
+    const auto completed = [&] {
+      scoped_timer timer{g_read_duration};
+      return _demultiplexer.update(hub, slab.bytes().first(size));
+    }();
+
+    if (!completed) {
+      g_read_failures.increment();
+      ESP_LOGE(TAG, "Failed to read sensor values: %s",
+               spymarine::error_message(completed.error()).c_str());
+      continue;
+    }
+
+    if (_alerts) {
+      _alerts->evaluate(hub, alert_engine::clock::now(),
+                        [this](const alert_event& event) {
+                          g_alert_events.increment();
+                          if (_alert_events->try_push(event)) {
+                            wake_publisher();
+                          } else {
+                            g_alerts_dropped.increment();
+                          }
+                        });
+    }
+
+    if (!*completed) {
+      continue;
+    }
+
+    auto snapshot = _snapshots->producer_slot();
+    if (!snapshot) {
+      g_snapshots_dropped.increment();
+      continue;
+    }
+
+    // Assigning reuses the slot's storage once it has the hub's size
+    const auto due = _demultiplexer.completed_devices(hub);
+    snapshot->hub = hub;
+    snapshot->devices = _demultiplexer.aggregated_devices(hub);
+    snapshot->due.assign(due.begin(), due.end());
+    _snapshots->push();
+    wake_publisher();
+  }
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "alert_rules.hpp"
+#include "buffer_arena.hpp"
+#include "hub_demultiplexer.hpp"
+#include "spsc_queue.hpp"
+
+#include "spymarine/buffer.hpp"
+#include "spymarine/device.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+/*! A completed window of a hub, handed from the aggregation task to the
+ * publisher
+ */
+struct sensor_snapshot {
+  size_t hub;
+
+  /*! The hub's devices with the values of the completed window
+   */
+  std::vector<spymarine::device> devices;
+
+  /*! Flags per device whether its window completed, see
+   * hub_demultiplexer::completed_devices
+   */
+  std::vector<uint8_t> due;
+};
+
+struct sensor_pipeline_config {
+  /*! The ingest and aggregation tasks share a core, leaving the other one
+   * to the Wifi stack and the publisher. Single core chips use core 0.
+   */
+  int core{1};
+
+  int ingest_priority{6};
+  int aggregation_priority{5};
+
+  /*! Longest time the ingest task blocks on the socket, must be shorter
+   * than the task watchdog timeout
+   */
+  std::chrono::milliseconds receive_timeout{1000};
+};
+
+/*! Runs the sensor path of the hub_demultiplexer on two tasks supervised by
+ * the task watchdog: the ingest task receives datagrams and the aggregation
+ * task updates the hubs' devices with them. Completed windows are queued for
+ * the publisher, which takes them with wait_for_snapshot(). The aggregation
+ * task also checks every raw sample against the alert rules and queues the
+ * alert events for the publisher right away.
+ *
+ * Datagrams are received into the slabs of a buffer_arena allocated with the
+ * pipeline and handed to the aggregation task by handle. The tasks are
+ * connected by bounded lock-free queues. If a queue is full the newest
+ * element is dropped and counted, so a slow network or publisher never
+ * blocks receiving.
+ */
+class sensor_pipeline {
+public:
+  static constexpr size_t datagram_capacity = 16;
+  static constexpr size_t snapshot_capacity = 4;
+  static constexpr size_t alert_capacity = 8;
+
+  /*! A slab for each queued datagram plus the ones the ingest and
+   * aggregation tasks work on
+   */
+  static constexpr size_t datagram_slabs = datagram_capacity + 2;
+
+  /*! The alert engine is optional, its hubs must match the
+   * demultiplexer's
+   */
+  sensor_pipeline(hub_demultiplexer& demultiplexer,
+                  sensor_pipeline_config config,
+                  alert_engine* alerts = nullptr);
+  sensor_pipeline(const sensor_pipeline& other) = delete;
+
+  /*! Stops and joins the tasks
+   */
+  ~sensor_pipeline();
+
+  sensor_pipeline& operator=(const sensor_pipeline& other) = delete;
+
+  void start();
+
+  /*! Waits up to the timeout for the next completed window or alert event.
+   * Returns nullptr if there is no completed window, alert events are taken
+   * with take_alert(). The snapshot stays valid until release_snapshot() is
+   * called. Only a single task may take snapshots and alerts.
+   */
+  const sensor_snapshot* wait_for_snapshot(std::chrono::milliseconds timeout);
+  void release_snapshot();
+
+  std::optional<alert_event> take_alert();
+
+  /*! Switches the demultiplexer to the aggregation of the config. It's
+   * applied by the aggregation task before the next datagram, receiving
+   * continues in the meantime.
+   */
+  void set_aggregation(aggregation_config config);
+
+private:
+  struct datagram {
+    size_t hub;
+    size_t size;
+    buffer_arena::handle slab;
+  };
+
+  void run_ingest();
+  void run_aggregation();
+  void wake_publisher();
+
+  hub_demultiplexer& _demultiplexer;
+  sensor_pipeline_config _config;
+  buffer_arena _datagram_arena;
+  alert_engine* _alerts;
+
+  std::unique_ptr<spsc_queue<datagram, datagram_capacity>> _datagrams;
+  std::unique_ptr<spsc_queue<sensor_snapshot, snapshot_capacity>> _snapshots;
+  std::unique_ptr<spsc_queue<alert_event, alert_capacity>> _alert_events;
+  spymarine::buffer _discarded{};
+  std::counting_semaphore<datagram_capacity + 1> _datagrams_pending{0};
+
+  /*! Notified whenever a snapshot or alert event is queued, the publisher
+   * waits for either queue to be non-empty
+   */
+  std::mutex _publisher_mutex;
+  std::condition_variable _publisher_wakeup;
+
+  std::mutex _aggregation_mutex;
+  std::optional<aggregation_config> _pending_aggregation;
+  std::atomic<bool> _aggregation_pending{false};
+
+  std::atomic<bool> _running{false};
+  std::thread _ingest_thread;
+  std::thread _aggregation_thread;
+};
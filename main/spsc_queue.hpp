@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+
+/*! Bounded lock-free queue for exactly one producer and one consumer task.
+ *
+ * Elements live in preallocated slots. Large elements can be written and
+ * read in place with producer_slot()/push() and consumer_slot()/pop() to
+ * avoid copies.
+ */
+template <typename T, size_t Capacity> class spsc_queue {
+public:
+  static_assert(Capacity > 0);
+
+  /*! Returns the slot the producer writes the next element to or nullptr if
+   * the queue is full. The element becomes visible to the consumer with
+   * push().
+   */
+  T* producer_slot() {
+    const auto tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == Capacity) {
+      return nullptr;
+    }
+    return &_slots[tail % Capacity];
+  }
+
+  void push() { _tail.fetch_add(1, std::memory_order_release); }
+
+  bool try_push(T value) {
+    auto slot = producer_slot();
+    if (!slot) {
+      return false;
+    }
+    *slot = std::move(value);
+    push();
+    return true;
+  }
+
+  /*! Returns the oldest element or nullptr if the queue is empty. The slot
+   * is released to the producer with pop().
+   */
+  T* consumer_slot() {
+    const auto head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &_slots[head % Capacity];
+  }
+
+  void pop() { _head.fetch_add(1, std::memory_order_release); }
+
+  std::optional<T> try_pop() {
+    auto slot = consumer_slot();
+    if (!slot) {
+      return std::nullopt;
+    }
+    auto value = std::move(*slot);
+    pop();
+    return value;
+  }
+
+  size_t size() const {
+    return _tail.load(std::memory_order_acquire) -
+           _head.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  std::array<T, Capacity> _slots{};
+  alignas(64) std::atomic<size_t> _head{0};
+  alignas(64) std::atomic<size_t> _tail{0};
+};
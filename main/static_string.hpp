@@ -0,0 +1,38 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/*! A string built at compile time and stored without a null terminator
+ */
+template <size_t N> struct static_string {
+  std::array<char, N> data{};
+
+  constexpr std::string_view view() const { return {data.data(), N}; }
+  constexpr operator std::string_view() const { return view(); }
+};
+
+/*! Turns the std::string returned by the constexpr callable into a
+ * static_string of exactly its size. The std::string only exists during
+ * compilation.
+ */
+template <auto Make> constexpr auto make_static_string() {
+  constexpr auto size = Make().size();
+  static_string<size> result;
+  const auto text = Make();
+  std::copy(text.begin(), text.end(), result.data.begin());
+  return result;
+}
+
+/*! Concatenates the string views at compile time
+ */
+template <std::string_view const&... Parts> constexpr auto concat() {
+  return make_static_string<[] {
+    std::string result;
+    (result.append(Parts), ...);
+    return result;
+  }>();
+}
@@ -0,0 +1,89 @@
+#include "subscription_table.hpp"
+
+#include <algorithm>
+
+namespace {
+
+bool has_wildcard(std::string_view filter) {
+  return filter.find_first_of("+#") != std::string_view::npos;
+}
+
+} // namespace
+
+bool topic_matches(std::string_view filter, std::string_view topic) {
+  // Topics starting with '$' aren't matched by wildcards at the first level
+  if (!topic.empty() && topic.front() == '$' && !filter.empty() &&
+      (filter.front() == '+' || filter.front() == '#')) {
+    return false;
+  }
+
+  while (true) {
+    const auto filter_end = filter.find('/');
+    const auto filter_level = filter.substr(0, filter_end);
+
+    if (filter_level == "#") {
+      return true;
+    }
+
+    const auto topic_end = topic.find('/');
+    const auto topic_level = topic.substr(0, topic_end);
+
+    if (filter_level != "+" && filter_level != topic_level) {
+      return false;
+    }
+
+    const auto filter_done = filter_end == std::string_view::npos;
+    const auto topic_done = topic_end == std::string_view::npos;
+    if (filter_done || topic_done) {
+      // "a/#" also matches "a"
+      return filter_done == topic_done ||
+             (topic_done && filter.substr(filter_end + 1) == "#");
+    }
+
+    filter.remove_prefix(filter_end + 1);
+    topic.remove_prefix(topic_end + 1);
+  }
+}
+
+subscription_table subscription_table::with(std::string filter,
+                                            subscribe_callback callback) const {
+  auto result = *this;
+  if (has_wildcard(filter)) {
+    auto it = std::find_if(
+        result._wildcards.begin(), result._wildcards.end(),
+        [&](const auto& subscription) { return subscription.first == filter; });
+    if (it != result._wildcards.end()) {
+      it->second = std::move(callback);
+    } else {
+      result._wildcards.emplace_back(std::move(filter), std::move(callback));
+    }
+  } else {
+    result._exact.insert_or_assign(std::move(filter), std::move(callback));
+  }
+  return result;
+}
+
+subscription_table
+subscription_table::without(const std::string_view filter) const {
+  auto result = *this;
+  if (auto it = result._exact.find(filter); it != result._exact.end()) {
+    result._exact.erase(it);
+  }
+  std::erase_if(result._wildcards, [&](const auto& subscription) {
+    return subscription.first == filter;
+  });
+  return result;
+}
+
+void subscription_table::dispatch(const std::string_view topic,
+                                  const std::string_view data) const {
+  if (auto it = _exact.find(topic); it != _exact.end()) {
+    it->second(data);
+  }
+
+  for (const auto& [filter, callback] : _wildcards) {
+    if (topic_matches(filter, topic)) {
+      callback(data);
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "string_hash.hpp"
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using subscribe_callback = std::function<void(std::string_view)>;
+
+/*! Returns true if the topic matches the MQTT topic filter, which can
+ * contain the single level wildcard '+' and the multi level wildcard '#'
+ */
+bool topic_matches(std::string_view filter, std::string_view topic);
+
+/*! Immutable routing table from topic filters to callbacks. Modifications
+ * return a new table so that a table can be shared with the dispatching
+ * task without locking.
+ */
+class subscription_table {
+public:
+  /*! Returns a copy of the table with the callback registered for the
+   * filter, replacing a previous callback for the same filter
+   */
+  subscription_table with(std::string filter,
+                          subscribe_callback callback) const;
+
+  /*! Returns a copy of the table without the filter
+   */
+  subscription_table without(std::string_view filter) const;
+
+  /*! Calls the callback of every filter that matches the topic
+   */
+  void dispatch(std::string_view topic, std::string_view data) const;
+
+  /*! Calls the function with each registered filter
+   */
+  template <typename Function> void for_each_filter(Function&& function) const {
+    for (const auto& [filter, callback] : _exact) {
+      function(std::string_view{filter});
+    }
+    for (const auto& [filter, callback] : _wildcards) {
+      function(std::string_view{filter});
+    }
+  }
+
+  size_t size() const { return _exact.size() + _wildcards.size(); }
+
+private:
+  std::unordered_map<std::string, subscribe_callback, string_hash,
+                     std::equal_to<>>
+      _exact;
+  std::vector<std::pair<std::string, subscribe_callback>> _wildcards;
+};
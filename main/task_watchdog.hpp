@@ -0,0 +1,36 @@
+#pragma once
+
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#include "esp_task_wdt.h"
+#endif
+
+/*! Subscribes the calling task to the task watchdog while it exists. The
+ * task has to call feed() more often than CONFIG_ESP_TASK_WDT_TIMEOUT_S,
+ * otherwise the watchdog reports it as stalled and, with
+ * CONFIG_ESP_TASK_WDT_PANIC, restarts the chip. Does nothing on the host.
+ */
+class task_watchdog {
+public:
+  task_watchdog() {
+#ifdef ESP_PLATFORM
+    ESP_ERROR_CHECK(esp_task_wdt_add(nullptr));
+#endif
+  }
+
+  task_watchdog(const task_watchdog& other) = delete;
+
+  ~task_watchdog() {
+#ifdef ESP_PLATFORM
+    esp_task_wdt_delete(nullptr);
+#endif
+  }
+
+  task_watchdog& operator=(const task_watchdog& other) = delete;
+
+  void feed() {
+#ifdef ESP_PLATFORM
+    esp_task_wdt_reset();
+#endif
+  }
+};
@@ -0,0 +1,140 @@
+#include "udp_capture.hpp"
+#include "device_serialization.hpp"
+
+#include "esp_log.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+namespace {
+
+constexpr auto TAG = "udp_capture";
+
+constexpr std::array<uint8_t, 4> capture_magic{'S', 'M', 'C', 'P'};
+
+template <size_t Size> std::array<uint8_t, Size> to_le(uint32_t value) {
+  std::array<uint8_t, Size> bytes;
+  for (size_t i = 0; i < Size; i++) {
+    bytes[i] = uint8_t(value >> (8 * i));
+  }
+  return bytes;
+}
+
+uint32_t from_le(std::span<const uint8_t> bytes) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    value |= uint32_t(bytes[i]) << (8 * i);
+  }
+  return value;
+}
+
+bool read_bytes(std::FILE* file, std::span<uint8_t> data) {
+  return std::fread(data.data(), 1, data.size(), file) == data.size();
+}
+
+} // namespace
+
+udp_capture_writer::udp_capture_writer(std::FILE* file,
+                                       std::span<const cached_devices> hubs)
+    : _file{file} {
+  write_bytes(capture_magic);
+  write_bytes(std::array<uint8_t, 2>{udp_capture_version,
+                                     uint8_t(hubs.size())});
+  for (const auto& hub : hubs) {
+    const auto devices = serialize_devices(hub.devices);
+    write_bytes(to_le<4>(hub.ip));
+    write_bytes(to_le<2>(uint32_t(devices.size())));
+    write_bytes(devices);
+  }
+}
+
+void udp_capture_writer::write(const size_t hub,
+                               std::span<const uint8_t> datagram,
+                               const clock::time_point time) {
+  const auto delay =
+      _last_time ? std::chrono::duration_cast<std::chrono::microseconds>(
+                       time - *_last_time)
+                       .count()
+                 : 0;
+  _last_time = time;
+
+  write_bytes(to_le<4>(uint32_t(std::clamp<int64_t>(
+      delay, 0, std::numeric_limits<uint32_t>::max()))));
+  write_bytes(std::array<uint8_t, 1>{uint8_t(hub)});
+  write_bytes(to_le<2>(uint32_t(datagram.size())));
+  write_bytes(datagram);
+  _records++;
+}
+
+void udp_capture_writer::write_bytes(std::span<const uint8_t> data) {
+  if (_good &&
+      std::fwrite(data.data(), 1, data.size(), _file) != data.size()) {
+    ESP_LOGE(TAG, "Failed to write the capture, it's truncated");
+    _good = false;
+  }
+}
+
+udp_capture_reader::udp_capture_reader(std::FILE* file,
+                                       std::vector<cached_devices> hubs,
+                                       const long first_record)
+    : _file{file}, _hubs{std::move(hubs)}, _first_record{first_record} {}
+
+std::optional<udp_capture_record> udp_capture_reader::next() {
+  std::array<uint8_t, 7> header;
+  if (!read_bytes(_file, header)) {
+    return std::nullopt;
+  }
+
+  const auto hub = size_t(header[4]);
+  const auto size = size_t(from_le(std::span{header}.subspan(5, 2)));
+  if (hub >= _hubs.size() || size > _buffer.size() ||
+      !read_bytes(_file, std::span{_buffer}.first(size))) {
+    return std::nullopt;
+  }
+
+  return udp_capture_record{
+      .delay = std::chrono::microseconds{
+          from_le(std::span{header}.first(4))},
+      .hub = hub,
+      .data = std::span{_buffer}.first(size),
+  };
+}
+
+void udp_capture_reader::rewind() {
+  std::fseek(_file, _first_record, SEEK_SET);
+}
+
+std::optional<udp_capture_reader> open_udp_capture(std::FILE* file) {
+  std::array<uint8_t, 6> header;
+  if (!read_bytes(file, header) ||
+      !std::equal(capture_magic.begin(), capture_magic.end(),
+                  header.begin()) ||
+      header[4] != udp_capture_version) {
+    return std::nullopt;
+  }
+
+  std::vector<cached_devices> hubs;
+  for (size_t i = 0; i < header[5]; i++) {
+    std::array<uint8_t, 6> hub_header;
+    if (!read_bytes(file, hub_header)) {
+      return std::nullopt;
+    }
+
+    std::vector<uint8_t> data(from_le(std::span{hub_header}.subspan(4, 2)));
+    if (!read_bytes(file, data)) {
+      return std::nullopt;
+    }
+    auto devices = deserialize_devices(data);
+    if (!devices) {
+      return std::nullopt;
+    }
+
+    hubs.push_back({
+        .ip = from_le(std::span{hub_header}.first(4)),
+        .devices = std::move(*devices),
+    });
+  }
+
+  return udp_capture_reader{file, std::move(hubs), std::ftell(file)};
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "device_cache.hpp"
+
+#include "spymarine/buffer.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <span>
+#include <vector>
+
+/*! Incremented whenever the file format changes, older captures are
+ * rejected by open_udp_capture
+ */
+constexpr uint8_t udp_capture_version = 1;
+
+// Layout, little endian: the magic "SMCP", the version (u8) and hub count
+// (u8) followed by the hubs. Each hub consists of its IP (u32), the size of
+// its serialized devices (u16) and the devices as written by
+// serialize_devices. The datagrams follow as records of the microseconds
+// since the previous record (u32), the hub index (u8), the datagram size
+// (u16) and the datagram.
+
+/*! Writes the sensor state datagrams received from the hubs with their
+ * timing to a capture file, see hub_demultiplexer::set_capture
+ */
+class udp_capture_writer {
+public:
+  using clock = std::chrono::steady_clock;
+
+  /*! Writes the header with the hubs' devices. The file stays owned by the
+   * caller.
+   */
+  udp_capture_writer(std::FILE* file, std::span<const cached_devices> hubs);
+  udp_capture_writer(const udp_capture_writer& other) = delete;
+
+  udp_capture_writer& operator=(const udp_capture_writer& other) = delete;
+
+  void write(size_t hub, std::span<const uint8_t> datagram,
+             clock::time_point time);
+
+  /*! False once a write failed, the capture is truncated then
+   */
+  bool good() const { return _good; }
+
+  size_t records() const { return _records; }
+
+private:
+  void write_bytes(std::span<const uint8_t> data);
+
+  std::FILE* _file;
+  bool _good{true};
+  size_t _records{0};
+  std::optional<clock::time_point> _last_time;
+};
+
+/*! A datagram read from a capture
+ */
+struct udp_capture_record {
+  /*! Time since the previous record was received
+   */
+  std::chrono::microseconds delay;
+
+  size_t hub;
+  std::span<const uint8_t> data;
+};
+
+/*! Reads the records of a capture file written by udp_capture_writer
+ */
+class udp_capture_reader {
+public:
+  /*! The hubs and their devices, without sensor values, at the time of the
+   * capture
+   */
+  const std::vector<cached_devices>& hubs() const { return _hubs; }
+
+  /*! Returns the next record, which stays valid until the next call, or
+   * std::nullopt at the end of the capture
+   */
+  std::optional<udp_capture_record> next();
+
+  /*! Starts again with the first record
+   */
+  void rewind();
+
+private:
+  friend std::optional<udp_capture_reader> open_udp_capture(std::FILE* file);
+
+  udp_capture_reader(std::FILE* file, std::vector<cached_devices> hubs,
+                     long first_record);
+
+  std::FILE* _file;
+  std::vector<cached_devices> _hubs;
+  long _first_record;
+  spymarine::buffer _buffer{};
+};
+
+/*! Reads the header of the capture. Returns std::nullopt if the file isn't a
+ * capture of this version. The file stays owned by the caller.
+ */
+std::optional<udp_capture_reader> open_udp_capture(std::FILE* file);
@@ -1,16 +1,31 @@
 #include "wifi_connector.hpp"
+#include "metrics.hpp"
 #include "wifi_utils.hpp"
 
 #include "esp_err.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "esp_timer.h"
 #include "esp_wifi.h"
 
+#include <algorithm>
+#include <cinttypes>
+
 namespace {
 
 const char* TAG = "wifi_connector";
 
+keyed_counter g_wifi_disconnects{"wifi_disconnects"};
+
+constexpr histogram::bounds reconnect_bounds_ms{
+    100, 300, 1'000, 3'000, 10'000, 30'000, 60'000, 180'000, 600'000};
+
+histogram g_wifi_reconnect_pinned{"wifi_reconnect_pinned", "ms",
+                                  reconnect_bounds_ms};
+histogram g_wifi_reconnect_scan{"wifi_reconnect_scan", "ms",
+                                reconnect_bounds_ms};
+
 template <size_t N>
 void copy_string(uint8_t (&target)[N], const std::string_view str) {
   if (N < str.size() + 1) {
@@ -74,11 +89,15 @@ void wifi_connected_promise::event_handler(void* arg,
   }
 }
 
-wifi_connector::wifi_connector(std::string_view ssid, std::string_view password)
-    : wifi_connector{create_wifi_sta_config(ssid, password)} {}
+wifi_connector::wifi_connector(std::string_view ssid, std::string_view password,
+                               wifi_reconnect_config reconnect_config)
+    : wifi_connector{create_wifi_sta_config(ssid, password), reconnect_config} {
+}
 
-wifi_connector::wifi_connector(wifi_sta_config_t wifi_sta_config)
-    : _esp_netif{esp_netif_create_default_wifi_sta()} {
+wifi_connector::wifi_connector(wifi_sta_config_t wifi_sta_config,
+                               wifi_reconnect_config reconnect_config)
+    : _esp_netif{esp_netif_create_default_wifi_sta()},
+      _policy{reconnect_config, esp_random()} {
   ESP_LOGI(TAG, "Starting wifi...");
 
   ESP_ERROR_CHECK(esp_event_handler_instance_register(
@@ -117,12 +136,52 @@ wifi_connected_promise wifi_connector::make_connected_promise() {
   return wifi_connected_promise{};
 }
 
+void wifi_connector::set_access_point(const wifi_access_point& access_point) {
+  _policy.set_access_point(access_point);
+}
+
+std::optional<wifi_access_point>
+wifi_connector::connected_access_point() const {
+  wifi_ap_record_t record;
+  if (esp_wifi_sta_get_ap_info(&record) != ESP_OK) {
+    return std::nullopt;
+  }
+
+  wifi_access_point access_point;
+  std::copy(std::begin(record.bssid), std::end(record.bssid),
+            access_point.bssid.begin());
+  access_point.channel = record.primary;
+  return access_point;
+}
+
 void wifi_connector::start() {
+  apply_strategy(
+      _policy.start(wifi_reconnect_policy::clock::now()).strategy);
   ESP_ERROR_CHECK(esp_wifi_start());
 
   ESP_LOGI(TAG, "Wifi started");
 }
 
+void wifi_connector::on_station_connected(
+    const wifi_access_point& access_point) {
+  const auto result =
+      _policy.on_connected(access_point, wifi_reconnect_policy::clock::now());
+  if (!result) {
+    return;
+  }
+
+  auto& target = result->strategy == wifi_reconnect_strategy::pinned
+                     ? g_wifi_reconnect_pinned
+                     : g_wifi_reconnect_scan;
+  target.record(uint32_t(result->duration.count()));
+
+  ESP_LOGI(TAG,
+           "Wifi connected on channel %u after %lld ms and %" PRIu32
+           " attempts (%s)",
+           unsigned(access_point.channel), result->duration.count(),
+           result->attempts, wifi_reconnect_strategy_string(result->strategy));
+}
+
 void wifi_connector::on_station_disconnected(const wifi_err_reason_t reason) {
   // If we are in the process of stopping the connector we don't want to try
   // and reconnect. The handler is called even if we unregistering it before
@@ -131,12 +190,52 @@ void wifi_connector::on_station_disconnected(const wifi_err_reason_t reason) {
     return;
   }
 
+  g_wifi_disconnects.increment(uint16_t(reason));
   ESP_LOGI(TAG, "Wifi disconnected: %s", wifi_disconnect_reason_string(reason));
-  ESP_LOGI(TAG, "Attempting to reconnect in %lld seconds",
-           retry_interval.count());
+
+  const auto attempt = _policy.on_disconnected(
+      wifi_disconnect_reason_kind(reason), wifi_reconnect_policy::clock::now());
+  apply_strategy(attempt.strategy);
+  schedule_reconnect(attempt.delay);
+}
+
+void wifi_connector::apply_strategy(const wifi_reconnect_strategy strategy) {
+  const auto pin = strategy == wifi_reconnect_strategy::pinned;
+  if (pin == _access_point_pinned) {
+    return;
+  }
+
+  wifi_config_t wifi_config{};
+  ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+
+  if (pin) {
+    const auto& access_point = *_policy.access_point();
+    std::copy(access_point.bssid.begin(), access_point.bssid.end(),
+              wifi_config.sta.bssid);
+    wifi_config.sta.bssid_set = true;
+    wifi_config.sta.channel = access_point.channel;
+  } else {
+    // The cached access point may have moved to another channel or be gone
+    // entirely, so scan for the network
+    ESP_LOGI(TAG, "Falling back to scanning for the network");
+    wifi_config.sta.bssid_set = false;
+    wifi_config.sta.channel = 0;
+  }
+
+  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+  _access_point_pinned = pin;
+}
+
+void wifi_connector::schedule_reconnect(const std::chrono::milliseconds delay) {
+  if (delay.count() == 0) {
+    connect_wifi();
+    return;
+  }
+
+  ESP_LOGI(TAG, "Attempting to reconnect in %lld ms", delay.count());
 
   const auto timeout_us =
-      std::chrono::duration_cast<std::chrono::microseconds>(retry_interval);
+      std::chrono::duration_cast<std::chrono::microseconds>(delay);
   const auto err =
       esp_timer_start_once(_reconnect_timer_handle, timeout_us.count());
 
@@ -170,6 +269,15 @@ void wifi_connector::event_handler(void* arg, esp_event_base_t event_base,
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
     ESP_LOGI(TAG, "Connecting to wifi...");
     connect_wifi();
+  } else if (event_base == WIFI_EVENT &&
+             event_id == WIFI_EVENT_STA_CONNECTED) {
+    const auto connected_event =
+        static_cast<wifi_event_sta_connected_t*>(event_data);
+    wifi_access_point access_point;
+    std::copy(std::begin(connected_event->bssid),
+              std::end(connected_event->bssid), access_point.bssid.begin());
+    access_point.channel = connected_event->channel;
+    this_->on_station_connected(access_point);
   } else if (event_base == WIFI_EVENT &&
              event_id == WIFI_EVENT_STA_DISCONNECTED) {
     const auto disconnected_event =
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "wifi_reconnect_policy.hpp"
+
 #include "esp_event_base.h"
 #include "esp_netif_types.h"
 #include "esp_timer.h"
@@ -7,7 +9,9 @@
 
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <future>
+#include <optional>
 #include <string_view>
 
 class wifi_connected_promise {
@@ -17,6 +21,13 @@ public:
 
   void wait();
 
+  /*! Returns false if the station didn't get an address in time
+   */
+  template <typename Rep, typename Period>
+  bool wait_for(std::chrono::duration<Rep, Period> timeout) {
+    return _future.wait_for(timeout) == std::future_status::ready;
+  }
+
 private:
   static void event_handler(void* arg, esp_event_base_t eventBase,
                             int32_t eventId, void* eventData);
@@ -28,28 +39,40 @@ private:
 };
 
 /*! A simple Wifi connector that tries to establish a connection to the given
- * Wifi. Continuously attempts to reconnect at intervals defined by
- * retry_interval if the WiFi network disconnects, regardless of the
- * disconnection reason.
+ * Wifi. Continuously attempts to reconnect if the WiFi network disconnects,
+ * as decided by a wifi_reconnect_policy. The time to reconnect is recorded
+ * per strategy in the wifi_reconnect_pinned and wifi_reconnect_scan metrics.
  */
 class wifi_connector {
 public:
-  static constexpr std::chrono::seconds retry_interval{10};
-
-  wifi_connector(std::string_view ssid, std::string_view password);
-  explicit wifi_connector(wifi_sta_config_t wifi_config);
+  wifi_connector(std::string_view ssid, std::string_view password,
+                 wifi_reconnect_config reconnect_config = {});
+  wifi_connector(wifi_sta_config_t wifi_config,
+                 wifi_reconnect_config reconnect_config);
   wifi_connector(const wifi_connector& other) = delete;
 
   ~wifi_connector();
 
   wifi_connected_promise make_connected_promise();
 
+  /*! Connects to the given access point directly, skipping the scan. Falls
+   * back to a regular scan if the connection fails repeatedly. Must be called
+   * before start().
+   */
+  void set_access_point(const wifi_access_point& access_point);
+
+  /*! Returns the access point the station is currently connected to */
+  std::optional<wifi_access_point> connected_access_point() const;
+
   void start();
 
   wifi_connector& operator=(const wifi_connector& other) = delete;
 
 private:
+  void on_station_connected(const wifi_access_point& access_point);
   void on_station_disconnected(wifi_err_reason_t reason);
+  void apply_strategy(wifi_reconnect_strategy strategy);
+  void schedule_reconnect(std::chrono::milliseconds delay);
 
   void create_reconnect_timer();
   void delete_reconnect_timer();
@@ -63,4 +86,6 @@ private:
   esp_event_handler_instance_t _instance_any_id{nullptr};
   esp_timer_handle_t _reconnect_timer_handle;
   std::atomic<bool> _stopping{false};
+  wifi_reconnect_policy _policy;
+  bool _access_point_pinned{false};
 };
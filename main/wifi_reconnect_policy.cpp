@@ -0,0 +1,120 @@
+#include "wifi_reconnect_policy.hpp"
+
+#include <algorithm>
+
+wifi_reconnect_policy::wifi_reconnect_policy(wifi_reconnect_config config,
+                                             uint32_t seed)
+    : _config{config}, _random{seed} {}
+
+void wifi_reconnect_policy::set_access_point(
+    const wifi_access_point& access_point) {
+  _access_point = access_point;
+  _pinned_failures = 0;
+}
+
+wifi_reconnect_attempt
+wifi_reconnect_policy::start(const clock::time_point now) {
+  _connected = false;
+  _outage_start = now;
+  _failures = 0;
+  _strategy = _access_point ? wifi_reconnect_strategy::pinned
+                            : wifi_reconnect_strategy::scan;
+  return {std::chrono::milliseconds{0}, _strategy};
+}
+
+wifi_reconnect_attempt
+wifi_reconnect_policy::on_disconnected(const wifi_disconnect_kind kind,
+                                       const clock::time_point now) {
+  if (_connected) {
+    _connected = false;
+    _outage_start = now;
+    _failures = 0;
+  } else {
+    if (_strategy == wifi_reconnect_strategy::pinned) {
+      _pinned_failures++;
+    }
+    _failures++;
+  }
+
+  const auto& delays = backoff(kind);
+  auto delay = delays.first;
+  if (_failures > 0) {
+    // Doubling stops at max, also keeps the shift in range
+    delay = delays.initial;
+    for (uint32_t i = 1; i < _failures && delay < delays.max; i++) {
+      delay *= 2;
+    }
+    delay = std::min(delay, delays.max);
+  }
+
+  _strategy = next_strategy(kind);
+  return {jittered(delay), _strategy};
+}
+
+std::optional<wifi_reconnect_result>
+wifi_reconnect_policy::on_connected(const wifi_access_point& access_point,
+                                    const clock::time_point now) {
+  _access_point = access_point;
+  _pinned_failures = 0;
+
+  if (_connected) {
+    return std::nullopt;
+  }
+
+  _connected = true;
+  return wifi_reconnect_result{
+      .duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+          now - _outage_start),
+      .strategy = _strategy,
+      .attempts = _failures + 1,
+  };
+}
+
+const wifi_backoff&
+wifi_reconnect_policy::backoff(const wifi_disconnect_kind kind) const {
+  switch (kind) {
+  case wifi_disconnect_kind::link_lost:
+    return _config.link_lost;
+  case wifi_disconnect_kind::access_point_not_found:
+    return _config.access_point_not_found;
+  case wifi_disconnect_kind::authentication:
+    return _config.authentication;
+  case wifi_disconnect_kind::other:
+    break;
+  }
+  return _config.other;
+}
+
+std::chrono::milliseconds
+wifi_reconnect_policy::jittered(const std::chrono::milliseconds delay) {
+  if (delay.count() == 0 || _config.jitter <= 0.0f) {
+    return delay;
+  }
+
+  std::uniform_real_distribution<float> factor{1.0f - _config.jitter,
+                                               1.0f + _config.jitter};
+  return std::chrono::milliseconds{
+      int64_t(float(delay.count()) * factor(_random))};
+}
+
+wifi_reconnect_strategy
+wifi_reconnect_policy::next_strategy(const wifi_disconnect_kind kind) const {
+  // A missing access point has likely changed its channel, which the
+  // pinned config would never find
+  if (!_access_point || kind == wifi_disconnect_kind::access_point_not_found ||
+      _pinned_failures >= _config.pinned_attempts) {
+    return wifi_reconnect_strategy::scan;
+  }
+  return wifi_reconnect_strategy::pinned;
+}
+
+const char*
+wifi_reconnect_strategy_string(const wifi_reconnect_strategy strategy) {
+  switch (strategy) {
+  case wifi_reconnect_strategy::pinned:
+    return "pinned";
+  case wifi_reconnect_strategy::scan:
+    break;
+  }
+  return "scan";
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <random>
+
+/*! Identifies the access point a station connected to */
+struct wifi_access_point {
+  std::array<uint8_t, 6> bssid;
+  uint8_t channel;
+};
+
+/*! How a connection attempt finds the access point */
+enum class wifi_reconnect_strategy {
+  /*! Connects to the last good access point directly, skipping the scan */
+  pinned,
+
+  /*! Scans all channels for the network */
+  scan,
+};
+
+/*! Groups the Wifi disconnect reasons by how they are best handled */
+enum class wifi_disconnect_kind {
+  /*! The link to a working access point was lost, e.g. a beacon timeout.
+   * Usually recovers right away.
+   */
+  link_lost,
+
+  /*! The access point wasn't found, it may have moved to another channel
+   */
+  access_point_not_found,
+
+  /*! The access point rejected the credentials or the handshake timed out.
+   * Retrying quickly doesn't help and may get the station blocked.
+   */
+  authentication,
+
+  other,
+};
+
+/*! Delays between the attempts after a disconnect. The first attempt waits
+ * for first, the n-th retry for initial * 2^(n-1), at most max.
+ */
+struct wifi_backoff {
+  std::chrono::milliseconds first;
+  std::chrono::milliseconds initial;
+  std::chrono::milliseconds max;
+};
+
+struct wifi_reconnect_config {
+  wifi_backoff link_lost{std::chrono::milliseconds{0},
+                         std::chrono::milliseconds{500},
+                         std::chrono::seconds{30}};
+  wifi_backoff access_point_not_found{std::chrono::seconds{1},
+                                      std::chrono::seconds{2},
+                                      std::chrono::seconds{60}};
+  wifi_backoff authentication{std::chrono::seconds{5},
+                              std::chrono::seconds{10},
+                              std::chrono::minutes{5}};
+  wifi_backoff other{std::chrono::seconds{1}, std::chrono::seconds{2},
+                     std::chrono::seconds{60}};
+
+  /*! Each delay is varied randomly by up to this fraction, so that stations
+   * don't retry in lockstep after an access point restarts
+   */
+  float jitter{0.25f};
+
+  /*! Failed attempts with the pinned access point before scanning
+   */
+  uint32_t pinned_attempts{3};
+};
+
+struct wifi_reconnect_attempt {
+  std::chrono::milliseconds delay;
+  wifi_reconnect_strategy strategy;
+};
+
+struct wifi_reconnect_result {
+  /*! Time from the disconnect, or from start() for the first connection,
+   * until the station connected
+   */
+  std::chrono::milliseconds duration;
+
+  wifi_reconnect_strategy strategy;
+  uint32_t attempts;
+};
+
+/*! Decides when and how to reconnect after the Wifi disconnected. Backs off
+ * exponentially with jitter depending on the disconnect reason and connects
+ * to the last good access point directly until it failed repeatedly.
+ *
+ * Doesn't depend on the Wifi driver, see wifi_connector for applying the
+ * attempts.
+ */
+class wifi_reconnect_policy {
+public:
+  using clock = std::chrono::steady_clock;
+
+  wifi_reconnect_policy(wifi_reconnect_config config, uint32_t seed);
+
+  /*! Sets the last good access point, e.g. one cached across a restart
+   */
+  void set_access_point(const wifi_access_point& access_point);
+  const std::optional<wifi_access_point>& access_point() const {
+    return _access_point;
+  }
+
+  /*! Returns the first connection attempt, which is immediate
+   */
+  wifi_reconnect_attempt start(clock::time_point now);
+
+  /*! Returns the next attempt after the connection was lost or an attempt
+   * failed
+   */
+  wifi_reconnect_attempt on_disconnected(wifi_disconnect_kind kind,
+                                         clock::time_point now);
+
+  /*! Remembers the access point as the last good one and resets the
+   * backoff. Returns how long the connection took, or nothing if the
+   * station was already connected.
+   */
+  std::optional<wifi_reconnect_result>
+  on_connected(const wifi_access_point& access_point, clock::time_point now);
+
+private:
+  const wifi_backoff& backoff(wifi_disconnect_kind kind) const;
+  std::chrono::milliseconds jittered(std::chrono::milliseconds delay);
+  wifi_reconnect_strategy next_strategy(wifi_disconnect_kind kind) const;
+
+  wifi_reconnect_config _config;
+  std::minstd_rand _random;
+  std::optional<wifi_access_point> _access_point;
+
+  bool _connected{false};
+  clock::time_point _outage_start{};
+  wifi_reconnect_strategy _strategy{wifi_reconnect_strategy::scan};
+  uint32_t _failures{0};
+  uint32_t _pinned_failures{0};
+};
+
+const char* wifi_reconnect_strategy_string(wifi_reconnect_strategy strategy);
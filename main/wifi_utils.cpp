@@ -1,8 +1,13 @@
 #include "wifi_utils.hpp"
 
 #include "esp_event.h"
+#include "esp_netif.h"
 #include "esp_netif_types.h"
 
+#include "lwip/etharp.h"
+
+#include <algorithm>
+
 const char* wifi_disconnect_reason_string(const wifi_err_reason_t reason) {
   switch (reason) {
   case WIFI_REASON_UNSPECIFIED:
@@ -129,3 +134,65 @@ const char* wifi_disconnect_reason_string(const wifi_err_reason_t reason) {
 
   return "unknown";
 }
+
+wifi_disconnect_kind
+wifi_disconnect_reason_kind(const wifi_err_reason_t reason) {
+  switch (reason) {
+  case WIFI_REASON_BEACON_TIMEOUT:
+  case WIFI_REASON_ASSOC_LEAVE:
+  case WIFI_REASON_AUTH_LEAVE:
+  case WIFI_REASON_AUTH_EXPIRE:
+  case WIFI_REASON_ASSOC_EXPIRE:
+  case WIFI_REASON_NOT_AUTHED:
+  case WIFI_REASON_NOT_ASSOCED:
+  case WIFI_REASON_AP_TSF_RESET:
+  case WIFI_REASON_ROAMING:
+  case WIFI_REASON_BSS_TRANSITION_DISASSOC:
+  case WIFI_REASON_SA_QUERY_TIMEOUT:
+    return wifi_disconnect_kind::link_lost;
+  case WIFI_REASON_NO_AP_FOUND:
+  case WIFI_REASON_NO_AP_FOUND_W_COMPATIBLE_SECURITY:
+  case WIFI_REASON_NO_AP_FOUND_IN_AUTHMODE_THRESHOLD:
+  case WIFI_REASON_NO_AP_FOUND_IN_RSSI_THRESHOLD:
+    return wifi_disconnect_kind::access_point_not_found;
+  case WIFI_REASON_AUTH_FAIL:
+  case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+  case WIFI_REASON_HANDSHAKE_TIMEOUT:
+  case WIFI_REASON_MIC_FAILURE:
+  case WIFI_REASON_802_1X_AUTH_FAILED:
+  case WIFI_REASON_CONNECTION_FAIL:
+    return wifi_disconnect_kind::authentication;
+  default:
+    break;
+  }
+
+  return wifi_disconnect_kind::other;
+}
+
+std::optional<std::array<uint8_t, 6>> neighbor_mac_address(const uint32_t ip) {
+  struct lookup {
+    ip4_addr_t ip;
+    std::optional<std::array<uint8_t, 6>> mac;
+  };
+
+  lookup result{};
+  ip4_addr_set_u32(&result.ip, lwip_htonl(ip));
+
+  // The ARP table belongs to the TCP/IP task
+  const auto find = [](void* context) -> esp_err_t {
+    auto& result = *static_cast<lookup*>(context);
+    eth_addr* mac = nullptr;
+    const ip4_addr_t* ip = nullptr;
+    if (etharp_find_addr(nullptr, &result.ip, &mac, &ip) < 0) {
+      return ESP_ERR_NOT_FOUND;
+    }
+    result.mac.emplace();
+    std::copy_n(mac->addr, result.mac->size(), result.mac->begin());
+    return ESP_OK;
+  };
+
+  if (esp_netif_tcpip_exec(find, &result) != ESP_OK) {
+    return std::nullopt;
+  }
+  return result.mac;
+}
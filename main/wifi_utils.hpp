@@ -1,8 +1,23 @@
 #pragma once
 
+#include "wifi_reconnect_policy.hpp"
+
+#include <array>
+#include <cstdint>
 #include <future>
+#include <optional>
 
 #include "esp_event_base.h"
 #include "esp_wifi_types_generic.h"
 
 const char* wifi_disconnect_reason_string(const wifi_err_reason_t reason);
+
+/*! Groups the reason for the reconnect policy */
+wifi_disconnect_kind
+wifi_disconnect_reason_kind(const wifi_err_reason_t reason);
+
+/*! Looks up the MAC address of a host in the local network in the ARP
+ * table, the IP is in host byte order. Returns std::nullopt if the host
+ * wasn't contacted recently.
+ */
+std::optional<std::array<uint8_t, 6>> neighbor_mac_address(uint32_t ip);